@@ -4,37 +4,96 @@
 #include <iostream>
 #include <queue>
 #include <iomanip>
+#include <vector>
+#include <type_traits>
+#include <iterator>
+#include <algorithm>
+
+#include "TreeIO.h"
+#include "TreeMetrics.h"
+#include "TreeStats.h"
 
 using namespace std;
 
 namespace Viclib
 {
 
+/*	结点不保存高度，只保存平衡因子（右子树高度减左子树高度，只能是-1、0、1），存在左孩子指针的最低两位
+ *	结点至少按指针大小对齐，地址最低两位恒为0；uint64_t的结点从32字节缩小到24字节
+ *	child(right)把两个孩子都读出来再按位选择，查找时不产生随机走向的条件跳转
+ */
 template <typename T>
 class AVLTreeNode
 {
+private:
+	uintptr_t mChildren[2];		// 左、右孩子地址；左孩子的最低两位是平衡因子，按两位补码存放（-1存为3）
+
 public:
 	T key;
-	uint16_t height;
-	AVLTreeNode* left;
-	AVLTreeNode* right;
 
 	AVLTreeNode(T v, AVLTreeNode* l, AVLTreeNode* r) :
-		key(v), height(0), left(l), right(r) {}
+		mChildren{ reinterpret_cast<uintptr_t>(l), reinterpret_cast<uintptr_t>(r) }, key(v)
+	{
+		static_assert(alignof(AVLTreeNode) >= 4, "node address has no spare low bits for the balance factor");
+	}
+
+	AVLTreeNode* child(bool right) const
+	{
+		uintptr_t const mask = static_cast<uintptr_t>(0) - static_cast<uintptr_t>(right);
+
+		return reinterpret_cast<AVLTreeNode*>((mChildren[0] ^ ((mChildren[0] ^ mChildren[1]) & mask)) & ~static_cast<uintptr_t>(3));
+	}
+
+	AVLTreeNode* left() const
+	{
+		return child(false);
+	}
+
+	AVLTreeNode* right() const
+	{
+		return child(true);
+	}
+
+	void setChild(bool right, AVLTreeNode* child)
+	{
+		mChildren[right] = reinterpret_cast<uintptr_t>(child) | (mChildren[right] & 3);
+	}
+
+	void setLeft(AVLTreeNode* left)
+	{
+		setChild(false, left);
+	}
+
+	void setRight(AVLTreeNode* right)
+	{
+		setChild(true, right);
+	}
+
+	int8_t balance() const
+	{
+		return static_cast<int8_t>(static_cast<int8_t>((mChildren[0] & 3) ^ 2) - 2);
+	}
+
+	void setBalance(int8_t balance)
+	{
+		mChildren[0] = (mChildren[0] & ~static_cast<uintptr_t>(3)) | (static_cast<uintptr_t>(balance) & 3);
+	}
 };
 
-template <typename T>
+/*	Stats是统计策略（见TreeStats.h），默认TreeNoStats不统计；换成TreeCountStats后统计旋转、回溯修正的层数和查找的比较次数
+ */
+template <typename T, typename Stats = TreeNoStats>
 class AVLTree
 {
 private:
 	AVLTreeNode<T>* mRoot;
 	uint64_t mCount;
+	uint16_t mHeight;				// 根结点的高度，insert/remove回溯到根时增量维护
+	mutable Stats mStats;			// 查找和旋转是const函数，也要能计数
+	shared_ptr<TreeMetricsSlot> mMetrics;	// attachMetrics()之后才有，每次修改后把O(1)的指标写进去
 
-	void preOrder(AVLTreeNode<T>* tree) const;
-	void inOrder(AVLTreeNode<T>* tree) const;
-	void postOrder(AVLTreeNode<T>* tree) const;
-
-	void levelOrder(AVLTreeNode<T>* tree) const;
+	template <typename F>
+	static bool visit(F& visitor, const T& key);	// visitor可以返回void或bool
 
 	AVLTreeNode<T>* search(AVLTreeNode<T>* tree, T key) const;
 	AVLTreeNode<T>* iterativeSearch(AVLTreeNode<T>* tree, T key) const;
@@ -42,19 +101,22 @@ private:
 	AVLTreeNode<T>* minimum(AVLTreeNode<T>* tree) const;
 	AVLTreeNode<T>* maximum(AVLTreeNode<T>* tree) const;
 
-	AVLTreeNode<T>* llRotation(AVLTreeNode<T>* tree) const;
+	static constexpr uint16_t MAX_HEIGHT = 96;		// 2^64个结点的AVL树高度也不超过92，insert/remove的路径栈用定长数组
+
+	AVLTreeNode<T>* llRotation(AVLTreeNode<T>* tree) const;	// 旋转只用于tree一侧比另一侧高2的时候，返回新的子树根
 	AVLTreeNode<T>* rrRotation(AVLTreeNode<T>* tree) const;
 	AVLTreeNode<T>* lrRotation(AVLTreeNode<T>* tree) const;
 	AVLTreeNode<T>* rlRotation(AVLTreeNode<T>* tree) const;
+	AVLTreeNode<T>* rebalance(AVLTreeNode<T>* tree, int8_t balance) const;	// balance是tree实际的平衡因子±2，结点里存不下
+	void setChild(AVLTreeNode<T>* parent, bool right, AVLTreeNode<T>* child);	// parent为nullptr时替换根结点
 
-	AVLTreeNode<T>* insert(AVLTreeNode<T>* &tree, T key);
-	AVLTreeNode<T>* remove(AVLTreeNode<T>* &tree, AVLTreeNode<T>* del);
+	template <typename Iterator>
+	AVLTreeNode<T>* buildFromSorted(Iterator& it, uint64_t n, uint16_t& height);
 
 	void printGraph(const void* mRoot, uint16_t m_keyStrLen) const;
 	void printTree(AVLTreeNode<T> const* const tree, bool firstNode) const;
 
-	void destroy(AVLTreeNode<T>* &tree) const;
-	uint16_t height(AVLTreeNode<T>* tree) const;
+	void destroy(AVLTreeNode<T>* tree) const;
 
 public:
 	AVLTree();
@@ -66,6 +128,17 @@ public:
 
 	void levelOrder() const;
 
+	template <typename F>
+	bool forEachPreOrder(F&& visitor) const;		// 非递归遍历，visitor(key)返回false时提前结束，返回值表示是否遍历完整棵树
+	template <typename F>
+	bool forEachInOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachPostOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachLevelOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachInRange(const T& lo, const T& hi, F&& visitor) const;	// 按升序访问[lo, hi)内的key
+
 	AVLTreeNode<T>* search(T key) const;			// 递归版
 	AVLTreeNode<T>* iterativeSearch(T key) const;	// 非递归版
 
@@ -75,162 +148,271 @@ public:
 	void insert(T key);
 	bool remove(T key);
 
+	template <typename Iterator>
+	void buildFromSorted(Iterator first, Iterator last);	// 用严格升序的序列重建整棵树，O(n)
+	bool save(const char* path) const;					// 写出带版本号的二进制快照：文件头加升序排列的key
+	bool load(const char* path);						// 映射快照文件后用buildFromSorted()线性重建；失败时本树不变
+
 	void print() const;								// 打印结点关系，谁是谁的结点
 	void printGraph(uint16_t keyStrLen) const;		// 以图形树方式打印关系
 	void printTree() const;
+	bool exportKeys(TreeWriter& writer) const;		// 按升序把全部key写入缓冲区，整块write(2)写出
+	bool exportKeys(int fd, TreeWriter::Format format = TreeWriter::TEXT) const;
+	bool exportKeys(const char* path, TreeWriter::Format format = TreeWriter::TEXT) const;
 
 	void destroy();
 	uint16_t height() const;
 
 	uint64_t getCount() const;
 	bool rootIsNullptr() const;
+	TreeStats stats() const;						// 统计快照，Stats为TreeNoStats时全为0
+	void resetStats();
+	void attachMetrics(const string& name, TreeMetricsRegistry& registry = TreeMetricsRegistry::instance());	// 注册到指标表，之后每次修改都更新指标
+	void publishMetrics() const;					// 立即更新指标；只查找不修改的阶段里，查找计数要靠它才能刷新
 
 	T getRootKey() const;
 };
 
-template <typename T>
-AVLTree<T>::AVLTree() : mRoot(nullptr), mCount(0)
+template <typename T, typename Stats>
+AVLTree<T, Stats>::AVLTree() : mRoot(nullptr), mCount(0), mHeight(0)
 {
 }
 
-template <typename T>
-void AVLTree<T>::preOrder(AVLTreeNode<T>* tree) const	// 前序遍历
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::preOrder() const
 {
-	if ( tree != nullptr )
-	{
-		cout << tree->key << " " << flush;
-		preOrder(tree->left);
-		preOrder(tree->right);
-	}
+	forEachPreOrder([](const T& key) { cout << key << " "; });
+	cout << endl;
 }
 
-template <typename T>
-void AVLTree<T>::preOrder() const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::inOrder() const
 {
-	preOrder(mRoot);
+	forEachInOrder([](const T& key) { cout << key << " "; });
 	cout << endl;
 }
 
-template <typename T>
-void AVLTree<T>::inOrder(AVLTreeNode<T>* tree) const	// 中序遍历
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::postOrder() const
 {
-	if ( tree != nullptr )
-	{
-		inOrder(tree->left);
-		cout << tree->key << " " << flush;
-		inOrder(tree->right);
-	}
+	forEachPostOrder([](const T& key) { cout << key << " "; });
+	cout << endl;
 }
 
-template <typename T>
-void AVLTree<T>::inOrder() const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::levelOrder() const
 {
-	inOrder(mRoot);
+	forEachLevelOrder([](const T& key) { cout << key << " "; });
 	cout << endl;
 }
 
-template <typename T>
-void AVLTree<T>::postOrder(AVLTreeNode<T>* tree) const	// 后续遍历
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::visit(F& visitor, const T& key)
 {
-	if ( tree != nullptr )
+	if constexpr ( is_void<decltype(visitor(key))>::value )		// 返回void的visitor不能提前结束
 	{
-		postOrder(tree->left);
-		postOrder(tree->right);
-		cout << tree->key << " " << flush;
+		visitor(key);
+		return true;
 	}
+	else
+		return static_cast<bool>(visitor(key));
 }
 
-template <typename T>
-void AVLTree<T>::postOrder() const
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::forEachPreOrder(F&& visitor) const
 {
-	postOrder(mRoot);
-	cout << endl;
+	vector<AVLTreeNode<T>*> stack;
+	if ( mRoot != nullptr )
+		stack.push_back(mRoot);
+
+	while ( !stack.empty() )
+	{
+		AVLTreeNode<T>* node = stack.back();
+		stack.pop_back();
+
+		if ( !visit(visitor, node->key) )
+			return false;
+
+		if ( node->right() != nullptr )			// 右孩子先进栈，左子树先访问
+			stack.push_back(node->right());
+		if ( node->left() != nullptr )
+			stack.push_back(node->left());
+	}
+
+	return true;
 }
 
-template <typename T>
-void AVLTree<T>::levelOrder(AVLTreeNode<T>* tree) const	// 广度优先
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::forEachInOrder(F&& visitor) const
 {
-	if ( tree != nullptr )
+	vector<AVLTreeNode<T>*> stack;						// 当前结点到根路径上还没有访问的祖先
+	AVLTreeNode<T>* node = mRoot;
+
+	while ( node != nullptr || !stack.empty() )
 	{
-		queue<AVLTreeNode<T>*> tmp;
-		tmp.push(tree);
+		for ( ; node != nullptr; node = node->left() )
+			stack.push_back(node);
 
-		while( tmp.size() > 0 )
-		{
-			AVLTreeNode<T>* t = tmp.front();
+		node = stack.back();
+		stack.pop_back();
+
+		if ( !visit(visitor, node->key) )
+			return false;
+
+		node = node->right();
+	}
 
-			if ( t->left != nullptr )
-				tmp.push(t->left);
+	return true;
+}
+
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::forEachPostOrder(F&& visitor) const
+{
+	vector<AVLTreeNode<T>*> stack;
+	AVLTreeNode<T>* node = mRoot;
+	AVLTreeNode<T>* last = nullptr;						// 上一个访问的结点，用来判断右子树是否已经访问过
 
-			if ( t->right != nullptr )
-				tmp.push(t->right);
+	while ( node != nullptr || !stack.empty() )
+	{
+		for ( ; node != nullptr; node = node->left() )
+			stack.push_back(node);
 
-			tmp.pop();
+		AVLTreeNode<T>* top = stack.back();
+		if ( top->right() != nullptr && top->right() != last )
+			node = top->right();
+		else
+		{
+			if ( !visit(visitor, top->key) )
+				return false;
 
-			cout << t->key << " " << flush;
+			last = top;
+			stack.pop_back();
 		}
 	}
+
+	return true;
 }
 
-template <typename T>
-void AVLTree<T>::levelOrder() const
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::forEachLevelOrder(F&& visitor) const
 {
-	levelOrder(mRoot);
-	cout << endl;
+	queue<AVLTreeNode<T>*> tmp;
+	if ( mRoot != nullptr )
+		tmp.push(mRoot);
+
+	while ( !tmp.empty() )
+	{
+		AVLTreeNode<T>* node = tmp.front();
+		tmp.pop();
+
+		if ( !visit(visitor, node->key) )
+			return false;
+
+		if ( node->left() != nullptr )
+			tmp.push(node->left());
+		if ( node->right() != nullptr )
+			tmp.push(node->right());
+	}
+
+	return true;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::search(AVLTreeNode<T>* tree, T key) const	// 递归版搜索
+template <typename T, typename Stats>
+template <typename F>
+bool AVLTree<T, Stats>::forEachInRange(const T& lo, const T& hi, F&& visitor) const
+{
+	vector<AVLTreeNode<T>*> stack;						// 只保存不小于lo的祖先，小于lo的结点连同左子树整个跳过
+	AVLTreeNode<T>* node = mRoot;
+
+	while ( node != nullptr || !stack.empty() )
+	{
+		while ( node != nullptr )
+		{
+			if ( node->key < lo )
+				node = node->right();
+			else
+			{
+				stack.push_back(node);
+				node = node->left();
+			}
+		}
+		if ( stack.empty() )						// 剩下的结点都小于lo，比如lo大于最大key
+			return true;
+
+		node = stack.back();
+		stack.pop_back();
+
+		if ( !(node->key < hi) )
+			return true;
+		if ( !visit(visitor, node->key) )
+			return false;
+
+		node = node->right();
+	}
+
+	return true;
+}
+
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::search(AVLTreeNode<T>* tree, T key) const	// 递归版搜索
 {
-	if ( (tree == nullptr) || (tree->key == key) )
+	if ( tree == nullptr )
 		return tree;
 
-	if ( key < tree->key )
-		return search(tree->left, key);
-	else
-		return search(tree->right, key);
+	mStats.comparison();
+	if ( tree->key == key )
+		return tree;
+
+	return search(tree->child(!(key < tree->key)), key);
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::search(T key) const
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::search(T key) const
 {
+	mStats.search();
 	return search(mRoot, key);
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::iterativeSearch(AVLTreeNode<T>* tree, T key) const	// 非递归版搜索
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::iterativeSearch(AVLTreeNode<T>* tree, T key) const	// 非递归版搜索
 {
+	mStats.search();
 	while ( (tree != nullptr) && (tree->key != key) )
 	{
-		if ( key < tree->key )
-			tree = tree->left;
-		else
-			tree = tree->right;
+		mStats.comparison();
+		tree = tree->child(!(key < tree->key));		// 按位选择孩子，随机查找时不会频繁预测失败
 	}
+	if ( tree != nullptr )
+		mStats.comparison();				// 命中的那一次
 
 	return tree;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::iterativeSearch(T key) const
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::iterativeSearch(T key) const
 {
 	return iterativeSearch(mRoot, key);
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::minimum(AVLTreeNode<T>* tree) const
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::minimum(AVLTreeNode<T>* tree) const
 {
 	if ( tree == nullptr )
 		return nullptr;
 
-	while ( tree->left != nullptr )
-		tree = tree->left;
+	while ( tree->left() != nullptr )
+		tree = tree->left();
 
 	return tree;
 }
 
-template <typename T>
-T AVLTree<T>::minimum() const
+template <typename T, typename Stats>
+T AVLTree<T, Stats>::minimum() const
 {
 	AVLTreeNode<T> *ret = minimum(mRoot);
 //	if ( ret == nullptr )
@@ -239,20 +421,20 @@ T AVLTree<T>::minimum() const
 	return ret->key;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::maximum(AVLTreeNode<T>* tree) const
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::maximum(AVLTreeNode<T>* tree) const
 {
 	if ( tree == nullptr )
 		return nullptr;
 
-	while ( tree->right != nullptr )
-		tree = tree->right;
+	while ( tree->right() != nullptr )
+		tree = tree->right();
 
 	return tree;
 }
 
-template <typename T>
-T AVLTree<T>::maximum() const
+template <typename T, typename Stats>
+T AVLTree<T, Stats>::maximum() const
 {
 	AVLTreeNode<T> *ret = maximum(mRoot);
 //	if ( ret == nullptr )
@@ -261,183 +443,256 @@ T AVLTree<T>::maximum() const
 	return ret->key;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::llRotation(AVLTreeNode<T>* tree) const			// 左单旋，旋转前左孩子有孩子右孩子没有
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::llRotation(AVLTreeNode<T>* tree) const			// 左单旋，tree的左子树高2，左孩子不右重
 {
-	AVLTreeNode<T>* ret;
+	AVLTreeNode<T>* ret = tree->left();
 
-	ret = tree->left;
-	tree->left = tree->left->right;
-	ret->right = tree;
+	mStats.rotation();
+	tree->setLeft(ret->right());
+	ret->setRight(tree);
 
-	tree->height = max( height(tree->left), height(tree->right) ) + 1;
-	ret->height = max( height(ret->left), height(ret->right) ) + 1;
+	if ( ret->balance() == 0 )						// 只在删除时出现：旋转后子树高度不变
+	{
+		tree->setBalance(-1);
+		ret->setBalance(1);
+	}
+	else
+	{
+		tree->setBalance(0);
+		ret->setBalance(0);
+	}
 
 	return ret;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::rrRotation(AVLTreeNode<T>* tree) const			// 右单旋，旋转前右孩子有孩子左孩子没有
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::rrRotation(AVLTreeNode<T>* tree) const			// 右单旋，tree的右子树高2，右孩子不左重
 {
-	AVLTreeNode<T>* ret;
+	AVLTreeNode<T>* ret = tree->right();
 
-	ret = tree->right;
-	tree->right = tree->right->left;
-	ret->left = tree;
+	mStats.rotation();
+	tree->setRight(ret->left());
+	ret->setLeft(tree);
 
-	tree->height = max( height(tree->left), height(tree->right) ) + 1;
-	ret->height = max ( height(ret->left), height(ret->right) ) + 1;
+	if ( ret->balance() == 0 )
+	{
+		tree->setBalance(1);
+		ret->setBalance(-1);
+	}
+	else
+	{
+		tree->setBalance(0);
+		ret->setBalance(0);
+	}
 
 	return ret;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::lrRotation(AVLTreeNode<T>* tree) const			// 左右双旋，先右旋，后左旋；tree左孩子的右孩子有后代，tree右孩子没有后代
+/*	双旋直接把孙结点提为子树根，一次写好三个结点的平衡因子，不经过两次单旋的中间状态（中间状态的平衡因子可能是±2，结点里存不下）
+ */
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::lrRotation(AVLTreeNode<T>* tree) const			// 左右双旋，tree的左子树高2，左孩子右重
 {
-	tree->left = rrRotation(tree->left);	// 确保多出的后代在左子树的左子树上
+	AVLTreeNode<T>* left = tree->left();
+	AVLTreeNode<T>* ret = left->right();
+	int8_t balance = ret->balance();
 
-	return llRotation(tree);
+	mStats.doubleRotation();
+	mStats.rotation();							// 双旋按两次单旋计入
+	mStats.rotation();
+	left->setRight(ret->left());
+	tree->setLeft(ret->right());
+	ret->setLeft(left);
+	ret->setRight(tree);
+
+	left->setBalance(balance > 0 ? -1 : 0);
+	tree->setBalance(balance < 0 ? 1 : 0);
+	ret->setBalance(0);
+
+	return ret;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::rlRotation(AVLTreeNode<T>* tree) const			// 右左双旋，先左旋，后右旋；tree右孩子的左孩子有后代，tree左孩子没有后代
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::rlRotation(AVLTreeNode<T>* tree) const			// 右左双旋，tree的右子树高2，右孩子左重
 {
-	tree->right = llRotation(tree->right);	// 确保多出的后代在右子树的右子树上
+	AVLTreeNode<T>* right = tree->right();
+	AVLTreeNode<T>* ret = right->left();
+	int8_t balance = ret->balance();
 
-	return rrRotation(tree);
+	mStats.doubleRotation();
+	mStats.rotation();
+	mStats.rotation();
+	right->setLeft(ret->right());
+	tree->setRight(ret->left());
+	ret->setRight(right);
+	ret->setLeft(tree);
+
+	right->setBalance(balance < 0 ? 1 : 0);
+	tree->setBalance(balance > 0 ? -1 : 0);
+	ret->setBalance(0);
+
+	return ret;
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::insert(AVLTreeNode<T>* &tree, T key)
+template <typename T, typename Stats>
+AVLTreeNode<T>* AVLTree<T, Stats>::rebalance(AVLTreeNode<T>* tree, int8_t balance) const
+{
+	if ( balance < 0 )
+		return (tree->left()->balance() > 0) ? lrRotation(tree) : llRotation(tree);
+	else
+		return (tree->right()->balance() < 0) ? rlRotation(tree) : rrRotation(tree);
+}
+
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::setChild(AVLTreeNode<T>* parent, bool right, AVLTreeNode<T>* child)
+{
+	if ( parent == nullptr )
+		mRoot = child;
+	else
+		parent->setChild(right, child);
+}
+
+/*	自顶向下找到插入位置，途经的结点记在路径栈里，再沿路径自底向上修正平衡因子
+ *	某个祖先的平衡因子变为0，或者做过一次旋转，这棵子树的高度就与插入前相同，更上面的祖先不受影响，立即停止回溯
+ */
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::insert(T key)
 {
-	if ( tree == nullptr )									// 创建新结点，下面的两个else if会最终递归进入此if创建新结点
+	AVLTreeNode<T>* path[MAX_HEIGHT];
+	bool rights[MAX_HEIGHT];								// path[i]往下走的是否是右孩子
+	uint16_t n = 0;
+
+	for ( AVLTreeNode<T>* tree = mRoot; tree != nullptr; ++n )
 	{
-		tree = new AVLTreeNode<T>(key, nullptr, nullptr);
-		++mCount;
+		if ( key < tree->key )
+			rights[n] = false;
+		else if ( key > tree->key )
+			rights[n] = true;
+		else												// 结点重复
+			return;//THROW_EXCEPTION(DuplicateDataException, "Can't create duplicate nodes ...");
+
+		path[n] = tree;
+		tree = tree->child(rights[n]);
 	}
-	else if ( key < tree->key )								// 将新结点交给左子树负责插入
+
+	setChild(n > 0 ? path[n-1] : nullptr, n > 0 && rights[n-1], new AVLTreeNode<T>(key, nullptr, nullptr));
+	++mCount;
+
+	bool grew = true;										// 刚回溯过的子树是否长高了一层
+	while ( grew && n > 0 )
 	{
-		tree->left = insert(tree->left, key);				// 注意更新左结点，因为它可能旋转或是新创建的结点
+		AVLTreeNode<T>* tree = path[--n];
+		int8_t balance = static_cast<int8_t>(tree->balance() + (rights[n] ? 1 : -1));
 
-		if ( height(tree->left) - height(tree->right) == 2)	// 如果插入的左子树超重
+		mStats.fixUp();
+		if ( balance == 0 )									// 矮的一侧长高，子树高度不变
 		{
-			if ( key < tree->left->key )
-				tree = llRotation(tree);					// 如果插入的位置是左孩子的左孩子，左单旋
-			else
-				tree = lrRotation(tree);					// 否则插入的位置是左孩子的右孩子，右单旋；最外层的else保证不会有重复值
+			tree->setBalance(0);
+			grew = false;
 		}
-	}
-	else if ( key > tree->key )								// 将新结点交给右子树负责插入
-	{
-		tree->right = insert(tree->right, key);
-
-		if ( height(tree->right) - height(tree->left) == 2 )
+		else if ( balance == 1 || balance == -1 )			// 原本平衡，子树长高一层，继续向上
+			tree->setBalance(balance);
+		else												// 高的一侧又长高，旋转后恢复插入前的高度
 		{
-			if ( key > tree->right->key )
-				tree = rrRotation(tree);
-			else
-				tree = rlRotation(tree);
+			setChild(n > 0 ? path[n-1] : nullptr, n > 0 && rights[n-1], rebalance(tree, balance));
+			grew = false;
 		}
 	}
-	else													// 结点重复
-		;//THROW_EXCEPTION(DuplicateDataException, "Can't create duplicate nodes ...");
-
-	tree->height = max(height(tree->left), height(tree->right)) + 1;
+	if ( grew )
+		++mHeight;
 
-	return tree;
-}
-
-template <typename T>
-void AVLTree<T>::insert(T key)
-{
-	insert(mRoot, key);
+	if ( mMetrics != nullptr )
+		publishMetrics();
 }
 
-template <typename T>
-AVLTreeNode<T>* AVLTree<T>::remove(AVLTreeNode<T>* &tree, AVLTreeNode<T>* del)
+/*	与插入相同，先自顶向下查找并记下路径；有两个孩子的结点用较高一侧的前驱或后继的值替换，改为删除那个至多一个孩子的结点
+ *	回溯时某个祖先的平衡因子从0变为±1，或者旋转时另一侧的孩子是平衡的，子树高度就没有变，立即停止
+ */
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::remove(T key)
 {
-	if ( (tree == nullptr) || (del == nullptr) )
-		return nullptr;
+	AVLTreeNode<T>* path[MAX_HEIGHT];
+	bool rights[MAX_HEIGHT];
+	uint16_t n = 0;
+	AVLTreeNode<T>* del = mRoot;
 
-	if ( del->key < tree->key )							// 交给左子树删除，最终进入最外层else
+	mStats.search();
+	while ( (del != nullptr) && (del->key != key) )
+	{
+		mStats.comparison();
+		path[n] = del;
+		rights[n] = key > del->key;
+		del = del->child(rights[n++]);
+	}
+	if ( del == nullptr )
 	{
-		tree->left = remove(tree->left, del);						// 更新可能旋转的结点
+		if ( mMetrics != nullptr )
+			publishMetrics();
 
-		if ( height(tree->right) - height(tree->left) == 2 )		// 删除左子树结点后如果右子树超重
-		{
-			if ( height(tree->right->left) > height(tree->right->right) )
-				tree = rlRotation(tree);								// 右左重
-			else
-				tree = rrRotation(tree);								// 右右重
-		}
+		return false;
 	}
-	else if ( del->key > tree->key )					// 交给右子树删除，最终进入最外层else
+	mStats.comparison();									// 命中的那一次
+
+	if ( (del->left() != nullptr) && (del->right() != nullptr) )	// 删除点有两个孩子，在较高的分支找替换者，替换后两侧的高度差不会变大
 	{
-		tree->right = remove(tree->right, del);
+		AVLTreeNode<T>* found = del;
+		bool right = del->balance() >= 0;					// 左孩子高时用左边的最大者，否则用右边的最小者
 
-		if ( height(tree->left) - height(tree->right) == 2 )
+		path[n] = del;
+		rights[n++] = right;
+		del = del->child(right);
+		while ( del->child(!right) != nullptr )
 		{
-			if ( height(tree->left->right) - height(tree->left->left) == 2 )
-				tree = lrRotation(tree);
-			else
-				tree = llRotation(tree);
+			path[n] = del;
+			rights[n++] = !right;
+			del = del->child(!right);
 		}
+
+		found->key = std::move(del->key);					// 采用值拷贝的方式删除，否则你还要处理子结点
 	}
-	else												// 找到删除节点
+
+	setChild(n > 0 ? path[n-1] : nullptr, n > 0 && rights[n-1], (del->left() != nullptr) ? del->left() : del->right());	// 用唯一的孩子替换删除结点
+	delete del;
+	--mCount;
+
+	bool shrank = true;										// 刚回溯过的子树是否矮了一层
+	while ( shrank && n > 0 )
 	{
-		if ( (tree->left != nullptr) && (tree->right != nullptr) )	// 删除点有两个孩子，在较重的分支找替换者
+		AVLTreeNode<T>* tree = path[--n];
+		int8_t balance = static_cast<int8_t>(tree->balance() + (rights[n] ? -1 : 1));
+
+		mStats.fixUp();
+		if ( balance == 1 || balance == -1 )				// 原本平衡，一侧变矮，子树高度不变
 		{
-			if ( height(tree->left) > height(tree->right) )				// 左孩子重
-			{
-				AVLTreeNode<T>* lmax = maximum(tree->left);					// 查找左边最大者用于替换；如果用右边的最小者，当右边没有孩子就会删除自身导致不平衡
-				tree->key = lmax->key;										// 采用值拷贝的方式删除，否则你还要处理子结点
-				tree->left = remove(tree->left, lmax);						// 更新可能旋转的结点
-			}
-			else														// 右孩子重
-			{
-				AVLTreeNode<T>* rmin = minimum(tree->right);
-				tree->key = rmin->key;
-				tree->right = remove(tree->right, rmin);
-			}
+			tree->setBalance(balance);
+			shrank = false;
 		}
-		else														//	删除点孩子不足两个，直接删除并用孩子替换
+		else if ( balance == 0 )							// 高的一侧变矮，子树矮了一层，继续向上
+			tree->setBalance(0);
+		else												// 矮的一侧又变矮，旋转；另一侧的孩子平衡时旋转后高度不变
 		{
-			AVLTreeNode<T>* tmp = tree;
-			tree = (tree->left != nullptr) ? tree->left : tree->right;	// 替换删除结点
-			delete tmp;
-			--mCount;
+			shrank = tree->child(balance > 0)->balance() != 0;
+			setChild(n > 0 ? path[n-1] : nullptr, n > 0 && rights[n-1], rebalance(tree, balance));
 		}
 	}
+	if ( shrank )
+		--mHeight;
 
-	if ( tree != nullptr )
-		tree->height = max(height(tree->left), height(tree->right)) + 1;
+	if ( mMetrics != nullptr )
+		publishMetrics();
 
-	return tree;
+	return true;
 }
 
-template <typename T>
-bool AVLTree<T>::remove(T key)
-{
-	bool ret = false;
-	AVLTreeNode<T>* tmp;
-
-	if ( (tmp = search(mRoot, key)) != nullptr )	// 查找并删除节点
-	{
-		mRoot = remove(mRoot, tmp);					// remove()的返回值用于不能修改参数的编程语言，函数左边的参数是左值mRoot的引用
-		ret = true;
-	}
-
-	return ret;
-}
-
-template <typename T>
-void AVLTree<T>::printGraph(const void* Root, uint16_t m_keyStrLen) const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::printGraph(const void* Root, uint16_t m_keyStrLen) const
 {
 	AVLTreeNode<T>const* node = static_cast<AVLTreeNode<T>const*>(Root);
 	if ( node == nullptr )
 		return;
 
-	uint16_t height = node->height;			// 要打印的树总高度
+	uint16_t height = mHeight;				// 要打印的树总高度
 	uint16_t layer = 1;						// 当前层，root为第一层
 	uint64_t i, index;
 	uint64_t keyStrLen = m_keyStrLen;	// i: 循环变量；index: 当前层最大结点数；keyStrLen: 结点输出占用字符宽度
@@ -461,13 +716,13 @@ void AVLTree<T>::printGraph(const void* Root, uint16_t m_keyStrLen) const
 			{
 				cout << right << setw(keyStrLen) << setfill('0') << tmp->key << flush;
 
-				if ( tmp->left != nullptr )		// 加入左结点
-					q.push(tmp->left);
+				if ( tmp->left() != nullptr )		// 加入左结点
+					q.push(tmp->left());
 				else
 					q.push(nullptr);
 
-				if ( tmp->right != nullptr )	// 加入右节点
-					q.push(tmp->right);
+				if ( tmp->right() != nullptr )	// 加入右节点
+					q.push(tmp->right());
 				else
 					q.push(nullptr);
 			}
@@ -499,8 +754,8 @@ void AVLTree<T>::printGraph(const void* Root, uint16_t m_keyStrLen) const
 	}
 }
 
-template <typename T>
-void AVLTree<T>::printGraph(uint16_t keyStrLen) const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::printGraph(uint16_t keyStrLen) const
 {
 	if ( mRoot == nullptr )
 		return;
@@ -508,8 +763,8 @@ void AVLTree<T>::printGraph(uint16_t keyStrLen) const
 	printGraph(mRoot, keyStrLen);
 }
 
-template <typename T>
-void AVLTree<T>::printTree(AVLTreeNode<T> const* const tree, bool firstNode) const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::printTree(AVLTreeNode<T> const* const tree, bool firstNode) const
 {
 	if ( tree==nullptr )
 		return;
@@ -535,78 +790,188 @@ void AVLTree<T>::printTree(AVLTreeNode<T> const* const tree, bool firstNode) con
 
 	for ( i=2-1; i>0; --i)		// 从右往左输出结点，即先打印最右边结点，其次次右边的结点；此循环不输出最左边的结点
 	{
-		if ( (tree->left+i) != nullptr )	// 注意树的子结点指针必须是从左往右依次排列，中间不能有其它变量（left_1,left_2,left_3...left_n）
+		if ( (tree->left()+i) != nullptr )	// 注意树的子结点指针必须是从左往右依次排列，中间不能有其它变量（left_1,left_2,left_3...left_n）
 		{									// 如果你的子结点数量不定，一定要把后面的首个指针设为nullptr
 			outTag[layer] = !firstNode;
-			printTree(tree->right, false);
+			printTree(tree->right(), false);
 		}
 	}
-	if ( tree->left != nullptr )			// 输出最左边的结点
+	if ( tree->left() != nullptr )			// 输出最左边的结点
 	{
-		printTree(tree->left, true);
+		printTree(tree->left(), true);
 		outTag[layer] = firstNode;
 	}
 
 	--layer;
 }
 
-template <typename T>
-void AVLTree<T>::printTree() const
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::exportKeys(TreeWriter& writer) const
+{
+	forEachInOrder([&writer](const T& key) { writer.put(key); });
+
+	return writer.flush();
+}
+
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::exportKeys(int fd, TreeWriter::Format format) const
+{
+	TreeWriter writer(fd, format);
+
+	return exportKeys(writer);
+}
+
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::exportKeys(const char* path, TreeWriter::Format format) const
+{
+	TreeWriter writer(path, format);
+
+	return writer.good() && exportKeys(writer) && writer.commit();
+}
+
+/*	按中序顺序从升序序列依次取出key构建结点，左右子树结点数至多相差1，高度也至多相差1，天然满足AVL平衡条件
+ */
+template <typename T, typename Stats>
+template <typename Iterator>
+AVLTreeNode<T>* AVLTree<T, Stats>::buildFromSorted(Iterator& it, uint64_t n, uint16_t& height)
+{
+	height = 0;
+	if ( n == 0 )
+		return nullptr;
+
+	uint64_t leftCount = (n-1)/2;
+	uint16_t leftHeight, rightHeight;
+
+	AVLTreeNode<T>* left = buildFromSorted(it, leftCount, leftHeight);
+	AVLTreeNode<T>* node = new AVLTreeNode<T>(*it, left, nullptr);
+	++it;
+	node->setRight(buildFromSorted(it, n-1-leftCount, rightHeight));
+	node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+	height = static_cast<uint16_t>(max(leftHeight, rightHeight) + 1);
+
+	return node;
+}
+
+template <typename T, typename Stats>
+template <typename Iterator>
+void AVLTree<T, Stats>::buildFromSorted(Iterator first, Iterator last)
+{
+	destroy();
+
+	mCount = static_cast<uint64_t>(distance(first, last));
+	mRoot = buildFromSorted(first, mCount, mHeight);
+	if ( mMetrics != nullptr )
+		publishMetrics();
+}
+
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::save(const char* path) const
+{
+	static_assert(is_trivially_copyable<T>::value, "snapshots store keys byte by byte");
+
+	TreeWriter writer(path, TreeWriter::BINARY);
+	TreeSnapshotHeader header = TreeSnapshotHeader::make<T>(mCount);
+	writer.putBytes(&header, sizeof(header));
+
+	return writer.good() && exportKeys(writer) && writer.commit();	// 写到path.tmp，fsync后替换，崩溃时旧快照仍然完整
+}
+
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::load(const char* path)
+{
+	static_assert(is_trivially_copyable<T>::value, "snapshots store keys byte by byte");
+
+	TreeSnapshot snapshot(path);
+	T const* keys = snapshot.keys<T>();
+	if ( keys == nullptr )
+		return false;
+
+	T const* end = keys+snapshot.getCount();
+	if ( adjacent_find(keys, end, [](const T& a, const T& b) { return !(a < b); }) != end )	// AVL树不允许重复key，且必须升序
+		return false;
+
+	buildFromSorted(keys, end);
+
+	return true;
+}
+
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::printTree() const
 {
 	printTree(mRoot, true);	// 右边参数此时无意义
 }
 
-template <typename T>
-void AVLTree<T>::destroy(AVLTreeNode<T>* &tree) const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::destroy(AVLTreeNode<T>* tree) const	// 左右子树都要释放，递归深度不超过树高
 {
 	if ( tree == nullptr )
 		return;
 
-	if ( tree->left != nullptr )
-		destroy(tree->left);
-	else
-		destroy(tree->right);
+	destroy(tree->left());
+	destroy(tree->right());
 
 	delete tree;
 }
 
-template <typename T>
-void AVLTree<T>::destroy()
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::destroy()
 {
 	destroy(mRoot);
 	mRoot = nullptr;
 	mCount = 0;
+	mHeight = 0;
+	if ( mMetrics != nullptr )
+		publishMetrics();
 }
 
-template <typename T>
-uint16_t AVLTree<T>::height(AVLTreeNode<T>* tree) const
+template <typename T, typename Stats>
+uint16_t AVLTree<T, Stats>::height() const
 {
-	if ( tree != nullptr )
-		return tree->height;
+	return mHeight;
+}
 
-	return 0;
+template <typename T, typename Stats>
+uint64_t AVLTree<T, Stats>::getCount() const
+{
+	return mCount;
 }
 
-template <typename T>
-uint16_t AVLTree<T>::height() const
+template <typename T, typename Stats>
+bool AVLTree<T, Stats>::rootIsNullptr() const
 {
-	return height(mRoot);
+	return mRoot == nullptr;
 }
 
-template <typename T>
-uint64_t AVLTree<T>::getCount() const
+template <typename T, typename Stats>
+TreeStats AVLTree<T, Stats>::stats() const
 {
-	return mCount;
+	return mStats.snapshot();
 }
 
-template <typename T>
-bool AVLTree<T>::rootIsNullptr() const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::resetStats()
 {
-	return mRoot == nullptr;
+	mStats.reset();
 }
 
-template <typename T>
-T AVLTree<T>::getRootKey() const
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::attachMetrics(const string& name, TreeMetricsRegistry& registry)
+{
+	mMetrics = registry.add(name, "avl");
+	publishMetrics();
+}
+
+template <typename T, typename Stats>
+void AVLTree<T, Stats>::publishMetrics() const	// 树高增量维护，O(1)；AVL树没有黑高，结点逐个new，占用即结点本身
+{
+	if ( mMetrics == nullptr )
+		return;
+
+	mMetrics->publish(mCount, mHeight, 0ull, mCount*sizeof(AVLTreeNode<T>), mCount*sizeof(AVLTreeNode<T>), mStats.snapshot());
+}
+
+template <typename T, typename Stats>
+T AVLTree<T, Stats>::getRootKey() const
 {
 //	if ( mRoot == nullptr )
 //		THROW_EXCEPTION(EmptyTreeException, "The tree is empty ...");
@@ -614,8 +979,8 @@ T AVLTree<T>::getRootKey() const
 	return mRoot->key;
 }
 
-template <typename T>
-AVLTree<T>::~AVLTree()
+template <typename T, typename Stats>
+AVLTree<T, Stats>::~AVLTree()
 {
 	destroy();
 }
@@ -3,9 +3,16 @@ CONFIG += console c++17
 CONFIG -= app_bundle
 CONFIG -= qt
 
+# DEFINES += TIMES_PERF=0	# 关掉Times.h中的硬件计数器（perf_event_open）
+
 SOURCES += \
     main.cpp
 
 HEADERS += \
     AVLTree.h \
-    Times.h
+    EytzingerIndex.h \
+    Times.h \
+    TreeIO.h \
+    TreeMetrics.h \
+    TreeStats.h \
+    Workload.h
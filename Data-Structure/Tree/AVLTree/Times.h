@@ -1,138 +1,676 @@
 #ifndef TIMES_H
 #define TIMES_H
 
+#include <cstdint>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
-#ifdef _WIN32
-#include <windows.h>
-#endif
-#if defined(linux) || defined(__MINGW64__) || defined(__GNUC__)
-#include <sys/time.h>
-#endif
+#include <sstream>
+#include <string>
+#include <vector>
 
 // intrinsics
-#if defined(__GNUC__)    // GCC
-#include <cpuid.h>
-#elif defined(_MSC_VER)    // MSVC
-    #if _MSC_VER >=1400    // VC2005
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TIMES_X86 1
+#if defined(_MSC_VER)
 #include <intrin.h>
-    #endif    // #if _MSC_VER >=1400
 #else
-#error Only supports MSVC or GCC.
-#endif    // #if defined(__GNUC__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+// 硬件计数器只在Linux上可用；定义TIMES_PERF=0可以完全关掉
+#ifndef TIMES_PERF
+#if defined(__linux__)
+#define TIMES_PERF 1
+#else
+#define TIMES_PERF 0
+#endif
+#endif
+#if TIMES_PERF
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace Viclib
 {
-void getcpuid(unsigned int CPUInfo[4], unsigned int InfoType)
+
+/*	计时工具，全部是内联函数，可以被多个翻译单元同时包含
+ *	x86上用TSC计数：读之前用lfence等前面的指令执行完，结束时用rdtscp（不支持时退回lfence+rdtsc）再接lfence，
+ *	避免乱序执行把被测代码移出计时区间；TSC频率不再从CPU商标字符串里猜，而是第一次使用时对照steady_clock校准
+ *	只有CPUID报告TSC不变（invariant，不随降频和睡眠变化）时才用TSC换算时间，否则退回steady_clock
+ *	非x86平台上的"周期"就是steady_clock的纳秒数
+ */
+#ifdef TIMES_X86
+inline void getcpuid(unsigned int CPUInfo[4], unsigned int InfoType)
 {
-#if defined(__GNUC__)		// GCC
-	__cpuid(InfoType, CPUInfo[0],CPUInfo[1],CPUInfo[2],CPUInfo[3]);
-#elif defined(_MSC_VER)		// MSVC
-    #if _MSC_VER>=1400		// VC2005才支持__cpuid
-	    __cpuid((int*)(void*)CPUInfo, (int)InfoType);
-    #else
-	    getcpuidex(CPUInfo, InfoType, 0);
-    #endif
-#endif    // #if defined(__GNUC__)
+#if defined(_MSC_VER)
+	__cpuid(reinterpret_cast<int*>(CPUInfo), static_cast<int>(InfoType));
+#else
+	__cpuid(InfoType, CPUInfo[0], CPUInfo[1], CPUInfo[2], CPUInfo[3]);
+#endif
 }
 
-// 取得CPU商标（Brand）.
-//
-// result: 成功时返回字符串的长度（一般为48）。失败时返回0.
-// pbrand: 接收商标信息的字符串缓冲区。至少为49字节.
-int cpu_getbrand(char* pbrand)
+inline unsigned int cpuMaxExtendedFunction()
 {
-	unsigned int dwBuf[4];
-	if ( nullptr == pbrand ) return 0;
-	// Function 0x80000000: Largest Extended Function Number
-	getcpuid(dwBuf, 0x80000000U);
-	if ( dwBuf[0] < 0x80000004U ) return 0;
-	// Function 80000002h,80000003h,80000004h: Processor Brand String
-	getcpuid(reinterpret_cast<unsigned int *>(&pbrand[0]), 0x80000002U);    // 前16个字符.
-	getcpuid(reinterpret_cast<unsigned int *>(&pbrand[16]), 0x80000003U);    // 中间16个字符.
-	getcpuid(reinterpret_cast<unsigned int *>(&pbrand[32]), 0x80000004U);    // 最后16个字符.
-	pbrand[48] = '\0';
+	unsigned int info[4];
+	getcpuid(info, 0x80000000U);
 
-	return 48;
+	return info[0];
 }
+#endif
 
-unsigned long long getCpuFrq(void)
+inline bool tscInvariant()				// CPUID 80000007h EDX[8]
 {
-	char info[49];	// Intel(R) Core(TM) i7-3820 CPU @ 3.60GHz
-	info[48] = '\0';
+#ifdef TIMES_X86
+	static bool const invariant = []
+	{
+		unsigned int info[4];
+		if ( cpuMaxExtendedFunction() < 0x80000007U )
+			return false;
+		getcpuid(info, 0x80000007U);
+		return (info[3] & (1u << 8)) != 0;
+	}();
+
+	return invariant;
+#else
+	return false;
+#endif
+}
 
-	if ( cpu_getbrand(info) )
+inline bool hasRdtscp()					// CPUID 80000001h EDX[27]
+{
+#ifdef TIMES_X86
+	static bool const supported = []
 	{
-		strtok(info, "@");					// var[0]="Intel(R) Core(TM) i7-3820 CPU "; var[1]=" 3.60GHz";
-		char * p = strtok(nullptr, "G");	// var[1] <==> p=" 3.60";
-		p = strtok(p, " ");					// p="3.60";
-		return static_cast<unsigned long long>(atof(p)*1000*1000*1000);
-	}
+		unsigned int info[4];
+		if ( cpuMaxExtendedFunction() < 0x80000001U )
+			return false;
+		getcpuid(info, 0x80000001U);
+		return (info[3] & (1u << 27)) != 0;
+	}();
 
-	return 0;
+	return supported;
+#else
+	return false;
+#endif
 }
 
-// CPU频率计时器
-#if defined (__i386__)
-static inline unsigned long long GetCycleCount(void)
+inline uint64_t steadyNanoseconds()
 {
-		unsigned long long int x;
-		__asm__ volatile("rdtsc":"=A"(x));
-		return x;
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
 }
-#elif defined (__x86_64__)
-static inline unsigned long long GetCycleCount(void)
+
+inline uint64_t cycleStart()			// 计时区间的起点：之前的指令全部完成后才读TSC
 {
-	    unsigned hi, lo;
-		__asm__ volatile("rdtsc":"=a"(lo),"=d"(hi));
-		return (static_cast<unsigned long long>(lo))|(static_cast<unsigned long long>(hi)<<32);
+#ifdef TIMES_X86
+	_mm_lfence();
+	uint64_t ret = __rdtsc();
+	_mm_lfence();
+	return ret;
+#else
+	return steadyNanoseconds();
+#endif
 }
+
+inline uint64_t cycleEnd()				// 计时区间的终点：被测代码全部完成后才读TSC，之后的代码也不会提前执行
+{
+#ifdef TIMES_X86
+	uint64_t ret;
+	if ( hasRdtscp() )
+	{
+		unsigned int aux;
+		ret = __rdtscp(&aux);
+	}
+	else
+	{
+		_mm_lfence();
+		ret = __rdtsc();
+	}
+	_mm_lfence();
+	return ret;
+#else
+	return steadyNanoseconds();
 #endif
+}
+
+/*	每秒的TSC周期数：忙等约20ms，用两端steady_clock读数的中点对齐TSC读数，结果缓存
+ */
+inline double cycleFrequency()
+{
+#ifdef TIMES_X86
+	static double const frequency = []
+	{
+		auto sample = [](uint64_t& cycles)
+		{
+			uint64_t before = steadyNanoseconds();
+			cycles = cycleStart();
+			uint64_t after = steadyNanoseconds();
+			return before + (after-before)/2;
+		};
+
+		uint64_t beginCycles, endCycles;
+		uint64_t const beginNs = sample(beginCycles);
+		uint64_t endNs;
+		do
+			endNs = sample(endCycles);
+		while ( endNs - beginNs < 20000000ull );
+
+		return static_cast<double>(endCycles-beginCycles) * 1e9 / static_cast<double>(endNs-beginNs);
+	}();
 
-static inline void timing(bool b){
-	if ( b ) goto GET;
-#if defined(linux) || defined(__MINGW64__) || defined(__GNUC__)
-	static struct timeval tv_begin, tv_end;
-	gettimeofday(&tv_begin, nullptr);
+	return frequency;
+#else
+	return 1e9;
 #endif
+}
+
+inline double cyclesToSeconds(uint64_t cycles)
+{
+	return static_cast<double>(cycles) / cycleFrequency();
+}
+
+/*	用perf_event_open(2)打开的本线程硬件计数器，只统计用户态，进程启动后一直计数，阶段的开始和结束各读一次取差值
+ *	每个计数器单独打开而不组成一组：某个事件不支持（虚拟机、容器里常见）只影响它自己；
+ *	计数器比PMU寄存器多时内核会轮流调度，读数按enabled/running时间比例放大
+ *	打不开的计数器读数恒为0，全部打不开时available()返回false，error()说明原因，计时本身不受影响
+ */
+class PerfCounters
+{
+public:
+	enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES, COUNTERS };
+
+	PerfCounters();
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator = (const PerfCounters&) = delete;
+	~PerfCounters();
+
+	static char const* name(Counter counter);
+	bool available() const;				// 至少有一个计数器可用
+	bool available(Counter counter) const;
+	char const* error() const;
+	void read(uint64_t values[COUNTERS]) const;
 
-#ifdef _WIN32
-	static LARGE_INTEGER li_freq, li_start, li_stop;
-	QueryPerformanceFrequency(&li_freq);
-	QueryPerformanceCounter(&li_start);
+private:
+	int mFds[COUNTERS];
+	int mErrno;							// 第一个失败的计数器的errno
+};
+
+inline char const* PerfCounters::name(Counter counter)
+{
+	static char const* const NAMES[COUNTERS] = { "cycles", "instructions", "L1d-misses", "LLC-misses", "dTLB-misses", "branch-misses" };
+
+	return NAMES[counter];
+}
+
+inline PerfCounters::PerfCounters() : mErrno(0)
+{
+	for ( int& fd : mFds )
+		fd = -1;
+
+#if TIMES_PERF
+	auto cache = [](uint64_t id)
+	{
+		return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	};
+	uint32_t const types[COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+									   PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+	uint64_t const configs[COUNTERS] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, cache(PERF_COUNT_HW_CACHE_L1D),
+										 cache(PERF_COUNT_HW_CACHE_LL), cache(PERF_COUNT_HW_CACHE_DTLB), PERF_COUNT_HW_BRANCH_MISSES };
+
+	for ( int i = 0; i < COUNTERS; ++i )
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = types[i];
+		attr.config = configs[i];
+		attr.exclude_kernel = 1;		// perf_event_paranoid为2时只允许统计用户态
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		mFds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		if ( mFds[i] < 0 && mErrno == 0 )
+			mErrno = errno;
+	}
+#else
+	mErrno = ENOSYS;
 #endif
+}
 
-	static uint64_t t1;
-	t1 = GetCycleCount();
-	static uint64_t frq = getCpuFrq();
+inline PerfCounters::~PerfCounters()
+{
+#if TIMES_PERF
+	for ( int fd : mFds )
+		if ( fd >= 0 )
+			::close(fd);
+#endif
+}
 
-	std::cout << "启动计时..." << std::endl;
-	goto END;
+inline bool PerfCounters::available() const
+{
+	for ( int fd : mFds )
+		if ( fd >= 0 )
+			return true;
+
+	return false;
+}
+
+inline bool PerfCounters::available(Counter counter) const
+{
+	return mFds[counter] >= 0;
+}
 
-GET:
-#if defined(linux) || defined(__MINGW64__) || defined(__GNUC__)
-	gettimeofday(&tv_end, nullptr);
-	std::cout << "Linux:  \t" << std::fixed << (tv_end.tv_sec+tv_end.tv_usec/1000000.0)-(tv_begin.tv_sec+tv_begin.tv_usec/1000000.0) << " s" << std::endl;
+inline char const* PerfCounters::error() const
+{
+	return mErrno != 0 ? strerror(mErrno) : "";
+}
+
+inline void PerfCounters::read(uint64_t values[COUNTERS]) const
+{
+	for ( int i = 0; i < COUNTERS; ++i )
+	{
+		values[i] = 0;
+#if TIMES_PERF
+		uint64_t data[3];				// 计数值，enabled时间，running时间
+		if ( mFds[i] >= 0 && ::read(mFds[i], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data)) && data[2] > 0 )
+			values[i] = (data[1] == data[2]) ? data[0]
+					  : static_cast<uint64_t>(static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]));
 #endif
+	}
+}
+
+inline PerfCounters& perfCounters()		// 第一次使用时打开
+{
+	static PerfCounters counters;
+
+	return counters;
+}
+
+/*	具名阶段的累计结果，同名阶段多次计时会累加
+ */
+struct TimingPhase
+{
+	std::string mName;
+	uint64_t mCalls;
+	uint64_t mOps;						// 阶段内的操作数，用来给出每次操作的耗时，0表示不统计
+	uint64_t mCycles;
+	double mSeconds;					// TSC不变时由周期数换算，否则取steady_clock
+	uint64_t mCounters[PerfCounters::COUNTERS];	// 硬件计数器的增量，不可用的为0
+};
+
+inline std::vector<TimingPhase>& timingPhases()
+{
+	static std::vector<TimingPhase> phases;
+
+	return phases;
+}
+
+inline void recordTimingPhase(const char* name, uint64_t ops, uint64_t cycles, double seconds, uint64_t const counters[PerfCounters::COUNTERS])
+{
+	std::vector<TimingPhase>& phases = timingPhases();
+
+	for ( TimingPhase& phase : phases )
+		if ( phase.mName == name )
+		{
+			++phase.mCalls;
+			phase.mOps += ops;
+			phase.mCycles += cycles;
+			phase.mSeconds += seconds;
+			for ( int i = 0; i < PerfCounters::COUNTERS; ++i )
+				phase.mCounters[i] += counters[i];
+			return;
+		}
+
+	TimingPhase phase = { name, 1ull, ops, cycles, seconds, {} };
+	for ( int i = 0; i < PerfCounters::COUNTERS; ++i )
+		phase.mCounters[i] = counters[i];
+	phases.push_back(phase);
+}
+
+/*	作用域计时器：构造时开始，stop()或析构时结束，并按名字记入timingPhases()，同时记录这段时间内硬件计数器的增量
+ *	读计数器是系统调用，所以只适合给整段阶段计时，不要包在单次操作外面
+ *	不是线程安全的，只应在主线程上给整段阶段计时
+ */
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(const char* name, uint64_t ops = 0);
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator = (const ScopedTimer&) = delete;
+	~ScopedTimer();
 
-#ifdef _WIN32
-	QueryPerformanceCounter(&li_stop);
-	std::cout << "Windows:\t" << (li_stop.QuadPart-li_start.QuadPart) * 1.0 / li_freq.QuadPart << " s" << std::endl;
+	void setOps(uint64_t ops);
+	double stop();						// 返回本次的秒数，重复调用只记录一次
+	double elapsed() const;				// 到目前为止的秒数，不停止计时
+
+private:
+	const char* mName;
+	uint64_t mOps;
+	uint64_t mBeginCycles;
+	std::chrono::steady_clock::time_point mBegin;
+	uint64_t mBeginCounters[PerfCounters::COUNTERS];
+	bool mRunning;
+};
+
+inline ScopedTimer::ScopedTimer(const char* name, uint64_t ops) :
+	mName(name), mOps(ops), mBeginCycles(0ull), mRunning(true)
+{
+	cycleFrequency();					// 第一次使用时的校准不计入阶段
+	perfCounters().read(mBeginCounters);
+	mBegin = std::chrono::steady_clock::now();
+	mBeginCycles = cycleStart();
+}
+
+inline ScopedTimer::~ScopedTimer()
+{
+	stop();
+}
+
+inline void ScopedTimer::setOps(uint64_t ops)
+{
+	mOps = ops;
+}
+
+inline double ScopedTimer::elapsed() const
+{
+	if ( tscInvariant() )
+		return cyclesToSeconds(cycleEnd() - mBeginCycles);
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - mBegin).count();
+}
+
+inline double ScopedTimer::stop()
+{
+	if ( !mRunning )
+		return 0.0;
+
+	uint64_t const cycles = cycleEnd() - mBeginCycles;
+	auto const end = std::chrono::steady_clock::now();
+	double const seconds = tscInvariant() ? cyclesToSeconds(cycles) : std::chrono::duration<double>(end - mBegin).count();
+	uint64_t counters[PerfCounters::COUNTERS];
+	perfCounters().read(counters);
+	for ( int i = 0; i < PerfCounters::COUNTERS; ++i )
+		counters[i] -= mBeginCounters[i];
+
+	mRunning = false;
+	recordTimingPhase(mName, mOps, cycles, seconds, counters);
+
+	return seconds;
+}
+
+inline void printTimingPhases(std::ostream& out = std::cout)
+{
+	std::vector<TimingPhase> const& phases = timingPhases();
+	if ( phases.empty() )
+		return;
+
+	std::ios_base::fmtflags const flags = out.flags();
+	std::streamsize const precision = out.precision();
+
+	out << std::left << std::setw(16) << "阶段" << std::right << std::setw(14) << "秒" << std::setw(18) << "周期" << std::setw(14) << "纳秒/次" << std::endl;
+	for ( TimingPhase const& phase : phases )
+	{
+		out << std::left << std::setw(16) << phase.mName << std::right
+			<< std::fixed << std::setprecision(6) << std::setw(14) << phase.mSeconds << std::setw(18) << phase.mCycles << std::setw(14);
+		if ( phase.mOps > 0 )
+			out << std::setprecision(2) << phase.mSeconds * 1e9 / static_cast<double>(phase.mOps);
+		else
+			out << "-";
+		out << std::endl;
+	}
+
+	PerfCounters const& counters = perfCounters();
+	if ( !counters.available() )
+		out << "硬件计数器不可用：" << counters.error() << std::endl;
+	else
+	{
+		out << "硬件计数器（阶段总数 / 每次操作）：" << std::endl << std::left << std::setw(16) << "阶段" << std::right;
+		for ( int i = 0; i < PerfCounters::COUNTERS; ++i )
+			out << std::setw(24) << PerfCounters::name(static_cast<PerfCounters::Counter>(i));
+		out << std::setw(8) << "IPC" << std::endl;
+
+		for ( TimingPhase const& phase : phases )
+		{
+			out << std::left << std::setw(16) << phase.mName << std::right;
+			for ( int i = 0; i < PerfCounters::COUNTERS; ++i )
+			{
+				std::ostringstream cell;
+				if ( !counters.available(static_cast<PerfCounters::Counter>(i)) )
+					cell << "-";
+				else
+				{
+					cell << phase.mCounters[i];
+					if ( phase.mOps > 0 )
+						cell << " / " << std::fixed << std::setprecision(2) << static_cast<double>(phase.mCounters[i]) / static_cast<double>(phase.mOps);
+				}
+				out << std::setw(24) << cell.str();
+			}
+			if ( phase.mCounters[PerfCounters::CYCLES] > 0 )
+				out << std::fixed << std::setprecision(2) << std::setw(8)
+					<< static_cast<double>(phase.mCounters[PerfCounters::INSTRUCTIONS]) / static_cast<double>(phase.mCounters[PerfCounters::CYCLES]);
+			else
+				out << std::setw(8) << "-";
+			out << std::endl;
+		}
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+/*	单次操作的延迟分布，按HDR Histogram的方式分桶：每个2的幂区间再等分成2^SUB_BITS个子桶，
+ *	相对误差不超过1/2^SUB_BITS（约3%），任何64位周期数都有对应的桶，内存固定约15KB，record()只是几次位运算和一次加法
+ *	周期数由调用者在单次操作前后用cycleStart()/cycleEnd()读取，每次读取本身约几十个周期，会计入测得的延迟
+ *	分位数取所在桶的上界（不超过实测最大值），最大值和最小值是精确的
+ */
+class LatencyHistogram
+{
+public:
+	static constexpr int SUB_BITS = 5;
+	static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BITS;
+	static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram();
+
+	void record(uint64_t cycles);
+	void merge(const LatencyHistogram& other);
+	void clear();
+
+	uint64_t getCount() const;
+	uint64_t getMin() const;
+	uint64_t getMax() const;
+	double getMean() const;
+	uint64_t percentile(double percent) const;	// percent在[0, 100]内，返回周期数
+
+	void print(const char* name, std::ostream& out = std::cout) const;	// 换算成纳秒输出次数、平均、p50、p99、p99.9和最大值
+
+private:
+	uint64_t mCounts[BUCKETS];
+	uint64_t mCount;
+	uint64_t mMin;
+	uint64_t mMax;
+	uint64_t mSum;
+
+	static size_t bucketIndex(uint64_t value);
+	static uint64_t bucketUpper(size_t index);	// 桶内的最大值
+};
+
+inline LatencyHistogram::LatencyHistogram()
+{
+	clear();
+}
+
+inline size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+	if ( value < SUB_BUCKETS )
+		return static_cast<size_t>(value);
+
+#if defined(_MSC_VER)
+	unsigned long top;
+	_BitScanReverse64(&top, value);
+	int const shift = static_cast<int>(top) - SUB_BITS;		// 保留最高的SUB_BITS+1位
+#else
+	int const shift = 63 - __builtin_clzll(value) - SUB_BITS;	// 保留最高的SUB_BITS+1位
 #endif
 
-	std::cout << "CPU:    \t" << (GetCycleCount() - t1)*1.0/frq << " s" << std::endl;
+	return static_cast<size_t>(shift+1) * SUB_BUCKETS + static_cast<size_t>((value >> shift) - SUB_BUCKETS);
+}
+
+inline uint64_t LatencyHistogram::bucketUpper(size_t index)
+{
+	uint64_t const bucket = index / SUB_BUCKETS;
+	uint64_t const sub = index % SUB_BUCKETS;
+
+	if ( bucket == 0 )
+		return sub;
+
+	return ((SUB_BUCKETS + sub + 1) << (bucket - 1)) - 1;
+}
+
+inline void LatencyHistogram::record(uint64_t cycles)
+{
+	++mCounts[bucketIndex(cycles)];
+	++mCount;
+	mSum += cycles;
+	if ( cycles < mMin )
+		mMin = cycles;
+	if ( cycles > mMax )
+		mMax = cycles;
+}
+
+inline void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for ( size_t i = 0; i < BUCKETS; ++i )
+		mCounts[i] += other.mCounts[i];
+	mCount += other.mCount;
+	mSum += other.mSum;
+	if ( other.mMin < mMin )
+		mMin = other.mMin;
+	if ( other.mMax > mMax )
+		mMax = other.mMax;
+}
+
+inline void LatencyHistogram::clear()
+{
+	memset(mCounts, 0, sizeof(mCounts));
+	mCount = 0;
+	mMin = UINT64_MAX;
+	mMax = 0;
+	mSum = 0;
+}
+
+inline uint64_t LatencyHistogram::getCount() const
+{
+	return mCount;
+}
+
+inline uint64_t LatencyHistogram::getMin() const
+{
+	return mCount > 0 ? mMin : 0;
+}
+
+inline uint64_t LatencyHistogram::getMax() const
+{
+	return mMax;
+}
+
+inline double LatencyHistogram::getMean() const
+{
+	return mCount > 0 ? static_cast<double>(mSum) / static_cast<double>(mCount) : 0.0;
+}
+
+inline uint64_t LatencyHistogram::percentile(double percent) const
+{
+	if ( mCount == 0 )
+		return 0;
+
+	uint64_t rank = static_cast<uint64_t>(percent / 100.0 * static_cast<double>(mCount) + 0.5);	// 第rank个（从1起）
+	if ( rank < 1 )
+		rank = 1;
+	if ( rank > mCount )
+		rank = mCount;
+
+	uint64_t seen = 0;
+	for ( size_t i = 0; i < BUCKETS; ++i )
+	{
+		seen += mCounts[i];
+		if ( seen >= rank )
+		{
+			uint64_t const upper = bucketUpper(i);
+			return upper < mMax ? upper : mMax;
+		}
+	}
+
+	return mMax;
+}
+
+inline void LatencyHistogram::print(const char* name, std::ostream& out) const
+{
+	std::ios_base::fmtflags const flags = out.flags();
+	std::streamsize const precision = out.precision();
+	double const nsPerCycle = 1e9 / cycleFrequency();
 
-END:
-	;
+	out << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+		<< "次数 " << mCount
+		<< "\t平均 " << getMean() * nsPerCycle
+		<< "\tp50 " << static_cast<double>(percentile(50.0)) * nsPerCycle
+		<< "\tp99 " << static_cast<double>(percentile(99.0)) * nsPerCycle
+		<< "\tp99.9 " << static_cast<double>(percentile(99.9)) * nsPerCycle
+		<< "\t最大 " << static_cast<double>(getMax()) * nsPerCycle << " ns" << std::endl;
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+/*	整个程序的计时：timingStart()开始，timingEnd()输出总耗时和各阶段的耗时
+ */
+struct TimingTotal
+{
+	std::chrono::steady_clock::time_point mBegin;
+	uint64_t mBeginCycles;
+};
+
+inline TimingTotal& timingTotal()
+{
+	static TimingTotal total;
+
+	return total;
 }
 
-static void timingStart()
+inline void timingStart()
 {
-	timing(false);
+	std::cout << "启动计时..." << std::endl;
+	std::cout << "TSC：" << (tscInvariant() ? "不变" : "可变或不可用，改用steady_clock")
+			  << "\t频率 " << cycleFrequency() / 1e9 << " GHz（以steady_clock校准）" << std::endl;
+
+	TimingTotal& total = timingTotal();
+	total.mBegin = std::chrono::steady_clock::now();
+	total.mBeginCycles = cycleStart();
 }
 
-static void timingEnd()
+inline void timingEnd()
 {
-	timing(true);
+	TimingTotal const& total = timingTotal();
+	uint64_t const cycles = cycleEnd() - total.mBeginCycles;
+	auto const end = std::chrono::steady_clock::now();
+
+	std::ios_base::fmtflags const flags = std::cout.flags();
+	std::streamsize const precision = std::cout.precision();
+
+	std::cout << std::defaultfloat << std::setprecision(6);
+	std::cout << "steady_clock:\t" << std::chrono::duration<double>(end - total.mBegin).count() << " s" << std::endl;
+	if ( tscInvariant() )
+		std::cout << "TSC:     \t" << cyclesToSeconds(cycles) << " s" << std::endl;
+	std::cout.flags(flags);
+	std::cout.precision(precision);
+
+	printTimingPhases(std::cout);
 }
 
 }
@@ -0,0 +1,113 @@
+#ifndef TREESTATS_H
+#define TREESTATS_H
+
+#include <cstdint>
+
+namespace Viclib
+{
+
+/*	树结构变化的统计快照，由RBTree和AVLTree的stats()返回
+ */
+struct TreeStats
+{
+	uint64_t mRotations;			// 单旋次数，双旋按两次单旋计入
+	uint64_t mDoubleRotations;		// AVL的lr/rl双旋次数
+	uint64_t mRecolors;				// 红黑树修正中的变色次数
+	uint64_t mFixUps;				// 修正循环的轮数：红黑树insertFixUp/removeFixUp每轮一次，AVL回溯路径上每层一次
+	uint64_t mSearches;
+	uint64_t mComparisons;			// 查找时比较过的结点数，除以mSearches即每次查找的平均比较次数
+
+	void merge(const TreeStats& other)
+	{
+		mRotations += other.mRotations;
+		mDoubleRotations += other.mDoubleRotations;
+		mRecolors += other.mRecolors;
+		mFixUps += other.mFixUps;
+		mSearches += other.mSearches;
+		mComparisons += other.mComparisons;
+	}
+};
+
+/*	统计策略，作为树的Stats模板参数
+ *	TreeNoStats（默认）的钩子都是空的内联函数，编译后不留下任何指令；stats()返回全0
+ *	TreeCountStats逐项计数；const的查找也会计数，所以开启统计的树不能在多个线程里同时查找
+ *	Task用于树内部的并行任务：任务线程的计数写进任务自己的对象，完成后由发起的线程merge()，不与其它线程争用同一组计数
+ */
+class TreeNoStats
+{
+public:
+	class Task
+	{
+	public:
+		explicit Task(TreeNoStats&) {}
+	};
+
+	void rotation() {}
+	void doubleRotation() {}
+	void recolor(uint64_t = 1) {}
+	void fixUp() {}
+	void search() {}
+	void comparison() {}
+
+	void merge(const TreeNoStats&) {}
+	void reset() {}
+	TreeStats snapshot() const { return TreeStats{}; }
+};
+
+class TreeCountStats
+{
+public:
+	class Task
+	{
+	public:
+		explicit Task(TreeCountStats& stats) : mPrevious(current())
+		{
+			current() = &stats.mStats;
+		}
+
+		Task(const Task&) = delete;
+		Task& operator = (const Task&) = delete;
+
+		~Task()
+		{
+			current() = mPrevious;
+		}
+
+	private:
+		TreeStats* mPrevious;
+	};
+
+	TreeCountStats() : mStats() {}
+
+	void rotation() { ++sink().mRotations; }
+	void doubleRotation() { ++sink().mDoubleRotations; }
+	void recolor(uint64_t n = 1) { sink().mRecolors += n; }
+	void fixUp() { ++sink().mFixUps; }
+	void search() { ++sink().mSearches; }
+	void comparison() { ++sink().mComparisons; }
+
+	void merge(const TreeCountStats& other) { sink().merge(other.mStats); }
+	void reset() { mStats = TreeStats(); }
+	TreeStats snapshot() const { return mStats; }
+
+private:
+	TreeStats mStats;
+
+	static TreeStats*& current()		// 本线程正在执行的并行任务的计数，不在任务中时为nullptr
+	{
+		static thread_local TreeStats* ret = nullptr;
+
+		return ret;
+	}
+
+	TreeStats& sink()
+	{
+		TreeStats* task = current();
+
+		return (task != nullptr) ? *task : mStats;
+	}
+};
+
+}
+
+#endif // TREESTATS_H
@@ -3,19 +3,23 @@
 #include "AVLTree.h"
 
 #include "Times.h"
+#include "Workload.h"
 
 using namespace std;
 using namespace Viclib;
 
 typedef uint64_t templateType;
 typedef uint64_t sizeType;
+typedef TreeNoStats statsType;		// 换成TreeCountStats统计旋转、回溯修正的层数和比较次数
+
+static KeyDistribution const distribution = KEYS_PERMUTATION;	// 插入顺序；改成KEYS_SEQUENTIAL、KEYS_CLUSTERED等可以观察不同的插入模式
 
 int main(int argc, char* argv[])
 {
 	sizeType i, len = 5;
 	//uint16_t keyStrLen = 3;	// 打印结点占用的字符宽度，printGraph(node, keyStrLen)
 
-	if ( argc == 2 )
+	if ( argc >= 2 )
 		len = static_cast<sizeType>(atoi(argv[1]));
 	else {
 		cout << "请输入结点层数，注意内存大小" << endl;
@@ -25,28 +29,36 @@ int main(int argc, char* argv[])
 	timingStart();
 
 	templateType tmp = 0;
-	AVLTree<templateType>* tree = new AVLTree<templateType>();
+	AVLTree<templateType, statsType>* tree = new AVLTree<templateType, statsType>();
+
+	sizeType const count = (1ull<<len)-1;
+	vector<uint64_t> const keys = generateKeys(distribution, count, count*2, static_cast<uint64_t>(time(nullptr)));	// 预先生成，不再重试
+
+	cout << "添加元素（" << KEY_DISTRIBUTION_NAMES[distribution] << "）：\nkey\tcount\tlayer" << endl;
+	LatencyHistogram searchLatency, insertLatency, removeLatency;	// 单次操作的延迟分布，看沿递归向上的旋转带来的长尾
 
-	cout << "添加元素：\nkey\tcount\tlayer" << endl;
-	srand(static_cast<uint32_t>(time(nullptr)));
 	i = 0;
-	while ( tree->getCount() < (1ull<<len)-1 )
+	ScopedTimer insertTimer("insert");
+	for ( uint64_t key : keys )
 	{
-		do
-		{
-			tmp = static_cast<templateType>(
-				static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				);
-		} while(tree->iterativeSearch(tmp));
+		tmp = static_cast<templateType>(key);
+		uint64_t begin = cycleStart();
+		bool const found = tree->iterativeSearch(tmp) != nullptr;
+		searchLatency.record(cycleEnd() - begin);
+		if ( found )							// 可能重复的分布里已存在的key直接跳过
+			continue;
+		begin = cycleStart();
 		tree->insert(tmp);
+		insertLatency.record(cycleEnd() - begin);
 		cout << tmp << "\t" << ++i << "\t" << tree->height() << endl;
 		if ( tree->height() >= static_cast<int>(len) )	// 限制树的高度
 			break;
 	}
+	insertTimer.setOps(i);
+	insertTimer.stop();
 	cout << endl;
 
+	ScopedTimer traverseTimer("traverse");
 	cout << "先序遍历：" << endl;
 	tree->preOrder();
 	cout << endl;
@@ -59,6 +71,7 @@ int main(int argc, char* argv[])
 	cout << "广度优先：" << endl;
 	tree->levelOrder();
 	cout << endl;
+	traverseTimer.stop();
 
 	// 输出树形描述的关系图
 //	tree->printGraph(keyStrLen);
@@ -71,8 +84,16 @@ int main(int argc, char* argv[])
 	cout << "最大结点：" << tree->maximum() << endl;
 	cout << "树的高度：" << tree->height() << endl;
 	cout << "树的结点数：" << tree->getCount() << endl;
+	uint64_t inRange = 0;					// 范围查询自检：整段在最大key之上的区间什么也不访问，[最小, 最大+1)访问全部结点
+	bool rangeOk = tree->forEachInRange(tree->maximum()+1, tree->maximum()+100, [&inRange](const uint64_t&) { ++inRange; }) && inRange == 0;
+	rangeOk = rangeOk && tree->forEachInRange(tree->minimum(), tree->maximum()+1, [&inRange](const uint64_t&) { ++inRange; }) && inRange == tree->getCount();
+	cout << "范围查询校验：" << (rangeOk ? "成功" : "失败") << endl;
+
+	if ( argc >= 3 )						// 第二个参数是导出文件路径，按升序每行一个key
+		cout << "导出到" << argv[2] << "：" << (tree->exportKeys(argv[2]) ? "成功" : "失败") << endl;
 
 	cout << "\n开始删除！！！\nkey\tlayer" << endl;
+	ScopedTimer deleteTimer("delete", tree->getCount());
 	while ( !tree->rootIsNullptr() )		// 随机数删除
 	{
 //		tmp = static_cast<templateType>(
@@ -80,9 +101,27 @@ int main(int argc, char* argv[])
 //			* static_cast<sizeType>(rand())
 //			* static_cast<sizeType>(rand())
 //			% ( (1ull<<len)-1) );
-		if ( tree->remove(tree->getRootKey()) )
+		templateType const key = tree->getRootKey();
+		uint64_t const begin = cycleStart();
+		bool const removed = tree->remove(key);
+		removeLatency.record(cycleEnd() - begin);
+		if ( removed )
 			cout << tmp << "\t" << tree->height() << "\t" << endl;
 	}
+	deleteTimer.stop();
+	cout << endl;
+
+	cout << "单次操作延迟：" << endl;
+	searchLatency.print("search");
+	insertLatency.print("insert");
+	removeLatency.print("remove");
+	if constexpr ( !is_same<statsType, TreeNoStats>::value )
+	{
+		TreeStats const stats = tree->stats();
+		cout << "结构统计：旋转 " << stats.mRotations << "\t双旋 " << stats.mDoubleRotations << "\t变色 " << stats.mRecolors
+			 << "\t修正 " << stats.mFixUps << "\t查找 " << stats.mSearches
+			 << "\t每次查找比较 " << (stats.mSearches > 0 ? static_cast<double>(stats.mComparisons) / stats.mSearches : 0.0) << endl;
+	}
 	cout << endl;
 
 	cout << "删除后输出===" << endl;
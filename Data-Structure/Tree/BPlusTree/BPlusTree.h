@@ -0,0 +1,1046 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <iostream>
+#include <cstdlib>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "TreeIO.h"
+
+using namespace std;
+
+namespace Viclib
+{
+
+/*	B+树的结点按NodeBytes字节组织，一个结点占若干个整缓存行（或一页），一次下行只有log(fanout, n)次缓存未命中
+ *	内部结点只存分隔key和孩子指针：孩子i中的key < mKeys[i] <= 孩子i+1中的key；删除后分隔key可能已不在树中，但仍满足上述关系
+ *	所有key都在叶子中，叶子按升序组成双向链表，范围扫描和中序遍历只是顺序读连续内存
+ */
+struct BPTNode				// 叶子和内部结点共用的头部
+{
+	uint16_t mCount;		// 叶子为key数，内部结点为分隔key数（孩子数减一）
+	bool mLeaf;
+};
+
+template <typename T, size_t NodeBytes>
+struct alignas(64) BPTLeaf : public BPTNode
+{
+	static constexpr size_t SLOTS = (NodeBytes - 3*sizeof(void*)) / sizeof(T);	// 头部按指针对齐后占一个指针，再加前后两个指针
+	static constexpr uint16_t CAPACITY = static_cast<uint16_t>(SLOTS < 0xffff ? SLOTS : 0xffff);
+
+	BPTLeaf<T, NodeBytes>* mPrev;
+	BPTLeaf<T, NodeBytes>* mNext;
+	T mKeys[CAPACITY];
+
+	BPTLeaf() : BPTNode{0, true}, mPrev(nullptr), mNext(nullptr) {}
+};
+
+template <typename T, size_t NodeBytes>
+struct alignas(64) BPTInner : public BPTNode
+{
+	static constexpr size_t SLOTS = (NodeBytes - 2*sizeof(void*)) / (sizeof(T) + sizeof(void*));
+	static constexpr uint16_t CAPACITY = static_cast<uint16_t>(SLOTS < 0xfffe ? SLOTS : 0xfffe);
+
+	T mKeys[CAPACITY];
+	BPTNode* mChildren[CAPACITY+1];
+
+	BPTInner() : BPTNode{0, false} {}
+};
+
+/*	双向迭代器，按升序访问，只读
+ *	位置由叶子和叶子内下标表示，沿叶子链表移动，++和--都是O(1)；end()的叶子为nullptr，--end()得到最大key
+ */
+template <typename T, typename Leaf>
+class BPTIterator
+{
+private:
+	Leaf* mLeaf;
+	uint16_t mIndex;
+	Leaf* const* mLast;		// 指向树的mLast，--end()时使用
+
+public:
+	typedef bidirectional_iterator_tag iterator_category;
+	typedef T value_type;
+	typedef ptrdiff_t difference_type;
+	typedef T const* pointer;
+	typedef T const& reference;
+
+	BPTIterator();
+	BPTIterator(Leaf* leaf, uint16_t index, Leaf* const* last);
+
+	reference operator * () const;
+	pointer operator -> () const;
+
+	BPTIterator& operator ++ ();
+	BPTIterator operator ++ (int);
+	BPTIterator& operator -- ();
+	BPTIterator operator -- (int);
+
+	bool operator == (const BPTIterator& other) const;
+	bool operator != (const BPTIterator& other) const;
+};
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf>::BPTIterator() : mLeaf(nullptr), mIndex(0), mLast(nullptr)
+{
+}
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf>::BPTIterator(Leaf* leaf, uint16_t index, Leaf* const* last) : mLeaf(leaf), mIndex(index), mLast(last)
+{
+	if ( mLeaf != nullptr && mIndex == mLeaf->mCount )	// 叶子末尾之后就是下一个叶子的开头
+	{
+		mLeaf = mLeaf->mNext;
+		mIndex = 0;
+	}
+}
+
+template <typename T, typename Leaf>
+typename BPTIterator<T, Leaf>::reference BPTIterator<T, Leaf>::operator * () const
+{
+	return mLeaf->mKeys[mIndex];
+}
+
+template <typename T, typename Leaf>
+typename BPTIterator<T, Leaf>::pointer BPTIterator<T, Leaf>::operator -> () const
+{
+	return &mLeaf->mKeys[mIndex];
+}
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf>& BPTIterator<T, Leaf>::operator ++ ()
+{
+	if ( ++mIndex == mLeaf->mCount )
+	{
+		mLeaf = mLeaf->mNext;
+		mIndex = 0;
+	}
+
+	return *this;
+}
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf> BPTIterator<T, Leaf>::operator ++ (int)
+{
+	BPTIterator ret = *this;
+	++(*this);
+	return ret;
+}
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf>& BPTIterator<T, Leaf>::operator -- ()
+{
+	if ( mLeaf == nullptr || mIndex == 0 )
+	{
+		mLeaf = (mLeaf == nullptr) ? *mLast : mLeaf->mPrev;
+		mIndex = static_cast<uint16_t>(mLeaf->mCount-1);
+	}
+	else
+		--mIndex;
+
+	return *this;
+}
+
+template <typename T, typename Leaf>
+BPTIterator<T, Leaf> BPTIterator<T, Leaf>::operator -- (int)
+{
+	BPTIterator ret = *this;
+	--(*this);
+	return ret;
+}
+
+template <typename T, typename Leaf>
+bool BPTIterator<T, Leaf>::operator == (const BPTIterator& other) const
+{
+	return mLeaf == other.mLeaf && mIndex == other.mIndex;
+}
+
+template <typename T, typename Leaf>
+bool BPTIterator<T, Leaf>::operator != (const BPTIterator& other) const
+{
+	return !(*this == other);
+}
+
+/*	接口与RBTree一致，可以直接替换比较；区别在于key不允许重复（insert()已有的key什么也不做），
+ *	查找返回key的地址而不是结点，插入和删除会在结点间移动key，之前得到的地址和迭代器随之失效
+ */
+template <typename T, size_t NodeBytes = 256>
+class BPlusTree
+{
+public:
+	typedef BPTLeaf<T, NodeBytes> Leaf;
+	typedef BPTInner<T, NodeBytes> Inner;
+	typedef BPTIterator<T, Leaf> iterator;
+	typedef iterator const_iterator;
+
+private:
+	static constexpr uint16_t LEAF_MIN = Leaf::CAPACITY/2;		// 根以外的结点至少半满
+	static constexpr uint16_t INNER_MIN = Inner::CAPACITY/2;
+	static constexpr uint16_t MAX_DEPTH = 64;					// 根以外的内部结点至少2个孩子
+	static constexpr bool LINEAR_SEARCH = is_arithmetic<T>::value && NodeBytes <= 512;	// 否则结点内二分查找
+
+	BPTNode* mRoot;
+	Leaf* mFirst;				// 叶子链表的头和尾，即最小和最大key所在的叶子
+	Leaf* mLast;
+	uint64_t mCount;
+	uint16_t mHeight;			// 层数，叶子为第1层，空树为0
+
+	template <typename F>
+	static bool visit(F& visitor, const T& key);	// visitor可以返回void或bool
+
+	static uint16_t childIndex(Inner const* node, const T& key);	// 第一个大于key的分隔key的下标，即key所在孩子
+	static uint16_t keyIndex(Leaf const* leaf, const T& key);		// 第一个不小于key的key的下标
+
+	T const* search(BPTNode const* node, const T& key) const;
+	Leaf* findLeaf(const T& key, Inner** path, uint16_t* slots, uint16_t& depth) const;	// 记录下行路径，path[i]->mChildren[slots[i]]是下一层结点
+
+	template <typename K>
+	pair<T const*, bool> tryInsertKey(K&& key);
+	void insertUp(Inner** path, uint16_t* slots, uint16_t depth, T separator, BPTNode* right);	// 把分裂出的right挂到父结点上，父结点满了继续向上分裂
+
+	void removeAt(Leaf* leaf, uint16_t index, Inner** path, uint16_t* slots, uint16_t depth);
+	void rebalance(BPTNode* node, Inner** path, uint16_t* slots, uint16_t depth);	// node不足半满：向兄弟借一个key，借不到就与兄弟合并
+	static void removeChild(Inner* node, uint16_t slot);	// 删除孩子slot和它左边的分隔key
+
+	void unlink(Leaf* leaf);
+	void destroy(BPTNode* node);
+
+	bool validate(BPTNode const* node, uint16_t level, T const* lo, T const* hi, Leaf const*& prev, uint64_t& count, char const*& reason) const;
+	void printTree(BPTNode const* node, uint16_t level) const;
+
+public:
+	BPlusTree();
+	BPlusTree(const BPlusTree&) = delete;
+	BPlusTree& operator = (const BPlusTree&) = delete;
+	~BPlusTree();
+
+	void inOrder() const;
+	void levelOrder() const;							// 逐层输出每个结点的key，内部结点输出分隔key
+
+	template <typename F>
+	bool forEachInOrder(F&& visitor) const;			// 沿叶子链表顺序访问，visitor(key)返回false时提前结束，返回值表示是否遍历完整棵树
+	template <typename F>
+	bool forEachInRange(const T& lo, const T& hi, F&& visitor) const;	// 按升序访问[lo, hi)内的key
+
+	T const* search(T key) const;
+	T const* iterativeSearch(T key) const;
+
+	T const* minimum() const;
+	T const* maximum() const;
+
+	iterator begin() const;
+	iterator end() const;
+	iterator lower_bound(const T& key) const;		// 第一个不小于key的位置
+	iterator upper_bound(const T& key) const;		// 第一个大于key的位置
+	pair<iterator, iterator> equal_range(const T& key) const;
+
+	void insert(const T& key);						// key已存在时什么也不做
+	void insert(T&& key);
+	pair<T const*, bool> tryInsert(const T& key);	// 一次下行完成查找和插入，key已存在时返回已有key和false
+	pair<T const*, bool> tryInsert(T&& key);
+	bool remove(T key);
+	iterator erase(iterator it);					// 返回被删除key的下一个位置
+
+	template <typename Iterator>
+	void buildFromSorted(Iterator first, Iterator last);	// 用升序序列自底向上重建整棵树，O(n)，重复的key只保留一个
+
+	void printTree() const;
+	bool exportKeys(TreeWriter& writer) const;		// 按升序把全部key写入缓冲区，整块write(2)写出
+	bool exportKeys(int fd, TreeWriter::Format format = TreeWriter::TEXT) const;
+	bool exportKeys(const char* path, TreeWriter::Format format = TreeWriter::TEXT) const;
+
+	void destroy();
+	uint64_t getCount() const;
+	bool validate(char const** reason = nullptr) const;	// 校验有序性、分隔key范围、结点填充率、叶子层数和叶子链表，O(n)；失败时reason指向原因
+	uint16_t getHeight() const;
+	bool rootIsNullptr() const;
+};
+
+template <typename T, size_t NodeBytes>
+BPlusTree<T, NodeBytes>::BPlusTree() : mRoot(nullptr), mFirst(nullptr), mLast(nullptr), mCount(0ull), mHeight(0)
+{
+	static_assert(NodeBytes >= 64, "a node should span at least one cache line");
+	static_assert(Leaf::CAPACITY >= 4 && Inner::CAPACITY >= 3, "NodeBytes is too small for this key type");
+}
+
+template <typename T, size_t NodeBytes>
+BPlusTree<T, NodeBytes>::~BPlusTree()
+{
+	destroy();
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::inOrder() const
+{
+	forEachInOrder([](const T& key) { cout << key << " "; });
+	cout << endl;
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::levelOrder() const
+{
+	vector<BPTNode const*> level, next;
+	if ( mRoot != nullptr )
+		level.push_back(mRoot);
+
+	while ( !level.empty() )
+	{
+		for ( BPTNode const* node : level )
+		{
+			T const* keys = node->mLeaf ? static_cast<Leaf const*>(node)->mKeys : static_cast<Inner const*>(node)->mKeys;
+			cout << "[";
+			for ( uint16_t i = 0; i < node->mCount; ++i )
+				cout << (i ? " " : "") << keys[i];
+			cout << "] ";
+
+			if ( !node->mLeaf )
+				next.insert(next.end(), static_cast<Inner const*>(node)->mChildren, static_cast<Inner const*>(node)->mChildren + node->mCount+1);
+		}
+		level.swap(next);
+		next.clear();
+	}
+	cout << endl;
+}
+
+template <typename T, size_t NodeBytes>
+template <typename F>
+bool BPlusTree<T, NodeBytes>::visit(F& visitor, const T& key)
+{
+	if constexpr ( is_void<decltype(visitor(key))>::value )		// 返回void的visitor不能提前结束
+	{
+		visitor(key);
+		return true;
+	}
+	else
+		return static_cast<bool>(visitor(key));
+}
+
+template <typename T, size_t NodeBytes>
+template <typename F>
+bool BPlusTree<T, NodeBytes>::forEachInOrder(F&& visitor) const
+{
+	for ( Leaf const* leaf = mFirst; leaf != nullptr; leaf = leaf->mNext )
+		for ( uint16_t i = 0; i < leaf->mCount; ++i )
+			if ( !visit(visitor, leaf->mKeys[i]) )
+				return false;
+
+	return true;
+}
+
+template <typename T, size_t NodeBytes>
+template <typename F>
+bool BPlusTree<T, NodeBytes>::forEachInRange(const T& lo, const T& hi, F&& visitor) const
+{
+	for ( iterator it = lower_bound(lo); it != end() && *it < hi; ++it )	// 一次下行定位，之后顺序读叶子
+		if ( !visit(visitor, *it) )
+			return false;
+
+	return true;
+}
+
+template <typename T, size_t NodeBytes>
+uint16_t BPlusTree<T, NodeBytes>::childIndex(Inner const* node, const T& key)
+{
+	if constexpr ( LINEAR_SEARCH )				// 结点只有几个缓存行时，无分支地数一遍比二分查找的分支预测失败更便宜
+	{
+		uint16_t ret = 0;
+		for ( uint16_t i = 0; i < node->mCount; ++i )
+			ret = static_cast<uint16_t>(ret + !(key < node->mKeys[i]));
+		return ret;
+	}
+	else
+		return static_cast<uint16_t>(std::upper_bound(node->mKeys, node->mKeys + node->mCount, key) - node->mKeys);
+}
+
+template <typename T, size_t NodeBytes>
+uint16_t BPlusTree<T, NodeBytes>::keyIndex(Leaf const* leaf, const T& key)
+{
+	if constexpr ( LINEAR_SEARCH )
+	{
+		uint16_t ret = 0;
+		for ( uint16_t i = 0; i < leaf->mCount; ++i )
+			ret = static_cast<uint16_t>(ret + (leaf->mKeys[i] < key));
+		return ret;
+	}
+	else
+		return static_cast<uint16_t>(std::lower_bound(leaf->mKeys, leaf->mKeys + leaf->mCount, key) - leaf->mKeys);
+}
+
+template <typename T, size_t NodeBytes>
+T const* BPlusTree<T, NodeBytes>::search(BPTNode const* node, const T& key) const	// 递归实现的查找
+{
+	if ( node == nullptr )
+		return nullptr;
+
+	if ( !node->mLeaf )
+	{
+		Inner const* inner = static_cast<Inner const*>(node);
+		return search(inner->mChildren[childIndex(inner, key)], key);
+	}
+
+	Leaf const* leaf = static_cast<Leaf const*>(node);
+	uint16_t i = keyIndex(leaf, key);
+
+	return (i < leaf->mCount && !(key < leaf->mKeys[i])) ? &leaf->mKeys[i] : nullptr;
+}
+
+template <typename T, size_t NodeBytes>
+T const* BPlusTree<T, NodeBytes>::search(T key) const
+{
+	return search(mRoot, key);
+}
+
+template <typename T, size_t NodeBytes>
+T const* BPlusTree<T, NodeBytes>::iterativeSearch(T key) const	// 非递归实现的查找
+{
+	BPTNode const* node = mRoot;
+	if ( node == nullptr )
+		return nullptr;
+
+	while ( !node->mLeaf )
+	{
+		Inner const* inner = static_cast<Inner const*>(node);
+		node = inner->mChildren[childIndex(inner, key)];
+	}
+
+	Leaf const* leaf = static_cast<Leaf const*>(node);
+	uint16_t i = keyIndex(leaf, key);
+
+	return (i < leaf->mCount && !(key < leaf->mKeys[i])) ? &leaf->mKeys[i] : nullptr;
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::Leaf* BPlusTree<T, NodeBytes>::findLeaf(const T& key, Inner** path, uint16_t* slots, uint16_t& depth) const
+{
+	BPTNode* node = mRoot;
+	depth = 0;
+
+	while ( !node->mLeaf )
+	{
+		Inner* inner = static_cast<Inner*>(node);
+		path[depth] = inner;
+		slots[depth] = childIndex(inner, key);
+		node = inner->mChildren[slots[depth]];
+		++depth;
+	}
+
+	return static_cast<Leaf*>(node);
+}
+
+template <typename T, size_t NodeBytes>
+T const* BPlusTree<T, NodeBytes>::minimum() const
+{
+	return (mFirst != nullptr) ? &mFirst->mKeys[0] : nullptr;
+}
+
+template <typename T, size_t NodeBytes>
+T const* BPlusTree<T, NodeBytes>::maximum() const
+{
+	return (mLast != nullptr) ? &mLast->mKeys[mLast->mCount-1] : nullptr;
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::iterator BPlusTree<T, NodeBytes>::begin() const
+{
+	return iterator(mFirst, 0, &mLast);
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::iterator BPlusTree<T, NodeBytes>::end() const
+{
+	return iterator(nullptr, 0, &mLast);
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::iterator BPlusTree<T, NodeBytes>::lower_bound(const T& key) const
+{
+	Inner* path[MAX_DEPTH];
+	uint16_t slots[MAX_DEPTH];
+	uint16_t depth;
+
+	if ( mRoot == nullptr )
+		return end();
+
+	Leaf* leaf = findLeaf(key, path, slots, depth);	// 结果不在这个叶子时就是下一个叶子的第一个key
+
+	return iterator(leaf, keyIndex(leaf, key), &mLast);
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::iterator BPlusTree<T, NodeBytes>::upper_bound(const T& key) const
+{
+	Inner* path[MAX_DEPTH];
+	uint16_t slots[MAX_DEPTH];
+	uint16_t depth;
+
+	if ( mRoot == nullptr )
+		return end();
+
+	Leaf* leaf = findLeaf(key, path, slots, depth);
+
+	return iterator(leaf, static_cast<uint16_t>(std::upper_bound(leaf->mKeys, leaf->mKeys + leaf->mCount, key) - leaf->mKeys), &mLast);
+}
+
+template <typename T, size_t NodeBytes>
+pair<typename BPlusTree<T, NodeBytes>::iterator, typename BPlusTree<T, NodeBytes>::iterator> BPlusTree<T, NodeBytes>::equal_range(const T& key) const
+{
+	return make_pair(lower_bound(key), upper_bound(key));
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::insert(const T& key)
+{
+	tryInsertKey(key);
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::insert(T&& key)
+{
+	tryInsertKey(std::move(key));
+}
+
+template <typename T, size_t NodeBytes>
+pair<T const*, bool> BPlusTree<T, NodeBytes>::tryInsert(const T& key)
+{
+	return tryInsertKey(key);
+}
+
+template <typename T, size_t NodeBytes>
+pair<T const*, bool> BPlusTree<T, NodeBytes>::tryInsert(T&& key)
+{
+	return tryInsertKey(std::move(key));
+}
+
+template <typename T, size_t NodeBytes>
+template <typename K>
+pair<T const*, bool> BPlusTree<T, NodeBytes>::tryInsertKey(K&& key)
+{
+	if ( mRoot == nullptr )
+	{
+		Leaf* leaf = new Leaf();
+		leaf->mKeys[0] = std::forward<K>(key);
+		leaf->mCount = 1;
+		mRoot = mFirst = mLast = leaf;
+		mHeight = 1;
+		++mCount;
+		return make_pair(&leaf->mKeys[0], true);
+	}
+
+	Inner* path[MAX_DEPTH];
+	uint16_t slots[MAX_DEPTH];
+	uint16_t depth;
+	Leaf* leaf = findLeaf(key, path, slots, depth);
+	uint16_t i = keyIndex(leaf, key);
+
+	if ( i < leaf->mCount && !(key < leaf->mKeys[i]) )
+		return make_pair(&leaf->mKeys[i], false);
+
+	++mCount;
+	if ( leaf->mCount < Leaf::CAPACITY )
+	{
+		std::move_backward(leaf->mKeys + i, leaf->mKeys + leaf->mCount, leaf->mKeys + leaf->mCount+1);
+		leaf->mKeys[i] = std::forward<K>(key);
+		++leaf->mCount;
+		return make_pair(&leaf->mKeys[i], true);
+	}
+
+	Leaf* right = new Leaf();					// 叶子已满：后一半移到新叶子，新key放进对应的一半
+	uint16_t const half = Leaf::CAPACITY/2;
+	std::move(leaf->mKeys + half, leaf->mKeys + Leaf::CAPACITY, right->mKeys);
+	right->mCount = static_cast<uint16_t>(Leaf::CAPACITY - half);
+	leaf->mCount = half;
+
+	right->mNext = leaf->mNext;
+	right->mPrev = leaf;
+	if ( leaf->mNext != nullptr )
+		leaf->mNext->mPrev = right;
+	else
+		mLast = right;
+	leaf->mNext = right;
+
+	Leaf* target = (i <= half) ? leaf : right;
+	if ( target == right )
+		i = static_cast<uint16_t>(i - half);
+	std::move_backward(target->mKeys + i, target->mKeys + target->mCount, target->mKeys + target->mCount+1);
+	target->mKeys[i] = std::forward<K>(key);
+	++target->mCount;
+
+	insertUp(path, slots, depth, right->mKeys[0], right);
+
+	return make_pair(&target->mKeys[i], true);
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::insertUp(Inner** path, uint16_t* slots, uint16_t depth, T separator, BPTNode* right)
+{
+	while ( depth > 0 )
+	{
+		Inner* node = path[--depth];
+		uint16_t i = slots[depth];				// right挂在孩子i的右边，separator放在mKeys[i]
+
+		if ( node->mCount < Inner::CAPACITY )
+		{
+			std::move_backward(node->mKeys + i, node->mKeys + node->mCount, node->mKeys + node->mCount+1);
+			std::copy_backward(node->mChildren + i+1, node->mChildren + node->mCount+1, node->mChildren + node->mCount+2);
+			node->mKeys[i] = std::move(separator);
+			node->mChildren[i+1] = right;
+			++node->mCount;
+			return;
+		}
+
+		T keys[Inner::CAPACITY+1];				// 已满：先在临时数组里插入，再从中间分开，中间的key上移到父结点
+		BPTNode* children[Inner::CAPACITY+2];
+		std::move(node->mKeys, node->mKeys + i, keys);
+		keys[i] = std::move(separator);
+		std::move(node->mKeys + i, node->mKeys + Inner::CAPACITY, keys + i+1);
+		std::copy(node->mChildren, node->mChildren + i+1, children);
+		children[i+1] = right;
+		std::copy(node->mChildren + i+1, node->mChildren + Inner::CAPACITY+1, children + i+2);
+
+		uint16_t const half = static_cast<uint16_t>((Inner::CAPACITY+1)/2);
+		Inner* sibling = new Inner();
+		std::move(keys, keys + half, node->mKeys);
+		std::copy(children, children + half+1, node->mChildren);
+		node->mCount = half;
+		std::move(keys + half+1, keys + Inner::CAPACITY+1, sibling->mKeys);
+		std::copy(children + half+1, children + Inner::CAPACITY+2, sibling->mChildren);
+		sibling->mCount = static_cast<uint16_t>(Inner::CAPACITY - half);
+
+		separator = std::move(keys[half]);
+		right = sibling;
+	}
+
+	Inner* root = new Inner();					// 根结点分裂，树长高一层
+	root->mKeys[0] = std::move(separator);
+	root->mChildren[0] = mRoot;
+	root->mChildren[1] = right;
+	root->mCount = 1;
+	mRoot = root;
+	++mHeight;
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::remove(T key)
+{
+	Inner* path[MAX_DEPTH];
+	uint16_t slots[MAX_DEPTH];
+	uint16_t depth;
+
+	if ( mRoot == nullptr )
+		return false;
+
+	Leaf* leaf = findLeaf(key, path, slots, depth);
+	uint16_t i = keyIndex(leaf, key);
+	if ( i == leaf->mCount || key < leaf->mKeys[i] )
+		return false;
+
+	removeAt(leaf, i, path, slots, depth);
+
+	return true;
+}
+
+template <typename T, size_t NodeBytes>
+typename BPlusTree<T, NodeBytes>::iterator BPlusTree<T, NodeBytes>::erase(iterator it)
+{
+	T key = *it;
+
+	remove(key);
+
+	return lower_bound(key);		// key可能已经移到别的叶子，重新定位
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::removeAt(Leaf* leaf, uint16_t index, Inner** path, uint16_t* slots, uint16_t depth)
+{
+	std::move(leaf->mKeys + index+1, leaf->mKeys + leaf->mCount, leaf->mKeys + index);
+	--leaf->mCount;
+	--mCount;
+
+	if ( depth == 0 )							// 叶子就是根，没有填充率要求，空了就删掉
+	{
+		if ( leaf->mCount == 0 )
+		{
+			delete leaf;
+			mRoot = mFirst = mLast = nullptr;
+			mHeight = 0;
+		}
+		return;
+	}
+
+	if ( leaf->mCount < LEAF_MIN )
+		rebalance(leaf, path, slots, depth);
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::removeChild(Inner* node, uint16_t slot)
+{
+	std::move(node->mKeys + slot, node->mKeys + node->mCount, node->mKeys + slot-1);
+	std::copy(node->mChildren + slot+1, node->mChildren + node->mCount+1, node->mChildren + slot);
+	--node->mCount;
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::unlink(Leaf* leaf)
+{
+	if ( leaf->mPrev != nullptr )
+		leaf->mPrev->mNext = leaf->mNext;
+	else
+		mFirst = leaf->mNext;
+	if ( leaf->mNext != nullptr )
+		leaf->mNext->mPrev = leaf->mPrev;
+	else
+		mLast = leaf->mPrev;
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::rebalance(BPTNode* node, Inner** path, uint16_t* slots, uint16_t depth)
+{
+	while ( depth > 0 )
+	{
+		Inner* parent = path[--depth];
+		uint16_t i = slots[depth];
+		BPTNode* left = (i > 0) ? parent->mChildren[i-1] : nullptr;
+		BPTNode* right = (i < parent->mCount) ? parent->mChildren[i+1] : nullptr;
+
+		if ( node->mLeaf )
+		{
+			Leaf* leaf = static_cast<Leaf*>(node);
+			Leaf* l = static_cast<Leaf*>(left);
+			Leaf* r = static_cast<Leaf*>(right);
+
+			if ( l != nullptr && l->mCount > LEAF_MIN )			// 左兄弟的最大key移过来
+			{
+				std::move_backward(leaf->mKeys, leaf->mKeys + leaf->mCount, leaf->mKeys + leaf->mCount+1);
+				leaf->mKeys[0] = std::move(l->mKeys[--l->mCount]);
+				++leaf->mCount;
+				parent->mKeys[i-1] = leaf->mKeys[0];
+				return;
+			}
+			if ( r != nullptr && r->mCount > LEAF_MIN )			// 右兄弟的最小key移过来
+			{
+				leaf->mKeys[leaf->mCount++] = std::move(r->mKeys[0]);
+				std::move(r->mKeys+1, r->mKeys + r->mCount, r->mKeys);
+				--r->mCount;
+				parent->mKeys[i] = r->mKeys[0];
+				return;
+			}
+
+			if ( l != nullptr )					// 并入左兄弟
+			{
+				std::move(leaf->mKeys, leaf->mKeys + leaf->mCount, l->mKeys + l->mCount);
+				l->mCount = static_cast<uint16_t>(l->mCount + leaf->mCount);
+				unlink(leaf);
+				delete leaf;
+				removeChild(parent, i);
+			}
+			else								// 右兄弟并入本结点
+			{
+				std::move(r->mKeys, r->mKeys + r->mCount, leaf->mKeys + leaf->mCount);
+				leaf->mCount = static_cast<uint16_t>(leaf->mCount + r->mCount);
+				unlink(r);
+				delete r;
+				removeChild(parent, static_cast<uint16_t>(i+1));
+			}
+		}
+		else
+		{
+			Inner* inner = static_cast<Inner*>(node);
+			Inner* l = static_cast<Inner*>(left);
+			Inner* r = static_cast<Inner*>(right);
+
+			if ( l != nullptr && l->mCount > INNER_MIN )		// 经父结点旋转：分隔key下移，左兄弟的最大key上移，最右孩子移过来
+			{
+				std::move_backward(inner->mKeys, inner->mKeys + inner->mCount, inner->mKeys + inner->mCount+1);
+				std::copy_backward(inner->mChildren, inner->mChildren + inner->mCount+1, inner->mChildren + inner->mCount+2);
+				inner->mKeys[0] = std::move(parent->mKeys[i-1]);
+				inner->mChildren[0] = l->mChildren[l->mCount];
+				++inner->mCount;
+				parent->mKeys[i-1] = std::move(l->mKeys[--l->mCount]);
+				return;
+			}
+			if ( r != nullptr && r->mCount > INNER_MIN )
+			{
+				inner->mKeys[inner->mCount] = std::move(parent->mKeys[i]);
+				inner->mChildren[inner->mCount+1] = r->mChildren[0];
+				++inner->mCount;
+				parent->mKeys[i] = std::move(r->mKeys[0]);
+				std::move(r->mKeys+1, r->mKeys + r->mCount, r->mKeys);
+				std::copy(r->mChildren+1, r->mChildren + r->mCount+1, r->mChildren);
+				--r->mCount;
+				return;
+			}
+
+			Inner* dst = (l != nullptr) ? l : inner;	// 合并：左边结点 + 分隔key + 右边结点
+			Inner* src = (l != nullptr) ? inner : r;
+			uint16_t slot = (l != nullptr) ? i : static_cast<uint16_t>(i+1);
+
+			dst->mKeys[dst->mCount] = std::move(parent->mKeys[slot-1]);
+			std::move(src->mKeys, src->mKeys + src->mCount, dst->mKeys + dst->mCount+1);
+			std::copy(src->mChildren, src->mChildren + src->mCount+1, dst->mChildren + dst->mCount+1);
+			dst->mCount = static_cast<uint16_t>(dst->mCount + 1 + src->mCount);
+			delete src;
+			removeChild(parent, slot);
+		}
+
+		if ( depth == 0 )						// 父结点是根：根只剩一个孩子时树降低一层
+		{
+			if ( parent->mCount == 0 )
+			{
+				mRoot = parent->mChildren[0];
+				delete parent;
+				--mHeight;
+			}
+			return;
+		}
+		if ( parent->mCount >= INNER_MIN )
+			return;
+
+		node = parent;
+	}
+}
+
+template <typename T, size_t NodeBytes>
+template <typename Iterator>
+void BPlusTree<T, NodeBytes>::buildFromSorted(Iterator first, Iterator last)
+{
+	destroy();
+
+	vector<BPTNode*> level;						// 当前层的结点及其子树的最小key，用来生成上一层的分隔key
+	vector<T> lows;
+	Leaf* prev = nullptr;
+
+	vector<T> keys(first, last);
+	keys.erase(std::unique(keys.begin(), keys.end(), [](const T& a, const T& b) { return !(a < b) && !(b < a); }), keys.end());
+	if ( keys.empty() )
+		return;
+
+	uint64_t const n = keys.size();				// n个key平均分到最少的叶子里，除只有一个叶子外每个叶子至少半满
+	uint64_t const leaves = (n + Leaf::CAPACITY-1) / Leaf::CAPACITY;
+	uint64_t begin = 0;
+	for ( uint64_t j = 0; j < leaves; ++j )
+	{
+		uint64_t const end = n * (j+1) / leaves;
+		Leaf* leaf = new Leaf();
+		std::move(keys.begin() + static_cast<ptrdiff_t>(begin), keys.begin() + static_cast<ptrdiff_t>(end), leaf->mKeys);
+		leaf->mCount = static_cast<uint16_t>(end - begin);
+		leaf->mPrev = prev;
+		if ( prev != nullptr )
+			prev->mNext = leaf;
+		else
+			mFirst = leaf;
+		prev = leaf;
+
+		level.push_back(leaf);
+		lows.push_back(leaf->mKeys[0]);
+		begin = end;
+	}
+	mLast = prev;
+	mCount = n;
+	mHeight = 1;
+
+	while ( level.size() > 1 )					// 逐层向上，孩子同样平均分配
+	{
+		uint64_t const m = level.size();
+		uint64_t const parents = (m + Inner::CAPACITY) / (Inner::CAPACITY+1);
+		vector<BPTNode*> upper;
+		vector<T> upperLows;
+
+		begin = 0;
+		for ( uint64_t j = 0; j < parents; ++j )
+		{
+			uint64_t const end = m * (j+1) / parents;
+			Inner* inner = new Inner();
+			for ( uint64_t c = begin; c < end; ++c )
+			{
+				inner->mChildren[c-begin] = level[c];
+				if ( c > begin )
+					inner->mKeys[c-begin-1] = lows[c];
+			}
+			inner->mCount = static_cast<uint16_t>(end - begin - 1);
+
+			upper.push_back(inner);
+			upperLows.push_back(lows[begin]);
+			begin = end;
+		}
+
+		level.swap(upper);
+		lows.swap(upperLows);
+		++mHeight;
+	}
+
+	mRoot = level[0];
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::printTree(BPTNode const* node, uint16_t level) const
+{
+	for ( uint16_t i = 1; i < level; ++i )
+		cout << "|       ";
+	if ( level > 0 )
+		cout << "+-------";
+
+	T const* keys = node->mLeaf ? static_cast<Leaf const*>(node)->mKeys : static_cast<Inner const*>(node)->mKeys;
+	cout << "[";
+	for ( uint16_t i = 0; i < node->mCount; ++i )
+		cout << (i ? " " : "") << keys[i];
+	cout << "]" << endl;
+
+	if ( !node->mLeaf )
+		for ( uint16_t i = 0; i <= node->mCount; ++i )
+			printTree(static_cast<Inner const*>(node)->mChildren[i], static_cast<uint16_t>(level+1));
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::printTree() const
+{
+	if ( mRoot != nullptr )
+		printTree(mRoot, 0);
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::exportKeys(TreeWriter& writer) const
+{
+	forEachInOrder([&writer](const T& key) { writer.put(key); });
+
+	return writer.flush();
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::exportKeys(int fd, TreeWriter::Format format) const
+{
+	TreeWriter writer(fd, format);
+
+	return exportKeys(writer);
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::exportKeys(const char* path, TreeWriter::Format format) const
+{
+	TreeWriter writer(path, format);
+
+	return writer.good() && exportKeys(writer) && writer.commit();
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::destroy(BPTNode* node)	// 递归深度就是层数
+{
+	if ( node->mLeaf )
+		delete static_cast<Leaf*>(node);
+	else
+	{
+		Inner* inner = static_cast<Inner*>(node);
+		for ( uint16_t i = 0; i <= inner->mCount; ++i )
+			destroy(inner->mChildren[i]);
+		delete inner;
+	}
+}
+
+template <typename T, size_t NodeBytes>
+void BPlusTree<T, NodeBytes>::destroy()
+{
+	if ( mRoot != nullptr )
+		destroy(mRoot);
+
+	mRoot = nullptr;
+	mFirst = mLast = nullptr;
+	mCount = 0ull;
+	mHeight = 0;
+}
+
+template <typename T, size_t NodeBytes>
+uint64_t BPlusTree<T, NodeBytes>::getCount() const
+{
+	return mCount;
+}
+
+/*	递归检查以node为根的子树：key严格升序并落在父结点给出的[lo, hi)内，根以外的结点至少半满，
+ *	所有叶子都在第1层，按中序遇到的叶子必须正是链表中上一个叶子的下一个
+ */
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::validate(BPTNode const* node, uint16_t level, T const* lo, T const* hi, Leaf const*& prev, uint64_t& count, char const*& reason) const
+{
+	bool const isRoot = (node == mRoot);
+	T const* keys = node->mLeaf ? static_cast<Leaf const*>(node)->mKeys : static_cast<Inner const*>(node)->mKeys;
+
+	if ( node->mLeaf != (level == 1) )
+		reason = "叶子不全在同一层";
+	else if ( node->mLeaf ? (node->mCount == 0 || node->mCount > Leaf::CAPACITY || (!isRoot && node->mCount < LEAF_MIN))
+						  : (node->mCount == 0 || node->mCount > Inner::CAPACITY || (!isRoot && node->mCount < INNER_MIN)) )
+		reason = "结点的key数超出范围";
+	if ( reason != nullptr )
+		return false;
+
+	for ( uint16_t i = 0; i < node->mCount; ++i )
+		if ( (i > 0 && !(keys[i-1] < keys[i])) || (lo != nullptr && keys[i] < *lo) || (hi != nullptr && !(keys[i] < *hi)) )
+		{
+			reason = "结点内的key没有严格升序，或者超出分隔key的范围";
+			return false;
+		}
+
+	if ( node->mLeaf )
+	{
+		Leaf const* leaf = static_cast<Leaf const*>(node);
+		if ( leaf->mPrev != prev || (prev != nullptr ? prev->mNext != leaf : mFirst != leaf) )
+		{
+			reason = "叶子链表与树中的叶子顺序不一致";
+			return false;
+		}
+		prev = leaf;
+		count += leaf->mCount;
+		return true;
+	}
+
+	Inner const* inner = static_cast<Inner const*>(node);
+	for ( uint16_t i = 0; i <= inner->mCount; ++i )
+		if ( !validate(inner->mChildren[i], static_cast<uint16_t>(level-1), (i > 0) ? &keys[i-1] : lo, (i < inner->mCount) ? &keys[i] : hi, prev, count, reason) )
+			return false;
+
+	return true;
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::validate(char const** reason) const
+{
+	char const* tmp;
+	char const*& ret = (reason != nullptr) ? *reason : tmp;
+	ret = nullptr;
+
+	if ( mRoot == nullptr )
+	{
+		if ( mCount != 0 || mHeight != 0 || mFirst != nullptr || mLast != nullptr )
+			ret = "空树的结点数、层数或叶子链表不为空";
+		return ret == nullptr;
+	}
+
+	Leaf const* prev = nullptr;
+	uint64_t count = 0;
+	if ( !validate(mRoot, mHeight, nullptr, nullptr, prev, count, ret) )
+		return false;
+
+	if ( prev != mLast || mLast->mNext != nullptr )
+		ret = "最后一个叶子与mLast不一致";
+	else if ( count != mCount )
+		ret = "叶子中的key数与记录的结点数不同";
+
+	return ret == nullptr;
+}
+
+template <typename T, size_t NodeBytes>
+uint16_t BPlusTree<T, NodeBytes>::getHeight() const
+{
+	return mHeight;
+}
+
+template <typename T, size_t NodeBytes>
+bool BPlusTree<T, NodeBytes>::rootIsNullptr() const
+{
+	return mRoot == nullptr;
+}
+
+}
+
+#endif // BPLUSTREE_H
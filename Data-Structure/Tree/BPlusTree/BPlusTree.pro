@@ -0,0 +1,16 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# DEFINES += BPLUSTREE_NODE_BYTES=4096	# 结点大小，默认256字节（4个缓存行），可以改成一页比较
+# DEFINES += TIMES_PERF=0	# 关掉Times.h中的硬件计数器（perf_event_open）
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    BPlusTree.h \
+    Times.h \
+    TreeIO.h \
+    Workload.h
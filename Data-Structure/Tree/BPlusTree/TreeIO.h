@@ -0,0 +1,376 @@
+#ifndef TREEIO_H
+#define TREEIO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+namespace Viclib
+{
+
+/*	树导出用的缓冲写出器：key先格式化到用户态缓冲区，攒满一块再用一次write(2)写出，不再每个key经过iostream并flush
+ *	TEXT：整数和浮点数用to_chars格式化，其它类型退回ostringstream，每个key后跟一个分隔符
+ *	BINARY：按内存布局原样写出，要求key可以按位复制
+ *	可以写到已打开的文件描述符（不负责关闭，比如1就是标准输出），也可以给出路径由写出器打开和关闭
+ *	给出路径时先写到path.tmp，commit()（析构时自动调用）fsync后再rename()覆盖path，中途崩溃或出错时原文件保持不变
+ */
+class TreeWriter
+{
+public:
+	enum Format { TEXT, BINARY };
+
+	static constexpr size_t DEFAULT_BUFFER = 1u<<20;
+
+	explicit TreeWriter(int fd, Format format = TEXT, char separator = '\n', size_t bufferSize = DEFAULT_BUFFER);
+	explicit TreeWriter(const char* path, Format format = TEXT, char separator = '\n', size_t bufferSize = DEFAULT_BUFFER);
+	TreeWriter(const TreeWriter&) = delete;
+	TreeWriter& operator = (const TreeWriter&) = delete;
+	~TreeWriter();
+
+	template <typename T>
+	void put(const T& key);
+	void putBytes(const void* data, size_t size);
+
+	bool flush();								// 写出缓冲区中的全部数据，出错后一直返回false
+	bool commit();								// 路径模式：flush、fsync、关闭后替换目标文件，失败时删除临时文件；之后不能再写
+	bool good() const;
+	Format getFormat() const;
+	uint64_t getBytes() const;					// 已经交给write(2)的字节数
+
+private:
+	int mFd;
+	bool mOwnsFd;
+	std::string mPath;							// 路径模式下的目标文件，数据先写到mPath+".tmp"
+	bool mGood;
+	Format mFormat;
+	char mSeparator;
+	std::vector<char> mBuffer;
+	size_t mUsed;
+	uint64_t mBytes;
+
+	char* reserve(size_t size);					// 保证缓冲区剩余至少size字节
+	static bool sync(int fd);
+	static bool syncDirectory(const std::string& path);	// rename()本身也要落盘，同步path所在的目录
+};
+
+inline TreeWriter::TreeWriter(int fd, Format format, char separator, size_t bufferSize) :
+	mFd(fd), mOwnsFd(false), mGood(fd >= 0), mFormat(format), mSeparator(separator),
+	mBuffer(bufferSize < 64 ? 64 : bufferSize), mUsed(0), mBytes(0ull)
+{
+}
+
+inline TreeWriter::TreeWriter(const char* path, Format format, char separator, size_t bufferSize) :
+	TreeWriter(::open((std::string(path) + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644), format, separator, bufferSize)
+{
+	mOwnsFd = mFd >= 0;
+	mPath = path;
+}
+
+inline TreeWriter::~TreeWriter()
+{
+	commit();
+}
+
+inline bool TreeWriter::commit()
+{
+	if ( !mOwnsFd )								// 文件描述符模式只写出缓冲区，已经提交过的也走这里
+		return flush();
+
+	std::string const tmp = mPath + ".tmp";
+	bool ok = flush() && sync(mFd);
+	ok = (::close(mFd) == 0) && ok;
+	mFd = -1;
+	mOwnsFd = false;
+	mGood = false;								// 文件已关闭，之后的写入都失败
+
+#ifdef _WIN32
+	if ( ok )
+		std::remove(mPath.c_str());				// Windows的rename()不能覆盖已有文件，这里不是原子替换
+#endif
+	ok = ok && std::rename(tmp.c_str(), mPath.c_str()) == 0;
+	if ( !ok )
+		std::remove(tmp.c_str());
+
+	return ok && syncDirectory(mPath);
+}
+
+inline bool TreeWriter::sync(int fd)
+{
+#ifdef _WIN32
+	return ::_commit(fd) == 0;
+#else
+	while ( ::fsync(fd) != 0 )
+		if ( errno != EINTR )
+			return false;
+
+	return true;
+#endif
+}
+
+inline bool TreeWriter::syncDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	(void)path;									// NTFS的元数据由文件系统日志保证
+	return true;
+#else
+	size_t const slash = path.rfind('/');
+	std::string const dir = (slash == std::string::npos) ? std::string(".") : (slash == 0 ? std::string("/") : path.substr(0, slash));
+	int const fd = ::open(dir.c_str(), O_RDONLY);
+	if ( fd < 0 )
+		return false;
+
+	bool const ok = sync(fd);
+	::close(fd);
+
+	return ok;
+#endif
+}
+
+inline char* TreeWriter::reserve(size_t size)
+{
+	if ( mBuffer.size() - mUsed < size )
+	{
+		flush();
+		if ( mBuffer.size() < size )			// 单个key比整个缓冲区还大
+			mBuffer.resize(size);
+	}
+
+	return mBuffer.data() + mUsed;
+}
+
+inline void TreeWriter::putBytes(const void* data, size_t size)
+{
+	memcpy(reserve(size), data, size);
+	mUsed += size;
+}
+
+template <typename T>
+void TreeWriter::put(const T& key)
+{
+	if ( mFormat == BINARY )
+	{
+		if constexpr ( std::is_trivially_copyable<T>::value )
+			putBytes(&key, sizeof(T));
+		else
+			mGood = false;						// 不能按位复制的key没有二进制格式
+	}
+	else if constexpr ( std::is_arithmetic<T>::value && !std::is_same<T, bool>::value )
+	{
+		constexpr size_t MAX_LEN = 64;			// 足够容纳任何整数和最短表示的double
+		char* begin = reserve(MAX_LEN+1);
+		char* end = std::to_chars(begin, begin+MAX_LEN, key).ptr;
+		*end++ = mSeparator;
+		mUsed += static_cast<size_t>(end-begin);
+	}
+	else
+	{
+		std::ostringstream tmp;
+		tmp << key << mSeparator;
+		std::string const& str = tmp.str();
+		putBytes(str.data(), str.size());
+	}
+}
+
+inline bool TreeWriter::flush()
+{
+	char const* data = mBuffer.data();
+	size_t left = mUsed;
+
+	while ( mGood && left > 0 )
+	{
+		auto ret = ::write(mFd, data, static_cast<unsigned>(left < (1u<<30) ? left : (1u<<30)));
+		if ( ret < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			mGood = false;
+		}
+		else
+		{
+			data += ret;
+			left -= static_cast<size_t>(ret);
+			mBytes += static_cast<uint64_t>(ret);
+		}
+	}
+
+	mUsed = 0;									// 出错时丢弃缓冲区，避免无限增长
+
+	return mGood;
+}
+
+inline bool TreeWriter::good() const
+{
+	return mGood;
+}
+
+inline TreeWriter::Format TreeWriter::getFormat() const
+{
+	return mFormat;
+}
+
+inline uint64_t TreeWriter::getBytes() const
+{
+	return mBytes;
+}
+
+/*	树快照文件格式（版本1）：32字节文件头，后面紧跟count个升序排列、按内存布局原样保存的key
+ *	文件头记录key的字节数和字节序标记，读入时不一致就拒绝，不做任何转换
+ */
+struct TreeSnapshotHeader
+{
+	static constexpr char MAGIC[8] = { 'V', 'L', 'T', 'R', 'E', 'E', 'S', 'N' };
+	static constexpr uint32_t VERSION = 1;
+	static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+	char mMagic[8];
+	uint32_t mVersion;
+	uint32_t mKeySize;
+	uint64_t mCount;
+	uint32_t mEndianTag;
+	uint32_t mReserved;
+
+	template <typename T>
+	static TreeSnapshotHeader make(uint64_t count);
+	template <typename T>
+	bool matches() const;
+};
+
+static_assert(sizeof(TreeSnapshotHeader) == 32, "snapshot header layout must not depend on the compiler");
+
+template <typename T>
+TreeSnapshotHeader TreeSnapshotHeader::make(uint64_t count)
+{
+	TreeSnapshotHeader ret;
+
+	memcpy(ret.mMagic, MAGIC, sizeof(MAGIC));
+	ret.mVersion = VERSION;
+	ret.mKeySize = sizeof(T);
+	ret.mCount = count;
+	ret.mEndianTag = ENDIAN_TAG;
+	ret.mReserved = 0;
+
+	return ret;
+}
+
+template <typename T>
+bool TreeSnapshotHeader::matches() const
+{
+	return memcmp(mMagic, MAGIC, sizeof(MAGIC)) == 0 && mVersion == VERSION &&
+		   mKeySize == sizeof(T) && mEndianTag == ENDIAN_TAG;
+}
+
+/*	只读映射整个快照文件，key直接在映射的内存上使用，不经过read()复制
+ *	Windows下没有mmap，退回一次性读入内存
+ */
+class TreeSnapshot
+{
+public:
+	explicit TreeSnapshot(const char* path);
+	TreeSnapshot(const TreeSnapshot&) = delete;
+	TreeSnapshot& operator = (const TreeSnapshot&) = delete;
+	~TreeSnapshot();
+
+	template <typename T>
+	T const* keys() const;						// 文件头与T不匹配或文件不完整时返回nullptr
+	uint64_t getCount() const;
+
+private:
+	char const* mData;
+	uint64_t mSize;
+#ifdef _WIN32
+	std::vector<char> mBuffer;
+#endif
+};
+
+inline TreeSnapshot::TreeSnapshot(const char* path) : mData(nullptr), mSize(0ull)
+{
+	int fd = ::open(path, O_RDONLY | O_BINARY);
+	if ( fd < 0 )
+		return;
+
+	struct stat info;
+	if ( ::fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(sizeof(TreeSnapshotHeader)) )
+	{
+		mSize = static_cast<uint64_t>(info.st_size);
+#ifdef _WIN32
+		mBuffer.resize(mSize);
+		uint64_t done = 0;
+		while ( done < mSize )
+		{
+			int ret = ::read(fd, mBuffer.data()+done, static_cast<unsigned>(mSize-done < (1u<<30) ? mSize-done : (1u<<30)));
+			if ( ret <= 0 )
+				break;
+			done += static_cast<uint64_t>(ret);
+		}
+		if ( done == mSize )
+			mData = mBuffer.data();
+#else
+		void* ret = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( ret != MAP_FAILED )
+		{
+			::madvise(ret, mSize, MADV_SEQUENTIAL);	// 只顺序读一遍，让内核提前大块预读
+			::madvise(ret, mSize, MADV_WILLNEED);
+			mData = static_cast<char const*>(ret);
+		}
+#endif
+	}
+
+	::close(fd);								// 映射建立后不再需要文件描述符
+	if ( mData == nullptr )
+		mSize = 0ull;
+}
+
+inline TreeSnapshot::~TreeSnapshot()
+{
+#ifndef _WIN32
+	if ( mData != nullptr )
+		::munmap(const_cast<char*>(mData), mSize);
+#endif
+}
+
+template <typename T>
+T const* TreeSnapshot::keys() const
+{
+	if ( mData == nullptr )
+		return nullptr;
+
+	TreeSnapshotHeader header;
+	memcpy(&header, mData, sizeof(header));
+	if ( !header.matches<T>() || (mSize - sizeof(header)) / sizeof(T) < header.mCount )
+		return nullptr;
+
+	return reinterpret_cast<T const*>(mData + sizeof(header));	// 文件头32字节，映射按页对齐，key是对齐的
+}
+
+inline uint64_t TreeSnapshot::getCount() const
+{
+	TreeSnapshotHeader header;
+
+	if ( mData == nullptr )
+		return 0ull;
+	memcpy(&header, mData, sizeof(header));
+
+	return header.mCount;
+}
+
+}
+
+#endif // TREEIO_H
@@ -0,0 +1,301 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Viclib
+{
+
+/*	测试用的key生成，全部在计时之前生成到缓冲区里
+ *	随机数用xoshiro256**：每个数只需几次移位、异或和乘法，周期2^256-1，比rand()快得多，64位全部均匀
+ */
+class WorkloadRandom
+{
+private:
+	uint64_t mState[4];
+
+	static uint64_t rotl(uint64_t x, int k);
+
+public:
+	explicit WorkloadRandom(uint64_t seed);
+
+	uint64_t next();
+	uint64_t below(uint64_t bound);				// [0, bound)内的整数，用乘法取高64位代替取模
+	double uniform();							// [0, 1)内的浮点数
+};
+
+/*	[0, range)上由种子决定的一个随机排列，operator()(i)给出第i个位置上的数，O(1)时间、不占额外内存
+ *	用4轮Feistel网络在覆盖range的最小偶数位宽上做双射，结果落在range之外就继续加密（cycle walking）；
+ *	位宽取偶数后定义域不超过range的4倍，平均不到4次加密，与已经生成过哪些数无关，不需要查重重试
+ */
+class WorkloadPermutation
+{
+private:
+	static constexpr int ROUNDS = 4;
+
+	uint64_t mRange;
+	uint32_t mHalfBits;
+	uint64_t mMask;
+	uint64_t mRoundKeys[ROUNDS];
+
+	uint64_t encrypt(uint64_t x) const;
+
+public:
+	WorkloadPermutation(uint64_t range, uint64_t seed);
+
+	uint64_t operator () (uint64_t i) const;	// 要求i < range
+};
+
+/*	Zipf分布的排名[0, n)，排名0最热；按Gray等人的方法预先算好zeta(n)，之后每次采样O(1)
+ *	n很大时zeta(n)的尾部用积分近似，误差远小于采样本身的波动
+ */
+class WorkloadZipf
+{
+private:
+	static constexpr uint64_t EXACT_TERMS = 1ull<<22;
+
+	uint64_t mCount;
+	double mTheta;
+	double mAlpha;
+	double mZetaN;
+	double mEta;
+
+	static double zeta(uint64_t n, double theta);
+
+public:
+	WorkloadZipf(uint64_t count, double theta = 0.99);	// theta在(0, 1)内，越大越偏斜
+
+	uint64_t next(WorkloadRandom& random) const;
+};
+
+enum KeyDistribution
+{
+	KEYS_UNIFORM,		// [0, range)内均匀分布，可能重复
+	KEYS_PERMUTATION,	// [0, range)内互不相同，随机顺序
+	KEYS_SEQUENTIAL,	// 互不相同，按升序等间距铺满[0, range)
+	KEYS_REVERSE,		// 同上，按降序
+	KEYS_CLUSTERED,		// 互不相同，每CLUSTER_SIZE个连续的key组成一簇，簇按随机顺序出现
+	KEYS_ZIPF,			// Zipf分布，可能重复，热门key经随机排列打散到[0, range)内
+	KEY_DISTRIBUTIONS
+};
+
+static constexpr uint64_t CLUSTER_SIZE = 64;
+
+static char const* const KEY_DISTRIBUTION_NAMES[KEY_DISTRIBUTIONS] = { "uniform", "permutation", "sequential", "reverse", "clustered", "zipf" };
+
+bool parseKeyDistribution(const char* name, KeyDistribution& dist);
+
+/*	生成count个[0, range)内的key；不重复的分布要求count <= range，否则返回空数组
+ */
+std::vector<uint64_t> generateKeys(KeyDistribution dist, uint64_t count, uint64_t range, uint64_t seed);
+
+inline uint64_t WorkloadRandom::rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64-k));
+}
+
+inline WorkloadRandom::WorkloadRandom(uint64_t seed)
+{
+	for ( uint64_t& s : mState )				// 用splitmix64展开种子，保证状态不全为0
+	{
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		s = z ^ (z >> 31);
+	}
+}
+
+inline uint64_t WorkloadRandom::next()
+{
+	uint64_t const ret = rotl(mState[1] * 5, 7) * 9;
+	uint64_t const t = mState[1] << 17;
+
+	mState[2] ^= mState[0];
+	mState[3] ^= mState[1];
+	mState[1] ^= mState[2];
+	mState[0] ^= mState[3];
+	mState[2] ^= t;
+	mState[3] = rotl(mState[3], 45);
+
+	return ret;
+}
+
+inline uint64_t WorkloadRandom::below(uint64_t bound)
+{
+#if defined(_MSC_VER)
+	return __umulh(next(), bound);					// 128位乘积的高64位
+#else
+	return static_cast<uint64_t>((static_cast<unsigned __int128>(next()) * bound) >> 64);
+#endif
+}
+
+inline double WorkloadRandom::uniform()
+{
+	return static_cast<double>(next() >> 11) * 0x1.0p-53;
+}
+
+inline WorkloadPermutation::WorkloadPermutation(uint64_t range, uint64_t seed) : mRange(range), mHalfBits(1)
+{
+	while ( mHalfBits < 32 && (1ull << (2*mHalfBits)) < range )
+		++mHalfBits;
+	mMask = (1ull << mHalfBits) - 1ull;
+
+	WorkloadRandom random(seed);
+	for ( uint64_t& key : mRoundKeys )
+		key = random.next();
+}
+
+inline uint64_t WorkloadPermutation::encrypt(uint64_t x) const
+{
+	uint64_t left = x >> mHalfBits;
+	uint64_t right = x & mMask;
+
+	for ( uint64_t key : mRoundKeys )
+	{
+		uint64_t f = right ^ key;				// 轮函数用splitmix64的末尾混合
+		f = (f ^ (f >> 30)) * 0xbf58476d1ce4e5b9ull;
+		f = (f ^ (f >> 27)) * 0x94d049bb133111ebull;
+		f ^= f >> 31;
+
+		uint64_t tmp = right;
+		right = left ^ (f & mMask);
+		left = tmp;
+	}
+
+	return (left << mHalfBits) | right;
+}
+
+inline uint64_t WorkloadPermutation::operator () (uint64_t i) const
+{
+	do
+		i = encrypt(i);
+	while ( i >= mRange );
+
+	return i;
+}
+
+inline double WorkloadZipf::zeta(uint64_t n, double theta)
+{
+	uint64_t const exact = n < EXACT_TERMS ? n : EXACT_TERMS;
+	double sum = 0.0;
+
+	for ( uint64_t i = exact; i >= 1; --i )		// 从小项加起，减少舍入误差
+		sum += 1.0 / pow(static_cast<double>(i), theta);
+
+	if ( n > exact )							// 欧拉-麦克劳林：积分加端点修正
+	{
+		double a = static_cast<double>(exact), b = static_cast<double>(n);
+		sum += (pow(b, 1.0-theta) - pow(a, 1.0-theta)) / (1.0-theta) + 0.5 * (pow(b, -theta) - pow(a, -theta));
+	}
+
+	return sum;
+}
+
+inline WorkloadZipf::WorkloadZipf(uint64_t count, double theta) :
+	mCount(count), mTheta(theta), mAlpha(1.0 / (1.0-theta)), mZetaN(zeta(count, theta)),
+	mEta((1.0 - pow(2.0 / static_cast<double>(count), 1.0-theta)) / (1.0 - zeta(2, theta) / mZetaN))
+{
+}
+
+inline uint64_t WorkloadZipf::next(WorkloadRandom& random) const
+{
+	double u = random.uniform();
+	double uz = u * mZetaN;
+
+	if ( uz < 1.0 || mCount < 2 )
+		return 0;
+	if ( uz < 1.0 + pow(0.5, mTheta) )
+		return 1;
+
+	uint64_t ret = static_cast<uint64_t>(static_cast<double>(mCount) * pow(mEta*u - mEta + 1.0, mAlpha));
+
+	return ret < mCount ? ret : mCount-1;
+}
+
+inline bool parseKeyDistribution(const char* name, KeyDistribution& dist)
+{
+	for ( int i = 0; i < KEY_DISTRIBUTIONS; ++i )
+		if ( strcmp(name, KEY_DISTRIBUTION_NAMES[i]) == 0 )
+		{
+			dist = static_cast<KeyDistribution>(i);
+			return true;
+		}
+
+	return false;
+}
+
+inline std::vector<uint64_t> generateKeys(KeyDistribution dist, uint64_t count, uint64_t range, uint64_t seed)
+{
+	bool const unique = dist != KEYS_UNIFORM && dist != KEYS_ZIPF;
+	if ( range == 0 || (unique && count > range) )
+		return std::vector<uint64_t>();
+
+	std::vector<uint64_t> keys(count);
+	WorkloadRandom random(seed);
+	uint64_t const stride = (count > 0) ? range / count : 1;
+
+	switch ( dist )
+	{
+	case KEYS_UNIFORM:
+		for ( uint64_t& key : keys )
+			key = random.below(range);
+		break;
+
+	case KEYS_PERMUTATION:
+	{
+		WorkloadPermutation permutation(range, seed);
+		for ( uint64_t i = 0; i < count; ++i )
+			keys[i] = permutation(i);
+		break;
+	}
+
+	case KEYS_SEQUENTIAL:
+		for ( uint64_t i = 0; i < count; ++i )
+			keys[i] = i * stride;
+		break;
+
+	case KEYS_REVERSE:
+		for ( uint64_t i = 0; i < count; ++i )
+			keys[i] = (count-1-i) * stride;
+		break;
+
+	case KEYS_CLUSTERED:
+	{
+		uint64_t const full = count / CLUSTER_SIZE;	// 只打乱完整的簇，最后不满的一簇留在原位
+		WorkloadPermutation permutation(full > 0 ? full : 1, seed);
+
+		for ( uint64_t i = 0; i < count; ++i )
+		{
+			uint64_t cluster = i / CLUSTER_SIZE;
+			if ( cluster < full )
+				cluster = permutation(cluster);
+			keys[i] = cluster * CLUSTER_SIZE * stride + i % CLUSTER_SIZE;	// 簇内连续，簇之间相隔(stride-1)*CLUSTER_SIZE
+		}
+		break;
+	}
+
+	case KEYS_ZIPF:
+	{
+		WorkloadZipf zipf(range);
+		WorkloadPermutation permutation(range, seed);
+		for ( uint64_t& key : keys )
+			key = permutation(zipf.next(random));
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	return keys;
+}
+
+}
+
+#endif // WORKLOAD_H
@@ -0,0 +1,147 @@
+#include "BPlusTree.h"
+
+#include "Times.h"
+#include "Workload.h"
+
+using namespace std;
+using namespace Viclib;
+
+#ifndef BPLUSTREE_NODE_BYTES
+#define BPLUSTREE_NODE_BYTES 256
+#endif
+
+typedef uint64_t templateType;
+typedef BPlusTree<templateType, BPLUSTREE_NODE_BYTES> treeType;
+
+static KeyDistribution const distribution = KEYS_PERMUTATION;	// 插入顺序；改成KEYS_SEQUENTIAL、KEYS_CLUSTERED等可以观察不同的插入模式
+
+int main(int argc, char* argv[])
+{
+	// msys2终端1920*2宽424个英文字符
+	uint16_t layer = 16;
+
+	if ( argc >= 2 && atoi(argv[1])>=0 )
+		layer = static_cast<uint16_t>(atoi(argv[1]));
+	else {
+		cout << "请输入结点层数，注意内存大小" << endl;
+		cin >> layer;
+	}
+
+	timingStart();
+	cout << endl;
+
+	uint64_t const count = (1ull<<layer)-1ull;
+
+	cout << "您设定的最大层数上限：" << layer << endl;
+	cout << "您设定的最大结点数上限：" << count << endl;
+	cout << "结点大小：" << BPLUSTREE_NODE_BYTES << "字节\t叶子容量：" << treeType::Leaf::CAPACITY
+		 << "\t内部结点容量：" << treeType::Inner::CAPACITY << endl;
+
+	templateType const* t = nullptr;
+	treeType* tree = new treeType();
+
+	uint64_t const seed = static_cast<uint64_t>(time(nullptr));
+	vector<uint64_t> const keys = generateKeys(distribution, count, count*2, seed);	// 预先生成，插入循环里不再产生随机数和重试
+
+	LatencyHistogram insertLatency, searchLatency, removeLatency;	// 单次操作的延迟分布，看结点分裂与合并带来的长尾
+
+	cout << endl << "添加元素（" << KEY_DISTRIBUTION_NAMES[distribution] << "）：\n\tkey\tcount\tlayer" << endl;
+	ScopedTimer insertTimer("insert", keys.size());
+	for ( uint64_t key : keys )
+	{
+		uint64_t const begin = cycleStart();
+		bool const inserted = tree->tryInsert(static_cast<templateType>(key)).second;
+		insertLatency.record(cycleEnd() - begin);
+		if ( !inserted )					// 可能重复的分布里已存在的key直接跳过
+			continue;
+
+		if ( (tree->getCount()*100%count) == 0 || tree->getCount() == count )
+			cout << "\r已添加：" << setw(2) << tree->getCount()*100.0/count << '%' << flush;
+	}
+	insertTimer.stop();
+	cout << endl;
+
+	char const* reason = nullptr;
+	cout << "\nB+树校验结果：";
+	if ( tree->validate(&reason) )
+		cout << "成功\n" << endl;
+	else
+	{
+		cout << reason << "\n" << endl;
+
+		cout << "输出目录树模式关系图：" << endl;
+		tree->printTree();
+		cout << endl;
+
+		exit(1);
+	}
+
+	ScopedTimer traverseTimer("traverse");
+	cout << "中序遍历: ";
+	tree->inOrder();
+	cout << "\n广度优先: ";
+	tree->levelOrder();
+	cout << endl;
+	traverseTimer.stop();
+
+	if ( (t = tree->minimum()) != nullptr )
+		cout << "最小结点：" << *t << endl;
+	if ( (t = tree->maximum()) != nullptr )
+		cout << "最大结点：" << *t << endl;
+	cout << "树的结点数：" << tree->getCount() << endl;
+	cout << "树的层数：" << tree->getHeight() << endl;
+
+	cout << "输出目录树模式关系图：" << endl;
+	tree->printTree();
+	cout << endl;
+
+	{										// 均匀随机查找，大约一半的key不在树中
+		uint64_t const lookups = count < (1ull<<20) ? (1ull<<20) : count;
+		vector<uint64_t> const probes = generateKeys(KEYS_UNIFORM, lookups, count*2, seed+2);
+		uint64_t hits = 0;
+
+		ScopedTimer searchTimer("search", lookups);
+		for ( uint64_t key : probes )
+		{
+			uint64_t const begin = cycleStart();
+			hits += tree->iterativeSearch(static_cast<templateType>(key)) != nullptr;
+			searchLatency.record(cycleEnd() - begin);
+		}
+		searchTimer.stop();
+		cout << "随机查找：" << lookups << "次，命中" << hits << "次" << endl;
+	}
+
+	if ( argc >= 3 )						// 第二个参数是导出文件路径，按升序每行一个key
+		cout << "导出到" << argv[2] << "：" << (tree->exportKeys(argv[2]) ? "成功" : "失败") << endl;
+
+	cout << "开始删除：\n\tkey\tcount\tlayer" << endl;
+	vector<uint64_t> const order = generateKeys(KEYS_PERMUTATION, keys.size(), keys.size(), seed+1);	// 按插入key的另一种随机排列删除
+	ScopedTimer deleteTimer("delete", order.size());
+	for ( uint64_t i : order )
+	{
+		uint64_t const begin = cycleStart();
+		bool const removed = tree->remove(static_cast<templateType>(keys[i]));
+		removeLatency.record(cycleEnd() - begin);
+		if ( removed )
+		{
+			if ( (tree->getCount()*100%count) == 0 || tree->getCount() == count )
+				cout << "\r已删除：" << setw(2) << (count-tree->getCount())*100.0/count << '%' << flush;
+		}
+	}
+	deleteTimer.stop();
+	cout << endl;
+
+	cout << "单次操作延迟：" << endl;
+	insertLatency.print("insert");
+	searchLatency.print("search");
+	removeLatency.print("remove");
+
+	tree->destroy();
+	delete tree;
+	tree = nullptr;
+
+	cout << endl;
+	timingEnd();
+
+	return 0;
+}
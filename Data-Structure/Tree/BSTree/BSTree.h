@@ -3,6 +3,10 @@
 
 #include <iostream>
 #include <queue>
+#include <vector>
+#include <type_traits>
+
+#include "TreeIO.h"
 
 using namespace std;
 
@@ -74,11 +78,8 @@ protected:
 	BSTNode<T>* mRoot;
 	size_t mCount;
 
-	virtual void preOrder(BSTNode<T> *tree) const;								// 深度优先的前、中、后序遍历
-	virtual void inOrder(BSTNode<T> *tree) const;
-	virtual void postOrder(BSTNode<T> *tree) const;
-
-	virtual void levelOrder(BSTNode<T> *tree) const;							// 广度优先
+	template <typename F>
+	static bool visit(F& visitor, const T& key);	// visitor可以返回void或bool
 
 	virtual BSTNode<T>* search(BSTNode<T> *tree, const T& key) const;			// 递归版搜索
 	virtual BSTNode<T>* iterativeSearch(BSTNode<T> *tree, const T& key) const;	// 非递归版搜索
@@ -112,6 +113,17 @@ public:
 
 	virtual void levelOrder() const;
 
+	template <typename F>
+	bool forEachPreOrder(F&& visitor) const;		// 非递归遍历，visitor(key)返回false时提前结束，返回值表示是否遍历完整棵树
+	template <typename F>
+	bool forEachInOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachPostOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachLevelOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachInRange(const T& lo, const T& hi, F&& visitor) const;	// 按升序访问[lo, hi)内的key
+
 	virtual BSTNode<T>* search(const T& key) const;
 	virtual BSTNode<T>* iterativeSearch(const T& key) const;
 
@@ -129,6 +141,9 @@ public:
 
 	virtual const T& getRootKey() const;
 	virtual void printTree() const;
+	virtual bool exportKeys(TreeWriter& writer) const;		// 按升序把全部key写入缓冲区，整块write(2)写出
+	virtual bool exportKeys(int fd, TreeWriter::Format format = TreeWriter::TEXT) const;
+	virtual bool exportKeys(const char* path, TreeWriter::Format format = TreeWriter::TEXT) const;
 };
 
 template < typename T >
@@ -137,84 +152,183 @@ BSTree<T>::BSTree() : mRoot(nullptr), mCount(0)
 }
 
 template < typename T >
-void BSTree<T>::preOrder(BSTNode<T> *tree) const
+void BSTree<T>::preOrder() const
 {
-	if ( tree != nullptr )
-	{
-		cout << tree->mKey << " " << flush;
-		preOrder(tree->mLeft);
-		preOrder(tree->mRight);
-	}
+	forEachPreOrder([](const T& key) { cout << key << " "; });
+	cout << flush;
 }
 
 template < typename T >
-void BSTree<T>::preOrder() const
+void BSTree<T>::inOrder() const
 {
-	preOrder(dynamic_cast<BSTNode<T>*>(this->mRoot));
+	forEachInOrder([](const T& key) { cout << key << " "; });
+	cout << flush;
 }
 
 template < typename T >
-void BSTree<T>::inOrder(BSTNode<T> *tree) const
+void BSTree<T>::postOrder() const
 {
-	if ( tree != nullptr )
-	{
-		inOrder(tree->mLeft);
-		cout << tree->mKey << " " << flush;
-		inOrder(tree->mRight);
-	}
+	forEachPostOrder([](const T& key) { cout << key << " "; });
+	cout << flush;
 }
 
 template < typename T >
-void BSTree<T>::inOrder() const
+void BSTree<T>::levelOrder() const
 {
-	inOrder(dynamic_cast<BSTNode<T>*>(this->mRoot));
+	forEachLevelOrder([](const T& key) { cout << key << " "; });
+	cout << flush;
 }
 
 template < typename T >
-void BSTree<T>::postOrder(BSTNode<T> *tree) const
+template <typename F>
+bool BSTree<T>::visit(F& visitor, const T& key)
 {
-	if ( tree != nullptr )
+	if constexpr ( is_void<decltype(visitor(key))>::value )		// 返回void的visitor不能提前结束
 	{
-		postOrder(tree->mLeft);
-		postOrder(tree->mRight);
-		cout << tree->mKey << " " << flush;
+		visitor(key);
+		return true;
 	}
+	else
+		return static_cast<bool>(visitor(key));
 }
 
 template < typename T >
-void BSTree<T>::postOrder() const
+template <typename F>
+bool BSTree<T>::forEachPreOrder(F&& visitor) const
 {
-	postOrder(dynamic_cast<BSTNode<T>*>(this->mRoot));
+	vector<BSTNode<T>*> stack;
+	if ( mRoot != nullptr )
+		stack.push_back(mRoot);
+
+	while ( !stack.empty() )
+	{
+		BSTNode<T>* node = stack.back();
+		stack.pop_back();
+
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		if ( node->mRight != nullptr )			// 右孩子先进栈，左子树先访问
+			stack.push_back(node->mRight);
+		if ( node->mLeft != nullptr )
+			stack.push_back(node->mLeft);
+	}
+
+	return true;
 }
 
 template < typename T >
-void BSTree<T>::levelOrder(BSTNode<T> *tree) const
+template <typename F>
+bool BSTree<T>::forEachInOrder(F&& visitor) const
 {
-	if ( tree != nullptr )
+	vector<BSTNode<T>*> stack;						// 当前结点到根路径上还没有访问的祖先
+	BSTNode<T>* node = mRoot;
+
+	while ( node != nullptr || !stack.empty() )
 	{
-		queue<BSTNode<T>*> tmp;
-		tmp.push(tree);
+		for ( ; node != nullptr; node = node->mLeft )
+			stack.push_back(node);
 
-		while( tmp.size() > 0 )
-		{
-			BSTNode<T>* t = tmp.front();
-			tmp.pop();
+		node = stack.back();
+		stack.pop_back();
+
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		node = node->mRight;
+	}
+
+	return true;
+}
 
-			if ( t->mLeft != nullptr )
-				tmp.push(t->mLeft);
+template < typename T >
+template <typename F>
+bool BSTree<T>::forEachPostOrder(F&& visitor) const
+{
+	vector<BSTNode<T>*> stack;
+	BSTNode<T>* node = mRoot;
+	BSTNode<T>* last = nullptr;						// 上一个访问的结点，用来判断右子树是否已经访问过
 
-			if ( t->mRight != nullptr )
-				tmp.push(t->mRight);
+	while ( node != nullptr || !stack.empty() )
+	{
+		for ( ; node != nullptr; node = node->mLeft )
+			stack.push_back(node);
 
-			cout << t->mKey << " " << flush;
+		BSTNode<T>* top = stack.back();
+		if ( top->mRight != nullptr && top->mRight != last )
+			node = top->mRight;
+		else
+		{
+			if ( !visit(visitor, top->mKey) )
+				return false;
+
+			last = top;
+			stack.pop_back();
 		}
 	}
+
+	return true;
 }
 
 template < typename T >
-void BSTree<T>::levelOrder() const
+template <typename F>
+bool BSTree<T>::forEachLevelOrder(F&& visitor) const
 {
-	levelOrder(dynamic_cast<BSTNode<T>*>(this->mRoot));
+	queue<BSTNode<T>*> tmp;
+	if ( mRoot != nullptr )
+		tmp.push(mRoot);
+
+	while ( !tmp.empty() )
+	{
+		BSTNode<T>* node = tmp.front();
+		tmp.pop();
+
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		if ( node->mLeft != nullptr )
+			tmp.push(node->mLeft);
+		if ( node->mRight != nullptr )
+			tmp.push(node->mRight);
+	}
+
+	return true;
+}
+
+template < typename T >
+template <typename F>
+bool BSTree<T>::forEachInRange(const T& lo, const T& hi, F&& visitor) const
+{
+	vector<BSTNode<T>*> stack;						// 只保存不小于lo的祖先，小于lo的结点连同左子树整个跳过
+	BSTNode<T>* node = mRoot;
+
+	while ( node != nullptr || !stack.empty() )
+	{
+		while ( node != nullptr )
+		{
+			if ( node->mKey < lo )
+				node = node->mRight;
+			else
+			{
+				stack.push_back(node);
+				node = node->mLeft;
+			}
+		}
+		if ( stack.empty() )						// 剩下的结点都小于lo，比如lo大于最大key
+			return true;
+
+		node = stack.back();
+		stack.pop_back();
+
+		if ( !(node->mKey < hi) )
+			return true;
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		node = node->mRight;
+	}
+
+	return true;
 }
 
 template < typename T >
@@ -552,6 +666,30 @@ void BSTree<T>::printTree(BSTNode<T> *tree, bool firstNode) const
 	--layer;							// 结点回溯时高度需要减1
 }
 
+template < typename T >
+bool BSTree<T>::exportKeys(TreeWriter& writer) const
+{
+	forEachInOrder([&writer](const T& key) { writer.put(key); });
+
+	return writer.flush();
+}
+
+template < typename T >
+bool BSTree<T>::exportKeys(int fd, TreeWriter::Format format) const
+{
+	TreeWriter writer(fd, format);
+
+	return exportKeys(writer);
+}
+
+template < typename T >
+bool BSTree<T>::exportKeys(const char* path, TreeWriter::Format format) const
+{
+	TreeWriter writer(path, format);
+
+	return writer.good() && exportKeys(writer) && writer.commit();
+}
+
 template <typename T>
 void BSTree<T>::printTree() const
 {
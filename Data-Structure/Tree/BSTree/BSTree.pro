@@ -3,9 +3,13 @@ CONFIG += console c++17
 CONFIG -= app_bundle
 CONFIG -= qt
 
+# DEFINES += TIMES_PERF=0	# 关掉Times.h中的硬件计数器（perf_event_open）
+
 SOURCES += \
     main.cpp
 
 HEADERS += \
     BSTree.h \
-    Times.h
+    Times.h \
+    TreeIO.h \
+    Workload.h
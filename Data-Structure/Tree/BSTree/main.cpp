@@ -1,22 +1,24 @@
 #include <iostream>
 #include <iomanip>
-#include <cmath>
 
 #include "BSTree.h"
 
 #include "Times.h"
+#include "Workload.h"
 
 using namespace std;
 using namespace Viclib;
 
+static KeyDistribution const distribution = KEYS_PERMUTATION;	// 插入顺序；如果是KEYS_SEQUENTIAL，会退化成链表模式，且插入变慢
+
 int main(int argc, char* argv[])
 {
 	uint16_t layer = 8;	// 结点最小层数
 
-	if ( argc == 2 && atoi(argv[1])>0 )
+	if ( argc >= 2 && atoi(argv[1])>0 )
 		layer = static_cast<uint8_t>(atoi(argv[1]));
 	else {
-		cout << "请输入结点最小层数，注意内存大小" << log(RAND_MAX*RAND_MAX+1+RAND_MAX*2)/log(2) << endl;
+		cout << "请输入结点最小层数，注意内存大小" << endl;
 		cin >> layer;
 	}
 
@@ -29,11 +31,17 @@ int main(int argc, char* argv[])
 
 	BSTree<uint64_t> *tree = new BSTree<uint64_t>();
 
+	vector<uint64_t> const keys = generateKeys(distribution, count, count*2, static_cast<uint64_t>(time(nullptr)));	// 预先生成，插入循环里不再产生随机数
+
+	LatencyHistogram insertLatency, removeLatency;	// 单次操作的延迟分布
+
 	speed = 0;
-	srand(static_cast<unsigned int>(time(nullptr)));
-	while ( tree->getCount() < count )
+	ScopedTimer insertTimer("insert", keys.size());
+	for ( uint64_t key : keys )
 	{
-		tree->insert(static_cast<size_t>(rand()*rand()+1+RAND_MAX*2));	// 使用随机值插入；如果是顺序值，会退化成链表模式，且插入变慢
+		uint64_t const begin = cycleStart();
+		tree->insert(key);
+		insertLatency.record(cycleEnd() - begin);
 
 		if ( (tree->getCount()*100/count > speed) || (tree->getCount() == count) )	// 进度值出现变化或完成操作时才能输出
 		{
@@ -41,8 +49,10 @@ int main(int argc, char* argv[])
 			cout << "\r已添加：" << setw(3) << speed << '%' << flush;
 		}
 	}
+	insertTimer.stop();
 	cout << endl;
 
+	ScopedTimer traverseTimer("traverse");
 	cout << "\n前序遍历: ";
 	tree->preOrder();
 	cout << endl;
@@ -58,19 +68,27 @@ int main(int argc, char* argv[])
 	cout << "\n广度遍历：";
 	tree->levelOrder();
 	cout << endl;
+	traverseTimer.stop();
 
 	cout << "\n最小值: " << tree->minimum();
 	cout << "\n最大值: " << tree->maximum();
 	cout << "\n树高度 = " << tree->height();
 	cout << "\n结点数= " << tree->getCount();
 	cout << endl;
+	uint64_t inRange = 0;					// 范围查询自检：整段在最大key之上的区间什么也不访问，[最小, 最大+1)访问全部结点
+	bool rangeOk = tree->forEachInRange(tree->maximum()+1, tree->maximum()+100, [&inRange](const uint64_t&) { ++inRange; }) && inRange == 0;
+	rangeOk = rangeOk && tree->forEachInRange(tree->minimum(), tree->maximum()+1, [&inRange](const uint64_t&) { ++inRange; }) && inRange == tree->getCount();
+	cout << "范围查询校验：" << (rangeOk ? "成功" : "失败") << endl;
 
 	cout << "\n输出树形信息：" << endl;
 	tree->printTree();
 	cout << endl;
 
+	if ( argc >= 3 )						// 第二个参数是导出文件路径，按升序每行一个key
+		cout << "导出到" << argv[2] << "：" << (tree->exportKeys(argv[2]) ? "成功" : "失败") << endl;
+
 	speed = 0;
-	srand(static_cast<unsigned int>(time(nullptr)));
+	ScopedTimer deleteTimer("delete", tree->getCount());
 	while ( tree->getCount() )
 	{
 		uint64_t node;
@@ -79,7 +97,9 @@ int main(int argc, char* argv[])
 //		else
 //			node = static_cast<size_t>(rand()*rand()+1+RAND_MAX*2);
 
+		uint64_t const begin = cycleStart();
 		tree->remove(node);
+		removeLatency.record(cycleEnd() - begin);
 
 		if ( ((count-tree->getCount())*100/count > speed) || (tree->getCount() == count) )
 		{
@@ -87,8 +107,13 @@ int main(int argc, char* argv[])
 			cout << "\r已删除：" << setw(3) << speed << '%' << flush;
 		}
 	}
+	deleteTimer.stop();
 	cout << endl;
 
+	cout << "\n单次操作延迟：" << endl;
+	insertLatency.print("insert");
+	removeLatency.print("remove");
+
 	tree->destroy();
 	delete tree;
 	tree = nullptr;
@@ -0,0 +1,305 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <chrono>
+#include <limits>
+#include <set>
+#include <vector>
+
+#include "AVLTree.h"
+#include "BPlusTree.h"
+#include "BSTree.h"
+#include "RBTree.h"
+#include "Times.h"
+#include "Workload.h"
+
+using namespace std;
+
+namespace Viclib
+{
+
+/*	统一的基准测试：同一组预先生成的key依次跑完全部负载，每种负载单独计时
+ *	  insert       按指定的顺序插入n个互不相同的key
+ *	  lookup-hit   按指定的分布查找n次已插入的key
+ *	  lookup-miss  查找n个不在树中的key
+ *	  range        n/64次范围扫描，每次从随机key开始按升序访问至多64个key
+ *	  mixed        n次操作：一半查找（命中和未命中各半），四分之一插入新key，四分之一删除已有key，树的大小基本不变
+ *	  delete       删除树中剩下的全部key
+ *	key由Workload.h在计时之前全部生成好，计时区间里只有树的操作；每种负载的结果累加到mCheck中，既防止被编译器优化掉，也可以在不同的树之间核对
+ *	insert、lookup-hit、lookup-miss和delete还用TSC记录每次操作的周期数，得到p50/p99/p99.9/最大延迟；
+ *	这四种负载的平均耗时因此包含每次两个带屏障的TSC读数（约几十个周期）
+ */
+enum BenchWorkload { BENCH_INSERT, BENCH_LOOKUP_HIT, BENCH_LOOKUP_MISS, BENCH_RANGE, BENCH_MIXED, BENCH_DELETE, BENCH_WORKLOADS };
+
+static char const* const BENCH_WORKLOAD_NAMES[BENCH_WORKLOADS] = { "insert", "lookup-hit", "lookup-miss", "range", "mixed", "delete" };
+
+struct BenchResult
+{
+	uint64_t mOps;
+	double mSeconds;
+	uint64_t mCheck;
+	bool mLatency;				// 是否记录了单次延迟，没有时下面四项为0
+	double mP50Ns;
+	double mP99Ns;
+	double mP999Ns;
+	double mMaxNs;
+};
+
+struct BenchReport				// 一个配置（一种树、一个规模）在子进程中的全部结果，经管道原样传回父进程
+{
+	BenchResult mResults[BENCH_WORKLOADS];
+	uint64_t mBaseRssKb;		// 生成key之后、建树之前的峰值常驻内存
+	uint64_t mPeakRssKb;		// 全部负载结束时的峰值常驻内存
+	bool mOk;
+};
+
+/*	把仓库里各棵树和std::set包装成相同的接口，key固定为uint64_t
+ */
+template <typename Tree>
+class BenchTree
+{
+private:
+	Tree mTree;
+
+public:
+	void insert(uint64_t key)
+	{
+		mTree.insert(key);
+	}
+
+	bool contains(uint64_t key) const
+	{
+		return mTree.iterativeSearch(key) != nullptr;
+	}
+
+	void remove(uint64_t key)
+	{
+		mTree.remove(key);
+	}
+
+	uint64_t scan(uint64_t lo, uint64_t len) const
+	{
+		uint64_t sum = 0;
+		mTree.forEachInRange(lo, numeric_limits<uint64_t>::max(), [&](const uint64_t& key)
+		{
+			sum += key;
+			return --len > 0;
+		});
+		return sum;
+	}
+};
+
+template <>
+class BenchTree<set<uint64_t>>
+{
+private:
+	set<uint64_t> mTree;
+
+public:
+	void insert(uint64_t key)
+	{
+		mTree.insert(key);
+	}
+
+	bool contains(uint64_t key) const
+	{
+		return mTree.find(key) != mTree.end();
+	}
+
+	void remove(uint64_t key)
+	{
+		mTree.erase(key);
+	}
+
+	uint64_t scan(uint64_t lo, uint64_t len) const
+	{
+		uint64_t sum = 0;
+		for ( auto it = mTree.lower_bound(lo); it != mTree.end() && len > 0; ++it, --len )
+			sum += *it;
+		return sum;
+	}
+};
+
+typedef RBTree<uint64_t, RBTNodePool, false, true> BenchRBTree;		// 与RBTree/main.cpp相同的配置
+
+/*	初始key由Workload.h按keyOrder生成[0, n)内互不相同的数再乘2加1，插入顺序即生成顺序（随机、升序、降序或成簇）；
+ *	查找未命中用对应的偶数，与初始key一一对应又互不相交；mixed中插入的新key取[2n, 4n)内的偶数
+ *	lookup-hit和mixed中的查找按lookupOrder（均匀或Zipf）从初始key里挑选，Zipf时少数热门key占大部分查找；
+ *	mixed按插入顺序删除初始key，命中的查找只从尚未删除的那部分里挑
+ */
+struct BenchKeys
+{
+	static constexpr uint64_t SCAN_LENGTH = 64;
+
+	vector<uint64_t> mInsert;
+	vector<uint64_t> mHit;
+	vector<uint64_t> mMiss;
+	vector<uint64_t> mScan;		// 范围扫描的起点
+	vector<uint64_t> mMixedKeys;
+	vector<uint8_t> mMixedOps;	// 0查找 1插入 2删除
+
+	BenchKeys(uint64_t n, KeyDistribution keyOrder, KeyDistribution lookupOrder, uint64_t seed);
+};
+
+inline BenchKeys::BenchKeys(uint64_t n, KeyDistribution keyOrder, KeyDistribution lookupOrder, uint64_t seed) :
+	mInsert(generateKeys(keyOrder, n, n, seed)), mMiss(n), mMixedKeys(n), mMixedOps(n)
+{
+	for ( uint64_t i = 0; i < n; ++i )
+	{
+		mMiss[i] = mInsert[i]*2;
+		mInsert[i] = mInsert[i]*2 + 1;
+	}
+
+	vector<uint64_t> const hit = generateKeys(lookupOrder, n, n, seed+1);	// 下标
+	mHit.resize(n);
+	for ( uint64_t i = 0; i < n; ++i )
+		mHit[i] = mInsert[hit[i]];
+
+	vector<uint64_t> const scan = generateKeys(KEYS_UNIFORM, n/SCAN_LENGTH > 0 ? n/SCAN_LENGTH : 1, n, seed+2);
+	for ( uint64_t index : scan )
+		mScan.push_back(mInsert[index]);
+
+	WorkloadRandom random(seed+3);
+	vector<uint64_t> const mixedHit = generateKeys(lookupOrder, n, n, seed+4);
+	uint64_t inserted = 0, removed = 0;
+	for ( uint64_t i = 0; i < n; ++i )
+	{
+		switch ( random.below(4) )
+		{
+		case 0:
+			mMixedOps[i] = 0;
+			mMixedKeys[i] = mInsert[removed + mixedHit[i] % (n - removed)];	// 只挑还没被前面的删除操作删掉的初始key，保证命中
+			break;
+		case 1:
+			mMixedOps[i] = 0;
+			mMixedKeys[i] = mMiss[random.below(n)];
+			break;
+		case 2:
+			mMixedOps[i] = 1;
+			mMixedKeys[i] = 2*n + 2*inserted++;
+			break;
+		default:
+			mMixedOps[i] = 2;
+			mMixedKeys[i] = mInsert[removed++];	// 按插入顺序删除，不会重复删除
+			break;
+		}
+	}
+}
+
+template <typename F>
+BenchResult benchTime(uint64_t ops, F&& body)
+{
+	auto begin = chrono::steady_clock::now();
+	uint64_t check = body();
+	auto end = chrono::steady_clock::now();
+
+	return BenchResult{ ops, chrono::duration<double>(end-begin).count(), check, false, 0.0, 0.0, 0.0, 0.0 };
+}
+
+template <typename F>
+BenchResult benchTimeEach(uint64_t ops, LatencyHistogram& latency, F&& body)	// body每次操作自己记录到latency，结束后换算成纳秒
+{
+	latency.clear();
+	BenchResult ret = benchTime(ops, body);
+
+	double const nsPerCycle = 1e9 / cycleFrequency();
+	ret.mLatency = true;
+	ret.mP50Ns = static_cast<double>(latency.percentile(50.0)) * nsPerCycle;
+	ret.mP99Ns = static_cast<double>(latency.percentile(99.0)) * nsPerCycle;
+	ret.mP999Ns = static_cast<double>(latency.percentile(99.9)) * nsPerCycle;
+	ret.mMaxNs = static_cast<double>(latency.getMax()) * nsPerCycle;
+
+	return ret;
+}
+
+template <typename Tree>
+void benchRun(BenchKeys const& keys, BenchResult* results)	// 依次运行全部负载，结果写入results[BENCH_WORKLOADS]
+{
+	BenchTree<Tree> tree;
+	uint64_t const n = keys.mInsert.size();
+	LatencyHistogram latency;
+
+	results[BENCH_INSERT] = benchTimeEach(n, latency, [&]
+	{
+		for ( uint64_t key : keys.mInsert )
+		{
+			uint64_t const begin = cycleStart();
+			tree.insert(key);
+			latency.record(cycleEnd() - begin);
+		}
+		return n;
+	});
+
+	results[BENCH_LOOKUP_HIT] = benchTimeEach(n, latency, [&]
+	{
+		uint64_t hits = 0;
+		for ( uint64_t key : keys.mHit )
+		{
+			uint64_t const begin = cycleStart();
+			hits += tree.contains(key);
+			latency.record(cycleEnd() - begin);
+		}
+		return hits;
+	});
+
+	results[BENCH_LOOKUP_MISS] = benchTimeEach(n, latency, [&]
+	{
+		uint64_t hits = 0;
+		for ( uint64_t key : keys.mMiss )
+		{
+			uint64_t const begin = cycleStart();
+			hits += tree.contains(key);
+			latency.record(cycleEnd() - begin);
+		}
+		return hits;
+	});
+
+	results[BENCH_RANGE] = benchTime(keys.mScan.size(), [&]
+	{
+		uint64_t sum = 0;
+		for ( uint64_t key : keys.mScan )
+			sum += tree.scan(key, BenchKeys::SCAN_LENGTH);
+		return sum;
+	});
+
+	results[BENCH_MIXED] = benchTime(n, [&]
+	{
+		uint64_t hits = 0;
+		for ( uint64_t i = 0; i < n; ++i )
+		{
+			uint64_t key = keys.mMixedKeys[i];
+			if ( keys.mMixedOps[i] == 0 )
+				hits += tree.contains(key);
+			else if ( keys.mMixedOps[i] == 1 )
+				tree.insert(key);
+			else
+				tree.remove(key);
+		}
+		return hits;
+	});
+
+	vector<uint64_t> rest;						// mixed之后还在树中的key：没被删掉的初始key加上新插入的key
+	uint64_t removed = 0;
+	for ( uint64_t i = 0; i < n; ++i )
+		if ( keys.mMixedOps[i] == 1 )
+			rest.push_back(keys.mMixedKeys[i]);
+		else if ( keys.mMixedOps[i] == 2 )
+			++removed;
+	rest.insert(rest.end(), keys.mInsert.begin() + static_cast<ptrdiff_t>(removed), keys.mInsert.end());
+
+	results[BENCH_DELETE] = benchTimeEach(rest.size(), latency, [&]
+	{
+		for ( uint64_t key : rest )
+		{
+			uint64_t const begin = cycleStart();
+			tree.remove(key);
+			latency.record(cycleEnd() - begin);
+		}
+		return static_cast<uint64_t>(rest.size());
+	});
+}
+
+}
+
+#endif // BENCHMARK_H
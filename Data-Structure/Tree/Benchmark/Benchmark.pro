@@ -0,0 +1,13 @@
+TEMPLATE = app
+CONFIG += console c++17 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ../AVLTree ../BPlusTree ../BSTree ../RBTree
+
+SOURCES += \
+    main.cpp
+
+HEADERS += \
+    Benchmark.h \
+    ../RBTree/Workload.h
@@ -0,0 +1,249 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "Benchmark.h"
+
+using namespace std;
+using namespace Viclib;
+
+/*	用法：Benchmark [--min 10] [--max 26] [--step 2] [--trees bs,avl,rb,bplus,set] [--keys permutation] [--lookups uniform] [--seed 1] [--json] [--out 文件]
+ *	--keys是插入顺序（permutation、sequential、reverse、clustered），--lookups是查找的分布（uniform、zipf）；
+ *	BSTree在有序插入时退化成链表，大规模下应当用--trees把它去掉
+ *	每个（树，规模）组合在单独的子进程里运行，峰值常驻内存只属于这一个配置，某个配置内存不足被杀掉也不影响其余配置
+ *	默认输出CSV到标准输出，每行一种负载：tree,size,workload,ops,ns_per_op,ops_per_s,p50_ns,p99_ns,p999_ns,max_ns,base_rss_kb,peak_rss_kb,check
+ *	range和mixed不记录单次延迟，CSV中这四列留空，JSON中为null
+ */
+
+struct BenchTarget
+{
+	char const* mName;
+	void (*mRun)(BenchKeys const&, BenchResult*);
+};
+
+static BenchTarget const TARGETS[] =
+{
+	{ "bs", benchRun<BSTree<uint64_t>> },
+	{ "avl", benchRun<AVLTree<uint64_t>> },
+	{ "rb", benchRun<BenchRBTree> },
+	{ "bplus", benchRun<BPlusTree<uint64_t>> },
+	{ "set", benchRun<set<uint64_t>> },
+};
+
+static uint64_t peakRssKb()
+{
+#ifdef _WIN32
+	return 0;											// 没有getrusage()，内存列输出0
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	return static_cast<uint64_t>(usage.ru_maxrss);		// Linux下单位为KB
+#endif
+}
+
+struct BenchOptions
+{
+	KeyDistribution mKeys;
+	KeyDistribution mLookups;
+	uint64_t mSeed;
+};
+
+static BenchReport runConfig(BenchTarget const& target, uint64_t n, BenchOptions const& options)
+{
+	BenchReport report;
+	memset(&report, 0, sizeof(report));
+
+	BenchKeys keys(n, options.mKeys, options.mLookups, options.mSeed);
+	report.mBaseRssKb = peakRssKb();
+	target.mRun(keys, report.mResults);
+	report.mPeakRssKb = peakRssKb();
+	report.mOk = true;
+
+	return report;
+}
+
+static BenchReport forkConfig(BenchTarget const& target, uint64_t n, BenchOptions const& options)
+{
+#ifdef _WIN32
+	return runConfig(target, n, options);				// 没有fork，只能在本进程里运行，峰值内存会累积
+#else
+	BenchReport report;
+	memset(&report, 0, sizeof(report));
+
+	int fds[2];
+	if ( pipe(fds) != 0 )
+		return report;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if ( pid == 0 )
+	{
+		close(fds[0]);
+		report = runConfig(target, n, options);
+		ssize_t written = write(fds[1], &report, sizeof(report));
+		_exit(written == static_cast<ssize_t>(sizeof(report)) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	if ( pid > 0 )
+	{
+		size_t got = 0;
+		char* buffer = reinterpret_cast<char*>(&report);
+		while ( got < sizeof(report) )
+		{
+			ssize_t ret = read(fds[0], buffer + got, sizeof(report) - got);
+			if ( ret <= 0 )
+				break;
+			got += static_cast<size_t>(ret);
+		}
+		if ( got != sizeof(report) )
+			memset(&report, 0, sizeof(report));			// 子进程异常退出（比如内存不足），本配置记为失败
+
+		int status = 0;
+		waitpid(pid, &status, 0);
+	}
+	close(fds[0]);
+
+	return report;
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t minLayer = 10, maxLayer = 26, step = 2;
+	string trees = "bs,avl,rb,bplus,set";
+	BenchOptions options = { KEYS_PERMUTATION, KEYS_UNIFORM, 1ull };
+	bool json = false;
+	FILE* out = stdout;
+
+	for ( int i = 1; i < argc; ++i )
+	{
+		string arg = argv[i];
+		bool hasValue = i+1 < argc;
+
+		if ( arg == "--min" && hasValue )
+			minLayer = static_cast<uint32_t>(atoi(argv[++i]));
+		else if ( arg == "--max" && hasValue )
+			maxLayer = static_cast<uint32_t>(atoi(argv[++i]));
+		else if ( arg == "--step" && hasValue )
+			step = static_cast<uint32_t>(atoi(argv[++i]));
+		else if ( arg == "--trees" && hasValue )
+			trees = argv[++i];
+		else if ( arg == "--keys" && hasValue )
+		{
+			if ( !parseKeyDistribution(argv[++i], options.mKeys) || options.mKeys == KEYS_UNIFORM || options.mKeys == KEYS_ZIPF )
+			{
+				fprintf(stderr, "插入顺序必须是不重复的分布：permutation、sequential、reverse、clustered\n");
+				return 1;
+			}
+		}
+		else if ( arg == "--lookups" && hasValue )
+		{
+			if ( !parseKeyDistribution(argv[++i], options.mLookups) || (options.mLookups != KEYS_UNIFORM && options.mLookups != KEYS_ZIPF) )
+			{
+				fprintf(stderr, "查找分布必须是uniform或zipf\n");
+				return 1;
+			}
+		}
+		else if ( arg == "--seed" && hasValue )
+			options.mSeed = strtoull(argv[++i], nullptr, 10);
+		else if ( arg == "--json" )
+			json = true;
+		else if ( arg == "--out" && hasValue )
+		{
+			out = fopen(argv[++i], "w");
+			if ( out == nullptr )
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "用法：%s [--min 10] [--max 26] [--step 2] [--trees bs,avl,rb,bplus,set] [--keys permutation] [--lookups uniform] [--seed 1] [--json] [--out 文件]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ( step == 0 || minLayer > maxLayer || maxLayer > 40 )
+	{
+		fprintf(stderr, "规模参数无效\n");
+		return 1;
+	}
+
+	if ( json )
+		fprintf(out, "[\n");
+	else
+		fprintf(out, "tree,size,workload,ops,ns_per_op,ops_per_s,p50_ns,p99_ns,p999_ns,max_ns,base_rss_kb,peak_rss_kb,check\n");
+
+	bool first = true;
+	for ( uint32_t layer = minLayer; layer <= maxLayer; layer += step )
+	{
+		uint64_t const n = 1ull << layer;
+
+		for ( BenchTarget const& target : TARGETS )
+		{
+			if ( ("," + trees + ",").find("," + string(target.mName) + ",") == string::npos )
+				continue;
+
+			fprintf(stderr, "%s 2^%u ...\n", target.mName, layer);
+			BenchReport report = forkConfig(target, n, options);
+			if ( !report.mOk )
+			{
+				fprintf(stderr, "%s 2^%u 失败\n", target.mName, layer);
+				continue;
+			}
+
+			for ( int w = 0; w < BENCH_WORKLOADS; ++w )
+			{
+				BenchResult const& r = report.mResults[w];
+				double nsPerOp = (r.mOps > 0) ? r.mSeconds * 1e9 / static_cast<double>(r.mOps) : 0.0;
+				double opsPerSecond = (r.mSeconds > 0.0) ? static_cast<double>(r.mOps) / r.mSeconds : 0.0;
+				char latency[160];
+
+				if ( json )
+				{
+					if ( r.mLatency )
+						snprintf(latency, sizeof(latency), "\"p50_ns\": %.1f, \"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f",
+								 r.mP50Ns, r.mP99Ns, r.mP999Ns, r.mMaxNs);
+					else
+						snprintf(latency, sizeof(latency), "\"p50_ns\": null, \"p99_ns\": null, \"p999_ns\": null, \"max_ns\": null");
+
+					fprintf(out, "%s  {\"tree\": \"%s\", \"size\": %llu, \"workload\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.3f, \"ops_per_s\": %.1f, %s, "
+								 "\"base_rss_kb\": %llu, \"peak_rss_kb\": %llu, \"check\": %llu}",
+							first ? "" : ",\n", target.mName, static_cast<unsigned long long>(n), BENCH_WORKLOAD_NAMES[w],
+							static_cast<unsigned long long>(r.mOps), nsPerOp, opsPerSecond, latency,
+							static_cast<unsigned long long>(report.mBaseRssKb), static_cast<unsigned long long>(report.mPeakRssKb),
+							static_cast<unsigned long long>(r.mCheck));
+				}
+				else
+				{
+					if ( r.mLatency )
+						snprintf(latency, sizeof(latency), "%.1f,%.1f,%.1f,%.1f", r.mP50Ns, r.mP99Ns, r.mP999Ns, r.mMaxNs);
+					else
+						snprintf(latency, sizeof(latency), ",,,");
+
+					fprintf(out, "%s,%llu,%s,%llu,%.3f,%.1f,%s,%llu,%llu,%llu\n",
+							target.mName, static_cast<unsigned long long>(n), BENCH_WORKLOAD_NAMES[w],
+							static_cast<unsigned long long>(r.mOps), nsPerOp, opsPerSecond, latency,
+							static_cast<unsigned long long>(report.mBaseRssKb), static_cast<unsigned long long>(report.mPeakRssKb),
+							static_cast<unsigned long long>(r.mCheck));
+				}
+				first = false;
+			}
+			fflush(out);
+		}
+	}
+
+	if ( json )
+		fprintf(out, "\n]\n");
+	if ( out != stdout )
+		fclose(out);
+
+	return 0;
+}
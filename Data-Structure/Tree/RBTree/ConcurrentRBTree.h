@@ -0,0 +1,216 @@
+#ifndef CONCURRENTRBTREE_H
+#define CONCURRENTRBTREE_H
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include "RBTree.h"
+
+using namespace std;
+
+namespace Viclib
+{
+
+/*	读多写少的并发红黑树
+ *	写者用互斥锁串行执行insert/remove（含修正），并在修改前后各把版本号加一，修改期间版本号为奇数（seqlock）
+ *	读者不加锁：记下偶数版本号后直接遍历，遍历结束再比较版本号，没有变化说明期间没有写者，结果有效，否则重试
+ *	读者可能读到正在修改的结点，所以：
+ *	  1. 结点来自RBTNodePool，删除的结点只进空闲链表，内存在destroy()之前不会归还，读者访问的始终是结点内存；
+ *	     空闲链表指针只覆盖结点开头的父指针字段，mLeft/mRight仍指向池内结点或nullptr
+ *	  2. 修改中途可能出现环，遍历步数超过红黑树最大高度就放弃本次读取并重试
+ *	  3. key必须可以按位复制，读到的key只在版本号校验通过后才使用
+ *	destroy()和buildFromSorted()会归还内存，调用时不能有并发的读者
+ */
+template <typename T>
+class ConcurrentRBTree
+{
+private:
+	typedef RBTree<T, RBTNodePool, false, true> Tree;
+	typedef typename Tree::Node Node;
+
+	static constexpr uint32_t MAX_STEPS = 2*64+2;	// 红黑树高度不超过2*log2(n+1)
+
+	Tree mTree;
+	mutex mWriteLock;
+	atomic<uint64_t> mVersion;		// 奇数表示有写者正在修改
+	atomic<uint64_t> mCount;		// 供读者无锁读取的结点数
+	mutable atomic<uint64_t> mRetries;	// 读者因版本号变化而重试的次数
+
+	template <typename P>
+	static P load(P const& field);	// 每个指针和key只读一次，防止编译器重复读取得到前后不一致的值
+
+	bool tryContains(const T& key, bool& found) const;
+	void beginWrite();
+	void endWrite();
+
+public:
+	ConcurrentRBTree();
+	ConcurrentRBTree(const ConcurrentRBTree&) = delete;
+	ConcurrentRBTree& operator = (const ConcurrentRBTree&) = delete;
+
+	bool contains(const T& key) const;			// 无锁读
+	bool insert(const T& key);					// key已存在返回false
+	bool remove(const T& key);
+
+	template <typename Iterator>
+	void buildFromSorted(Iterator first, Iterator last);
+
+	void destroy();
+	uint64_t getCount() const;
+	uint64_t getRetries() const;
+};
+
+template <typename T>
+ConcurrentRBTree<T>::ConcurrentRBTree() : mVersion(0ull), mCount(0ull), mRetries(0ull)
+{
+	static_assert(is_trivially_copyable<T>::value, "optimistic readers copy keys that may be concurrently overwritten");
+}
+
+template <typename T>
+template <typename P>
+P ConcurrentRBTree<T>::load(P const& field)
+{
+	if constexpr ( is_scalar<P>::value )
+		return *static_cast<P const volatile*>(&field);
+	else								// 结构体没有volatile拷贝构造，逐字节经volatile读出后再拼成副本
+	{
+		unsigned char bytes[sizeof(P)];
+		unsigned char const volatile* src = reinterpret_cast<unsigned char const volatile*>(&field);
+		for ( size_t i = 0; i < sizeof(P); ++i )
+			bytes[i] = src[i];
+
+		P ret;
+		memcpy(&ret, bytes, sizeof(P));
+		return ret;
+	}
+}
+
+template <typename T>
+bool ConcurrentRBTree<T>::tryContains(const T& key, bool& found) const
+{
+	uint64_t version = mVersion.load(memory_order_acquire);
+	if ( version & 1ull )					// 写者正在修改
+		return false;
+
+	Node const* tree = load(mTree.mRoot);
+	uint32_t steps = 0;
+	found = false;
+
+	while ( tree != nullptr )
+	{
+		if ( ++steps > MAX_STEPS )			// 读到了修改中途的环
+			return false;
+
+		T tmp = load(tree->mKey);			// 写者可能正在改这个key，和指针一样只读一次
+		if ( key == tmp )
+		{
+			found = true;
+			break;
+		}
+
+		Node* const* child = (key < tmp) ? &tree->mLeft : &tree->mRight;	// 先选地址再读，可以编译成条件传送而不是分支
+		tree = load(*child);
+	}
+
+	atomic_thread_fence(memory_order_acquire);	// 上面的读取不能推迟到版本号检查之后
+
+	return mVersion.load(memory_order_relaxed) == version;
+}
+
+template <typename T>
+bool ConcurrentRBTree<T>::contains(const T& key) const
+{
+	bool found;
+
+	while ( !tryContains(key, found) )
+	{
+		mRetries.fetch_add(1ull, memory_order_relaxed);
+		this_thread::yield();
+	}
+
+	return found;
+}
+
+template <typename T>
+void ConcurrentRBTree<T>::beginWrite()		// 调用前必须持有mWriteLock
+{
+	mVersion.store(mVersion.load(memory_order_relaxed)+1ull, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);	// 版本号先变成奇数，再修改结点
+}
+
+template <typename T>
+void ConcurrentRBTree<T>::endWrite()
+{
+	mVersion.store(mVersion.load(memory_order_relaxed)+1ull, memory_order_release);
+	mCount.store(mTree.getCount(), memory_order_relaxed);
+}
+
+template <typename T>
+bool ConcurrentRBTree<T>::insert(const T& key)
+{
+	lock_guard<mutex> lock(mWriteLock);
+
+	if ( mTree.iterativeSearch(key) != nullptr )	// 只读查找不影响读者，不必改版本号
+		return false;
+
+	beginWrite();
+	mTree.insert(key);
+	endWrite();
+
+	return true;
+}
+
+template <typename T>
+bool ConcurrentRBTree<T>::remove(const T& key)
+{
+	lock_guard<mutex> lock(mWriteLock);
+
+	if ( mTree.iterativeSearch(key) == nullptr )
+		return false;
+
+	beginWrite();
+	mTree.remove(key);
+	endWrite();
+
+	return true;
+}
+
+template <typename T>
+template <typename Iterator>
+void ConcurrentRBTree<T>::buildFromSorted(Iterator first, Iterator last)
+{
+	lock_guard<mutex> lock(mWriteLock);
+
+	beginWrite();
+	mTree.buildFromSorted(first, last);
+	endWrite();
+}
+
+template <typename T>
+void ConcurrentRBTree<T>::destroy()
+{
+	lock_guard<mutex> lock(mWriteLock);
+
+	beginWrite();
+	mTree.destroy();
+	endWrite();
+}
+
+template <typename T>
+uint64_t ConcurrentRBTree<T>::getCount() const
+{
+	return mCount.load(memory_order_relaxed);
+}
+
+template <typename T>
+uint64_t ConcurrentRBTree<T>::getRetries() const
+{
+	return mRetries.load(memory_order_relaxed);
+}
+
+}
+
+#endif // CONCURRENTRBTREE_H
@@ -0,0 +1,18 @@
+TEMPLATE = app
+CONFIG += console c++17 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# DEFINES += TIMES_PERF=0	# 关掉Times.h中的硬件计数器（perf_event_open）
+
+SOURCES += \
+    mainConcurrent.cpp
+
+HEADERS += \
+    ConcurrentRBTree.h \
+    RBTree.h \
+    Times.h \
+    TreeIO.h \
+    TreeMetrics.h \
+    TreeStats.h \
+    Workload.h
@@ -0,0 +1,217 @@
+#ifndef EYTZINGERINDEX_H
+#define EYTZINGERINDEX_H
+
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Viclib
+{
+
+/*	只读查找索引：把一棵树的key按中序冻结到连续数组里，数组按Eytzinger（广度优先）顺序排列，下标从1开始，k的孩子是2k和2k+1
+ *	查找时只有数组下标运算没有指针，每次比较只决定下一个下标，可以写成无分支的循环；
+ *	数组按缓存行对齐，一个缓存行放B个key时，k往下log2(B)层的后代k*B...k*B+B-1正好在同一行，循环里提前预取，访存延迟和比较重叠
+ *	冻结后与原树无关，树再修改需要重新freeze()
+ */
+template <typename T>
+class EytzingerIndex
+{
+public:
+	EytzingerIndex();
+	template <typename Tree>
+	explicit EytzingerIndex(const Tree& tree);
+	EytzingerIndex(const EytzingerIndex&) = delete;
+	EytzingerIndex& operator = (const EytzingerIndex&) = delete;
+	EytzingerIndex(EytzingerIndex&&) = default;
+	EytzingerIndex& operator = (EytzingerIndex&&) = default;
+
+	template <typename Tree>
+	void freeze(const Tree& tree);				// 需要tree.getCount()和tree.forEachInOrder()，RBTree、AVLTree、BSTree都可以
+	template <typename Iterator>
+	void build(Iterator first, Iterator last);	// 用升序序列构建
+
+	bool contains(const T& key) const;
+	T const* lower_bound(const T& key) const;	// 第一个不小于key的key，没有则返回nullptr
+	uint64_t rank(const T& key) const;			// 小于key的key的个数
+
+	uint64_t getCount() const;
+
+private:
+	struct alignas(64) CacheLine
+	{
+		char mBytes[64];
+	};
+
+	static constexpr uint64_t BLOCK = (sizeof(T) <= 64) ? 64/sizeof(T) : 1;	// 一个缓存行放的key数
+
+	std::vector<CacheLine> mStorage;
+	T* mKeys;									// 指向mStorage，mKeys[0]不用
+	std::vector<uint64_t> mRanks;				// 每个下标对应的中序序号，只有rank()用，不占查找路径上的缓存
+	uint64_t mCount;
+
+	uint64_t lowerBoundSlot(const T& key) const;	// 返回下标，0表示所有key都小于key
+	void reset(uint64_t count);
+	uint64_t first() const;						// 中序第一个下标（最左）
+	uint64_t next(uint64_t k) const;			// 中序下一个下标
+
+	template <typename Source>
+	void fill(Source&& source);
+};
+
+template <typename T>
+EytzingerIndex<T>::EytzingerIndex() : mKeys(nullptr), mCount(0ull)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "keys are stored in raw cache-line storage");
+}
+
+template <typename T>
+template <typename Tree>
+EytzingerIndex<T>::EytzingerIndex(const Tree& tree) : EytzingerIndex()
+{
+	freeze(tree);
+}
+
+template <typename T>
+void EytzingerIndex<T>::reset(uint64_t count)
+{
+	mCount = count;
+	mStorage.assign((count+1)*sizeof(T)/sizeof(CacheLine) + 1, CacheLine());
+	mKeys = reinterpret_cast<T*>(mStorage.data());
+	mRanks.assign(count+1, 0ull);
+}
+
+template <typename T>
+uint64_t EytzingerIndex<T>::first() const
+{
+	uint64_t k = 1;
+
+	while ( 2*k <= mCount )
+		k *= 2;
+
+	return k;
+}
+
+template <typename T>
+uint64_t EytzingerIndex<T>::next(uint64_t k) const
+{
+	if ( 2*k+1 <= mCount )						// 有右子树：右孩子的最左后代
+	{
+		k = 2*k+1;
+		while ( 2*k <= mCount )
+			k *= 2;
+	}
+	else										// 否则沿右孩子一路向上，再上一层
+	{
+		while ( k & 1ull )
+			k >>= 1;
+		k >>= 1;
+	}
+
+	return k;
+}
+
+template <typename T>
+template <typename Source>
+void EytzingerIndex<T>::fill(Source&& source)	// 按中序下标顺序依次写入升序的key，不需要中间数组
+{
+	uint64_t k = (mCount > 0) ? first() : 0;
+	uint64_t r = 0;
+
+	source([&](const T& key)
+	{
+		new (&mKeys[k]) T(key);
+		mRanks[k] = r++;
+		k = next(k);
+	});
+}
+
+template <typename T>
+template <typename Tree>
+void EytzingerIndex<T>::freeze(const Tree& tree)
+{
+	reset(tree.getCount());
+	fill([&tree](auto&& visitor) { tree.forEachInOrder(visitor); });
+}
+
+template <typename T>
+template <typename Iterator>
+void EytzingerIndex<T>::build(Iterator first, Iterator last)
+{
+	uint64_t count = 0;
+	for ( Iterator it = first; it != last; ++it )
+		++count;
+
+	reset(count);
+	fill([first, last](auto&& visitor)
+	{
+		for ( Iterator it = first; it != last; ++it )
+			visitor(*it);
+	});
+}
+
+/*	从根往下走，比key小就往右（2k+1），否则往左（2k），走出数组后下标的二进制末尾是若干个1（最后几步向右）再加一个0（最后一次向左），
+ *	去掉这些位就回到最后一次向左的结点，即第一个不小于key的结点；一直向右时结果为0
+ */
+template <typename T>
+uint64_t EytzingerIndex<T>::lowerBoundSlot(const T& key) const
+{
+	uint64_t k = 1;
+
+	while ( k <= mCount )
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_prefetch(reinterpret_cast<char const*>(mKeys + k*BLOCK), _MM_HINT_T0);
+#elif defined(_MSC_VER)
+		__prefetch(mKeys + k*BLOCK);
+#else
+		__builtin_prefetch(mKeys + k*BLOCK);	// 几层以后要访问的后代，越界的预取不会出错
+#endif
+		k = 2*k + (mKeys[k] < key);
+	}
+
+#if defined(_MSC_VER)
+	unsigned long low;
+	_BitScanForward64(&low, ~k);				// ~k不为0：k不会增长到全1
+	return k >> (low + 1);
+#else
+	return k >> __builtin_ffsll(static_cast<long long>(~k));
+#endif
+}
+
+template <typename T>
+bool EytzingerIndex<T>::contains(const T& key) const
+{
+	uint64_t k = lowerBoundSlot(key);
+
+	return k != 0 && !(key < mKeys[k]);
+}
+
+template <typename T>
+T const* EytzingerIndex<T>::lower_bound(const T& key) const
+{
+	uint64_t k = lowerBoundSlot(key);
+
+	return (k != 0) ? &mKeys[k] : nullptr;
+}
+
+template <typename T>
+uint64_t EytzingerIndex<T>::rank(const T& key) const
+{
+	uint64_t k = lowerBoundSlot(key);
+
+	return (k != 0) ? mRanks[k] : mCount;
+}
+
+template <typename T>
+uint64_t EytzingerIndex<T>::getCount() const
+{
+	return mCount;
+}
+
+}
+
+#endif // EYTZINGERINDEX_H
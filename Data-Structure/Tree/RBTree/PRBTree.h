@@ -0,0 +1,637 @@
+#ifndef PRBTREE_H
+#define PRBTREE_H
+
+#include <iostream>
+#include <atomic>
+#include <vector>
+
+#include "RBTree.h"
+
+using namespace std;
+
+namespace Viclib
+{
+
+/*	持久化（写时复制）红黑树
+ *	结点带引用计数，没有父指针；多个版本（快照）共享未修改的子树
+ *	snapshot()只增加根结点的引用计数，O(1)；插入删除时，沿查找路径向下把被共享的结点复制一份（引用计数为1的结点属于本版本独有，直接原地修改），
+ *	修正阶段需要改动的叔伯、兄弟结点同样先复制，所以每次修改只复制O(log(n))个结点
+ *	各版本可以交给不同线程读取；同一个版本不能同时读写
+ */
+template <typename T>
+class PRBTNode
+{
+public:
+	atomic<uint32_t> mRefs;		// 指向该结点的指针数（父结点或版本的根）
+	RBTColor mColor;
+	T mKey;
+	PRBTNode<T>* mLeft;
+	PRBTNode<T>* mRight;
+
+	PRBTNode(RBTColor color, const T& key, PRBTNode<T>* left, PRBTNode<T>* right) :
+		mRefs(1), mColor(color), mKey(key), mLeft(left), mRight(right) {}
+};
+
+template <typename T>
+class PRBTree
+{
+private:
+	PRBTNode<T>* mRoot;
+	uint64_t mCount;
+
+	static constexpr size_t MAX_PATH = 128;	// 红黑树高度不超过2*log2(n+1)
+
+	static void retain(PRBTNode<T>* node);
+	static void release(PRBTNode<T>* node);
+	static PRBTNode<T>* mutate(PRBTNode<T>* &slot);	// 写时复制
+
+	static void lRotate(PRBTNode<T>* &slot);
+	static void rRotate(PRBTNode<T>* &slot);
+
+	static bool isRed(PRBTNode<T> const* node);
+
+	template <typename F>
+	static bool visit(F& visitor, const T& key);	// visitor可以返回void或bool
+
+	int32_t validate(PRBTNode<T> const* tree, T const* &last, uint64_t& count, char const** reason) const;	// 返回子树黑高，失败返回-1
+
+	void inOrder(PRBTNode<T> const* tree) const;
+	uint16_t height(PRBTNode<T> const* tree) const;
+	uint64_t sharedCount(PRBTNode<T> const* tree) const;
+
+public:
+	PRBTree();
+	PRBTree(const PRBTree<T>& other);				// 与other共享所有结点，O(1)
+	PRBTree(PRBTree<T>&& other);
+	PRBTree<T>& operator = (const PRBTree<T>& other);
+	PRBTree<T>& operator = (PRBTree<T>&& other);
+	~PRBTree();
+
+	PRBTree<T> snapshot() const;
+
+	T const* search(const T& key) const;
+	T const* minimum() const;
+	T const* maximum() const;
+
+	bool insert(const T& key);						// key已存在返回false
+	bool remove(const T& key);
+
+	void inOrder() const;
+	template <typename F>
+	bool forEachInOrder(F&& visitor) const;		// 非递归中序遍历，visitor(key)返回false时提前结束
+
+	bool validate(char const** reason = nullptr) const;	// 校验红黑树性质、key顺序、结点数和引用计数，O(n)
+
+	void destroy();
+	uint64_t getCount() const;
+	uint16_t getHeight() const;
+	uint64_t getSharedCount() const;				// 引用计数大于1（还被其它版本引用）的可达结点数，O(n)；其它版本全部释放后应为0
+	bool rootIsNullptr() const;
+};
+
+template <typename T>
+PRBTree<T>::PRBTree() : mRoot(nullptr), mCount(0ull)
+{
+}
+
+template <typename T>
+PRBTree<T>::PRBTree(const PRBTree<T>& other) : mRoot(other.mRoot), mCount(other.mCount)
+{
+	retain(mRoot);
+}
+
+template <typename T>
+PRBTree<T>::PRBTree(PRBTree<T>&& other) : mRoot(other.mRoot), mCount(other.mCount)
+{
+	other.mRoot = nullptr;
+	other.mCount = 0ull;
+}
+
+template <typename T>
+PRBTree<T>& PRBTree<T>::operator = (const PRBTree<T>& other)
+{
+	retain(other.mRoot);		// 先增加再释放，自赋值也安全
+	release(mRoot);
+	mRoot = other.mRoot;
+	mCount = other.mCount;
+
+	return *this;
+}
+
+template <typename T>
+PRBTree<T>& PRBTree<T>::operator = (PRBTree<T>&& other)
+{
+	if ( this != &other )
+	{
+		release(mRoot);
+		mRoot = other.mRoot;
+		mCount = other.mCount;
+		other.mRoot = nullptr;
+		other.mCount = 0ull;
+	}
+
+	return *this;
+}
+
+template <typename T>
+PRBTree<T>::~PRBTree()
+{
+	destroy();
+}
+
+template <typename T>
+void PRBTree<T>::retain(PRBTNode<T>* node)
+{
+	if ( node != nullptr )
+		node->mRefs.fetch_add(1, memory_order_relaxed);
+}
+
+template <typename T>
+void PRBTree<T>::release(PRBTNode<T>* node)		// 引用归零时删除结点，并释放它对子结点的引用
+{
+	if ( node != nullptr && node->mRefs.fetch_sub(1, memory_order_acq_rel) == 1 )
+	{
+		release(node->mLeft);
+		release(node->mRight);
+		delete node;
+	}
+}
+
+template <typename T>
+PRBTNode<T>* PRBTree<T>::mutate(PRBTNode<T>* &slot)	// slot所在的结点必须已经是本版本独有的
+{
+	PRBTNode<T>* node = slot;
+	if ( node->mRefs.load(memory_order_acquire) == 1 )	// 只有本版本引用，原地修改
+		return node;
+
+	PRBTNode<T>* copy = new PRBTNode<T>(node->mColor, node->mKey, node->mLeft, node->mRight);
+	retain(copy->mLeft);
+	retain(copy->mRight);
+	release(node);						// 还有其它版本引用，不会被删除
+	slot = copy;
+
+	return copy;
+}
+
+/*	旋转只移动指针，每个结点在本版本中仍然只有一个父指针，引用计数不变
+ *	slot指向的结点和它被提升的孩子都必须是本版本独有的
+ */
+template <typename T>
+void PRBTree<T>::lRotate(PRBTNode<T>* &slot)
+{
+	PRBTNode<T>* node = slot;
+	PRBTNode<T>* r = node->mRight;
+
+	node->mRight = r->mLeft;
+	r->mLeft = node;
+	slot = r;
+}
+
+template <typename T>
+void PRBTree<T>::rRotate(PRBTNode<T>* &slot)
+{
+	PRBTNode<T>* node = slot;
+	PRBTNode<T>* l = node->mLeft;
+
+	node->mLeft = l->mRight;
+	l->mRight = node;
+	slot = l;
+}
+
+template <typename T>
+bool PRBTree<T>::isRed(PRBTNode<T> const* node)
+{
+	return node!=nullptr && node->mColor==RED;
+}
+
+template <typename T>
+PRBTree<T> PRBTree<T>::snapshot() const
+{
+	return PRBTree<T>(*this);
+}
+
+template <typename T>
+T const* PRBTree<T>::search(const T& key) const
+{
+	PRBTNode<T> const* tree = mRoot;
+
+	while ( tree!=nullptr && key!=tree->mKey )
+	{
+		if ( key < tree->mKey )
+			tree = tree->mLeft;
+		else
+			tree = tree->mRight;
+	}
+
+	return (tree != nullptr) ? &tree->mKey : nullptr;
+}
+
+template <typename T>
+T const* PRBTree<T>::minimum() const
+{
+	PRBTNode<T> const* tree = mRoot;
+	if ( tree == nullptr )
+		return nullptr;
+
+	while ( tree->mLeft != nullptr )
+		tree = tree->mLeft;
+
+	return &tree->mKey;
+}
+
+template <typename T>
+T const* PRBTree<T>::maximum() const
+{
+	PRBTNode<T> const* tree = mRoot;
+	if ( tree == nullptr )
+		return nullptr;
+
+	while ( tree->mRight != nullptr )
+		tree = tree->mRight;
+
+	return &tree->mKey;
+}
+
+/*	path[i]是路径上第i个结点所在的指针（父结点的mLeft/mRight或mRoot），没有父指针，靠它向上回溯
+ *	修正过程与RBTree::insertFixUp()相同，只是在改动叔伯结点前先复制
+ */
+template <typename T>
+bool PRBTree<T>::insert(const T& key)
+{
+	if ( search(key) != nullptr )		// 先只读查找，避免为重复值白白复制路径
+		return false;
+
+	PRBTNode<T>** path[MAX_PATH+1];
+	size_t depth = 0;
+	PRBTNode<T>** slot = &mRoot;
+
+	while ( *slot != nullptr )			// 向下查找插入点，路径上的结点全部变为本版本独有
+	{
+		PRBTNode<T>* node = mutate(*slot);
+		path[depth++] = slot;
+		slot = (key < node->mKey) ? &node->mLeft : &node->mRight;
+	}
+
+	*slot = new PRBTNode<T>(RED, key, nullptr, nullptr);
+	path[depth] = slot;
+	++mCount;
+
+	size_t i = depth;					// 当前结点在path中的位置
+	while ( i>=1 && isRed(*path[i-1]) )	// 父亲是红色，所以父亲不是根，一定有爷爷
+	{
+		PRBTNode<T>* node = *path[i];
+		PRBTNode<T>* parent = *path[i-1];
+		PRBTNode<T>* gparent = *path[i-2];
+
+		if ( parent == gparent->mLeft )
+		{
+			if ( isRed(gparent->mRight) )	// 叔叔是红色：父亲叔叔变黑，爷爷变红，继续向上
+			{
+				mutate(gparent->mRight)->mColor = BLACK;
+				parent->mColor = BLACK;
+				gparent->mColor = RED;
+				i -= 2;
+				continue;
+			}
+
+			if ( node == parent->mRight )	// 自己是右孩子，先旋转成左左
+				lRotate(*path[i-1]);
+
+			(*path[i-1])->mColor = BLACK;
+			gparent->mColor = RED;
+			rRotate(*path[i-2]);
+		}
+		else
+		{
+			if ( isRed(gparent->mLeft) )
+			{
+				mutate(gparent->mLeft)->mColor = BLACK;
+				parent->mColor = BLACK;
+				gparent->mColor = RED;
+				i -= 2;
+				continue;
+			}
+
+			if ( node == parent->mLeft )
+				rRotate(*path[i-1]);
+
+			(*path[i-1])->mColor = BLACK;
+			gparent->mColor = RED;
+			lRotate(*path[i-2]);
+		}
+		break;
+	}
+
+	mRoot->mColor = BLACK;				// 根结点在路径上，已经是本版本独有
+
+	return true;
+}
+
+/*	与RBTree::remove()/removeFixUp()相同的情形划分；有两个孩子时把后继的key复制过来，改为删除后继
+ *	path只保存x（替换被删结点的孩子）以上的祖先，x所在的指针单独保存在xslot
+ */
+template <typename T>
+bool PRBTree<T>::remove(const T& key)
+{
+	if ( search(key) == nullptr )
+		return false;
+
+	PRBTNode<T>** path[MAX_PATH+2];
+	size_t depth = 0;
+	PRBTNode<T>** slot = &mRoot;
+	PRBTNode<T>* node;
+
+	while ( (node = mutate(*slot))->mKey != key )	// 查找被删结点
+	{
+		path[depth++] = slot;
+		slot = (key < node->mKey) ? &node->mLeft : &node->mRight;
+	}
+
+	if ( node->mLeft!=nullptr && node->mRight!=nullptr )	// 有两个孩子，用右子树最小者的key替换，改为删除它
+	{
+		PRBTNode<T>* del = node;
+		path[depth++] = slot;
+		slot = &del->mRight;
+		while ( (node = mutate(*slot))->mLeft != nullptr )
+		{
+			path[depth++] = slot;
+			slot = &node->mLeft;
+		}
+		del->mKey = node->mKey;
+	}
+
+	PRBTNode<T>* x = (node->mLeft != nullptr) ? node->mLeft : node->mRight;	// 被删结点至多一个孩子
+	RBTColor color = node->mColor;
+	PRBTNode<T>** xslot = slot;
+
+	*xslot = x;							// 孩子直接接到被删结点的位置，引用从被删结点转给父结点
+	node->mLeft = node->mRight = nullptr;
+	release(node);
+	--mCount;
+
+	if ( color == BLACK )
+	{
+		while ( xslot!=&mRoot && !isRed(*xslot) )
+		{
+			PRBTNode<T>** pslot = path[depth-1];
+			PRBTNode<T>* parent = *pslot;
+			PRBTNode<T>* other;
+
+			if ( xslot == &parent->mLeft )
+			{
+				other = mutate(parent->mRight);
+				if ( other->mColor == RED )			// 兄弟是红色，旋转后兄弟的黑色孩子成为新兄弟
+				{
+					other->mColor = BLACK;
+					parent->mColor = RED;
+					lRotate(*pslot);
+					pslot = &other->mLeft;			// parent下降一层，成为原兄弟的左孩子
+					path[depth++] = pslot;
+					other = mutate(parent->mRight);
+				}
+
+				if ( !isRed(other->mLeft) && !isRed(other->mRight) )
+				{
+					other->mColor = RED;
+					xslot = path[--depth];			// 黑色缺失转移到父亲
+				}
+				else
+				{
+					if ( !isRed(other->mRight) )
+					{
+						mutate(other->mLeft)->mColor = BLACK;
+						other->mColor = RED;
+						rRotate(parent->mRight);
+						other = parent->mRight;
+					}
+
+					other->mColor = parent->mColor;
+					parent->mColor = BLACK;
+					mutate(other->mRight)->mColor = BLACK;
+					lRotate(*pslot);
+					xslot = &mRoot;
+					break;
+				}
+			}
+			else
+			{
+				other = mutate(parent->mLeft);
+				if ( other->mColor == RED )
+				{
+					other->mColor = BLACK;
+					parent->mColor = RED;
+					rRotate(*pslot);
+					pslot = &other->mRight;
+					path[depth++] = pslot;
+					other = mutate(parent->mLeft);
+				}
+
+				if ( !isRed(other->mLeft) && !isRed(other->mRight) )
+				{
+					other->mColor = RED;
+					xslot = path[--depth];
+				}
+				else
+				{
+					if ( !isRed(other->mLeft) )
+					{
+						mutate(other->mRight)->mColor = BLACK;
+						other->mColor = RED;
+						lRotate(parent->mLeft);
+						other = parent->mLeft;
+					}
+
+					other->mColor = parent->mColor;
+					parent->mColor = BLACK;
+					mutate(other->mLeft)->mColor = BLACK;
+					rRotate(*pslot);
+					xslot = &mRoot;
+					break;
+				}
+			}
+		}
+
+		if ( isRed(*xslot) )				// x是红色（或变成了根），染黑补上缺失的黑色
+			mutate(*xslot)->mColor = BLACK;
+	}
+
+	return true;
+}
+
+template <typename T>
+template <typename F>
+bool PRBTree<T>::visit(F& visitor, const T& key)
+{
+	if constexpr ( is_void<decltype(visitor(key))>::value )
+	{
+		visitor(key);
+		return true;
+	}
+	else
+		return static_cast<bool>(visitor(key));
+}
+
+template <typename T>
+template <typename F>
+bool PRBTree<T>::forEachInOrder(F&& visitor) const	// 没有父指针，用显式栈
+{
+	PRBTNode<T> const* stack[MAX_PATH];
+	size_t depth = 0;
+	PRBTNode<T> const* node = mRoot;
+
+	while ( node != nullptr || depth > 0 )
+	{
+		for ( ; node != nullptr; node = node->mLeft )
+			stack[depth++] = node;
+
+		node = stack[--depth];
+		if ( !visit(visitor, node->mKey) )
+			return false;
+		node = node->mRight;
+	}
+
+	return true;
+}
+
+/*	引用计数至少为1（有父结点或版本根指向它），红结点没有红孩子，左右黑高相等，中序严格递增
+ *	子树可能被其它版本共享，这里只检查本版本能看到的部分
+ */
+template <typename T>
+int32_t PRBTree<T>::validate(PRBTNode<T> const* tree, T const* &last, uint64_t& count, char const** reason) const
+{
+	if ( tree == nullptr )
+		return 0;
+
+	if ( tree->mRefs.load(memory_order_acquire) == 0 )
+	{
+		*reason = "可达结点的引用计数为0";
+		return -1;
+	}
+	if ( isRed(tree) && (isRed(tree->mLeft) || isRed(tree->mRight)) )
+	{
+		*reason = "红色结点有红色孩子";
+		return -1;
+	}
+
+	int32_t l = validate(tree->mLeft, last, count, reason);
+	if ( l < 0 )
+		return -1;
+	if ( last != nullptr && !(*last < tree->mKey) )
+	{
+		*reason = "中序遍历的key没有按升序排列";
+		return -1;
+	}
+	last = &tree->mKey;
+	++count;
+	int32_t r = validate(tree->mRight, last, count, reason);
+	if ( r < 0 )
+		return -1;
+	if ( l != r )
+	{
+		*reason = "左右子树黑高不等";
+		return -1;
+	}
+
+	return l + (isRed(tree) ? 0 : 1);
+}
+
+template <typename T>
+bool PRBTree<T>::validate(char const** reason) const
+{
+	char const* dummy = nullptr;
+	if ( reason == nullptr )
+		reason = &dummy;
+
+	if ( isRed(mRoot) )
+	{
+		*reason = "根结点是红色";
+		return false;
+	}
+
+	T const* last = nullptr;
+	uint64_t count = 0;
+	if ( validate(mRoot, last, count, reason) < 0 )
+		return false;
+	if ( count != mCount )
+	{
+		*reason = "结点数与mCount不符";
+		return false;
+	}
+
+	return true;
+}
+
+template <typename T>
+void PRBTree<T>::inOrder(PRBTNode<T> const* tree) const
+{
+	if ( tree != nullptr )
+	{
+		inOrder(tree->mLeft);
+		cout << tree->mKey << " " << flush;
+		inOrder(tree->mRight);
+	}
+}
+
+template <typename T>
+void PRBTree<T>::inOrder() const
+{
+	inOrder(mRoot);
+	cout << endl;
+}
+
+template <typename T>
+uint16_t PRBTree<T>::height(PRBTNode<T> const* tree) const
+{
+	if ( tree == nullptr )
+		return 0;
+
+	uint16_t l = height(tree->mLeft);
+	uint16_t r = height(tree->mRight);
+
+	return ((l > r) ? l : r) + 1;
+}
+
+template <typename T>
+uint16_t PRBTree<T>::getHeight() const
+{
+	return height(mRoot);
+}
+
+template <typename T>
+uint64_t PRBTree<T>::sharedCount(PRBTNode<T> const* tree) const
+{
+	if ( tree == nullptr )
+		return 0;
+
+	return (tree->mRefs.load(memory_order_acquire) > 1 ? 1 : 0) + sharedCount(tree->mLeft) + sharedCount(tree->mRight);
+}
+
+template <typename T>
+uint64_t PRBTree<T>::getSharedCount() const
+{
+	return sharedCount(mRoot);
+}
+
+template <typename T>
+void PRBTree<T>::destroy()			// 只释放本版本的引用，其它快照不受影响
+{
+	release(mRoot);
+	mRoot = nullptr;
+	mCount = 0ull;
+}
+
+template <typename T>
+uint64_t PRBTree<T>::getCount() const
+{
+	return mCount;
+}
+
+template <typename T>
+bool PRBTree<T>::rootIsNullptr() const
+{
+	return mRoot == nullptr;
+}
+
+}
+
+#endif // PRBTREE_H
@@ -2,67 +2,547 @@
 #define RBTREE_H
 
 #include <iostream>
+#include <cstdlib>
 #include <iomanip>
 #include <queue>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <memory>
+#include <future>
+#include <thread>
+
+#include "TreeIO.h"
+#include "TreeMetrics.h"
+#include "TreeStats.h"
 
 using namespace std;
 
+#ifndef RBTREE_VALIDATE_INTERVAL
+#define RBTREE_VALIDATE_INTERVAL 0		// 大于0时每修改这么多次就用validate()校验一遍整棵树，失败则输出原因并abort()
+#endif
+
 namespace Viclib
 {
 
 enum RBTColor { RED, BLACK };
 
-template <typename T>
-class RBTNode
+template <bool Counted>
+class RBTNodeSize			// 不统计子树结点数时为空基类，不占结点空间
+{
+};
+
+template <>
+class RBTNodeSize<true>		// 顺序统计：以该结点为根的子树的结点数
+{
+public:
+	uint64_t mSize;
+
+	RBTNodeSize() : mSize(1) {}
+};
+
+/*	结点的父指针和颜色统一通过parent()/setParent()、color()/setColor()访问，两种布局共用同一套红黑树代码
+ *	Packed为false时颜色单独存放；为true时颜色存在父指针的最低位，uint64_t的结点从40字节缩小到32字节
+ */
+template <typename T, bool Counted = false, bool Packed = false>
+class RBTNode : public RBTNodeSize<Counted>
 {
 public:
 	RBTColor mColor;
 	T mKey;
-	RBTNode<T>* mLeft;
-	RBTNode<T>* mRight;
-	RBTNode<T>* mParent;
+	RBTNode<T, Counted, Packed>* mLeft;
+	RBTNode<T, Counted, Packed>* mRight;
+	RBTNode<T, Counted, Packed>* mParent;
 
-	RBTNode(RBTColor color, T key, RBTNode<T>* left, RBTNode<T>* right, RBTNode<T>* parent) :
-		mColor(color), mKey(key), mLeft(left), mRight(right), mParent(parent) {}
+	RBTNode(RBTColor color, T key, RBTNode<T, Counted, Packed>* left, RBTNode<T, Counted, Packed>* right, RBTNode<T, Counted, Packed>* parent) :
+		mColor(color), mKey(std::move(key)), mLeft(left), mRight(right), mParent(parent) {}
+
+	RBTNode<T, Counted, Packed>* parent() const { return mParent; }
+	void setParent(RBTNode<T, Counted, Packed>* parent) { mParent = parent; }
+	RBTColor color() const { return mColor; }
+	void setColor(RBTColor color) { mColor = color; }
 };
 
-template <typename T>
-class RBTree
+template <typename T, bool Counted>
+class RBTNode<T, Counted, true> : public RBTNodeSize<Counted>
 {
 private:
-	RBTNode<T>* mRoot;
-	uint64_t mCount;
-	uint16_t mHeight;
+	uintptr_t mParentColor;		// 父结点地址|颜色；结点至少按指针大小对齐，地址最低位恒为0，借来存颜色（RED=0，BLACK=1）
+
+public:
+	T mKey;
+	RBTNode<T, Counted, true>* mLeft;
+	RBTNode<T, Counted, true>* mRight;
+
+	RBTNode(RBTColor color, T key, RBTNode<T, Counted, true>* left, RBTNode<T, Counted, true>* right, RBTNode<T, Counted, true>* parent) :
+		mParentColor(reinterpret_cast<uintptr_t>(parent) | static_cast<uintptr_t>(color)), mKey(std::move(key)), mLeft(left), mRight(right)
+	{
+		static_assert(alignof(RBTNode<T, Counted, true>) >= 2, "node address has no spare low bit for the color");
+	}
+
+	RBTNode<T, Counted, true>* parent() const
+	{
+		return reinterpret_cast<RBTNode<T, Counted, true>*>(mParentColor & ~static_cast<uintptr_t>(1));
+	}
+
+	void setParent(RBTNode<T, Counted, true>* parent)
+	{
+		mParentColor = reinterpret_cast<uintptr_t>(parent) | (mParentColor & 1);
+	}
+
+	RBTColor color() const
+	{
+		return static_cast<RBTColor>(mParentColor & 1);
+	}
+
+	void setColor(RBTColor color)
+	{
+		mParentColor = (mParentColor & ~static_cast<uintptr_t>(1)) | static_cast<uintptr_t>(color);
+	}
+};
+
+/*	双向迭代器，按中序（升序）访问，只读
+ *	借助mParent回溯，不需要栈，++和--均摊O(1)；end()的结点为nullptr，--end()得到最大结点
+ */
+template <typename T, typename Node>
+class RBTIterator
+{
+private:
+	Node* mNode;
+	Node* const* mRoot;		// 指向树的mRoot，旋转后根结点改变也不受影响
+
+	static Node* minimum(Node* tree);
+	static Node* maximum(Node* tree);
+
+public:
+	typedef bidirectional_iterator_tag iterator_category;
+	typedef T value_type;
+	typedef ptrdiff_t difference_type;
+	typedef T const* pointer;
+	typedef T const& reference;
+
+	RBTIterator();
+	RBTIterator(Node* node, Node* const* root);
+
+	reference operator * () const;
+	pointer operator -> () const;
+
+	RBTIterator& operator ++ ();
+	RBTIterator operator ++ (int);
+	RBTIterator& operator -- ();
+	RBTIterator operator -- (int);
+
+	bool operator == (const RBTIterator& other) const;
+	bool operator != (const RBTIterator& other) const;
+
+	Node* node() const;
+};
+
+template <typename T, typename Node>
+RBTIterator<T, Node>::RBTIterator() : mNode(nullptr), mRoot(nullptr)
+{
+}
+
+template <typename T, typename Node>
+RBTIterator<T, Node>::RBTIterator(Node* node, Node* const* root) : mNode(node), mRoot(root)
+{
+}
+
+template <typename T, typename Node>
+Node* RBTIterator<T, Node>::minimum(Node* tree)
+{
+	if ( tree != nullptr )
+		while ( tree->mLeft != nullptr )
+			tree = tree->mLeft;
+
+	return tree;
+}
+
+template <typename T, typename Node>
+Node* RBTIterator<T, Node>::maximum(Node* tree)
+{
+	if ( tree != nullptr )
+		while ( tree->mRight != nullptr )
+			tree = tree->mRight;
+
+	return tree;
+}
+
+template <typename T, typename Node>
+typename RBTIterator<T, Node>::reference RBTIterator<T, Node>::operator * () const
+{
+	return mNode->mKey;
+}
+
+template <typename T, typename Node>
+typename RBTIterator<T, Node>::pointer RBTIterator<T, Node>::operator -> () const
+{
+	return &mNode->mKey;
+}
+
+template <typename T, typename Node>
+RBTIterator<T, Node>& RBTIterator<T, Node>::operator ++ ()	// 后继：有右子树则取右子树最小者，否则向上找第一个从左边上来的祖先
+{
+	if ( mNode->mRight != nullptr )
+		mNode = minimum(mNode->mRight);
+	else
+	{
+		Node* p = mNode->parent();
+		while ( p!=nullptr && mNode==p->mRight )
+		{
+			mNode = p;
+			p = p->parent();
+		}
+		mNode = p;
+	}
+
+	return *this;
+}
+
+template <typename T, typename Node>
+RBTIterator<T, Node> RBTIterator<T, Node>::operator ++ (int)
+{
+	RBTIterator ret = *this;
+	++(*this);
+	return ret;
+}
+
+template <typename T, typename Node>
+RBTIterator<T, Node>& RBTIterator<T, Node>::operator -- ()	// 前任：end()退回到最大结点，其余与++对称
+{
+	if ( mNode == nullptr )
+		mNode = maximum(*mRoot);
+	else if ( mNode->mLeft != nullptr )
+		mNode = maximum(mNode->mLeft);
+	else
+	{
+		Node* p = mNode->parent();
+		while ( p!=nullptr && mNode==p->mLeft )
+		{
+			mNode = p;
+			p = p->parent();
+		}
+		mNode = p;
+	}
+
+	return *this;
+}
+
+template <typename T, typename Node>
+RBTIterator<T, Node> RBTIterator<T, Node>::operator -- (int)
+{
+	RBTIterator ret = *this;
+	--(*this);
+	return ret;
+}
+
+template <typename T, typename Node>
+bool RBTIterator<T, Node>::operator == (const RBTIterator& other) const
+{
+	return mNode == other.mNode;
+}
+
+template <typename T, typename Node>
+bool RBTIterator<T, Node>::operator != (const RBTIterator& other) const
+{
+	return mNode != other.mNode;
+}
+
+template <typename T, typename Node>
+Node* RBTIterator<T, Node>::node() const
+{
+	return mNode;
+}
+
+/*	结点分配策略，RBTree的第二个模板参数
+ *	allocate()只返回未构造的内存，deallocate()只回收内存，结点的构造和析构由RBTree负责
+ *	canRelease为true时release()可以一次性回收所有结点，destroy()不必逐个释放
+ *	分配器可以复制，副本之间共享同一块内存（shares()），split()/join()产生的树借此互相交换结点；
+ *	只有唯一持有者（unique()）调用release()才会真正归还内存；共享内存的树不能在不同线程同时修改
+ *	reservedBytes(live)是分配器占用的字节数，live是使用者持有的结点数，O(1)，供指标导出；共享内存时每棵树都会报告整块内存
+ */
+template <typename Node>
+class RBTNewAllocator		// 逐个new/delete，与原来的行为一致
+{
+public:
+	static constexpr bool canRelease = false;
+
+	Node* allocate()
+	{
+		return static_cast<Node*>(::operator new(sizeof(Node)));
+	}
+
+	void deallocate(Node* node)
+	{
+		::operator delete(node);
+	}
+
+	void release()
+	{
+	}
+
+	uint64_t reservedBytes(uint64_t live) const	// 不计malloc自身的额外开销
+	{
+		return live*sizeof(Node);
+	}
+
+	bool unique() const
+	{
+		return true;
+	}
+
+	bool shares(const RBTNewAllocator&) const	// 所有结点都来自同一个堆
+	{
+		return true;
+	}
+};
+
+template <typename Node>
+class RBTNodePool			// 结点池：按块批量申请内存，结点在块内连续存放，删除的结点进入空闲链表等待复用
+{
+private:
+	struct FreeNode
+	{
+		FreeNode* mNext;
+	};
+
+	struct Slab				// 内存块头部，结点紧跟在头部之后
+	{
+		Slab* mNext;
+		uint64_t mCapacity;
+	};
+
+	static constexpr uint64_t MIN_SLAB_NODES = 1ull<<10;
+	static constexpr uint64_t MAX_SLAB_NODES = 1ull<<16;
+	static constexpr size_t NODE_OFFSET = (sizeof(Slab)+alignof(Node)-1) / alignof(Node) * alignof(Node);
+
+	struct Arena
+	{
+		Slab* mSlabs;			// 已申请的内存块链表，最新的块在表头
+		Node* mCursor;			// 当前块中下一个未使用的结点
+		Node* mEnd;				// 当前块的结尾
+		FreeNode* mFree;		// 被删除结点组成的空闲链表
+		uint64_t mNextCapacity;	// 下一个块的结点数，逐块翻倍至上限
+		uint64_t mReserved;		// 已申请的内存块的总字节数
+
+		Arena();
+		~Arena();
+
+		void grow();
+		void release();
+	};
+
+	shared_ptr<Arena> mArena;
+
+public:
+	static constexpr bool canRelease = true;
+
+	RBTNodePool();
+
+	Node* allocate();
+	void deallocate(Node* node);
+	void release();
+	uint64_t reservedBytes(uint64_t live) const;
+
+	bool unique() const;
+	bool shares(const RBTNodePool& other) const;
+};
+
+template <typename Node>
+RBTNodePool<Node>::Arena::Arena() :
+	mSlabs(nullptr), mCursor(nullptr), mEnd(nullptr), mFree(nullptr), mNextCapacity(MIN_SLAB_NODES), mReserved(0ull)
+{
+	static_assert(sizeof(Node) >= sizeof(FreeNode), "node is too small for the free list");
+}
+
+template <typename Node>
+RBTNodePool<Node>::Arena::~Arena()
+{
+	release();
+}
+
+template <typename Node>
+void RBTNodePool<Node>::Arena::grow()
+{
+	Slab* slab = static_cast<Slab*>(::operator new(NODE_OFFSET + mNextCapacity*sizeof(Node)));
+	slab->mNext = mSlabs;
+	slab->mCapacity = mNextCapacity;
+	mSlabs = slab;
+	mReserved += NODE_OFFSET + mNextCapacity*sizeof(Node);
+
+	mCursor = reinterpret_cast<Node*>(reinterpret_cast<char*>(slab) + NODE_OFFSET);
+	mEnd = mCursor + mNextCapacity;
+
+	if ( mNextCapacity < MAX_SLAB_NODES )
+		mNextCapacity <<= 1;
+}
+
+template <typename Node>
+void RBTNodePool<Node>::Arena::release()	// 一次性归还所有内存块，开销只与块数有关，与结点数无关
+{
+	while ( mSlabs != nullptr )
+	{
+		Slab* tmp = mSlabs;
+		mSlabs = tmp->mNext;
+		::operator delete(tmp);
+	}
+
+	mCursor = nullptr;
+	mEnd = nullptr;
+	mFree = nullptr;
+	mNextCapacity = MIN_SLAB_NODES;
+	mReserved = 0ull;
+}
+
+template <typename Node>
+RBTNodePool<Node>::RBTNodePool() : mArena(make_shared<Arena>())
+{
+}
+
+template <typename Node>
+Node* RBTNodePool<Node>::allocate()
+{
+	Arena& a = *mArena;
+
+	if ( a.mFree != nullptr )		// 优先复用被删除的结点
+	{
+		FreeNode* ret = a.mFree;
+		a.mFree = ret->mNext;
+		return reinterpret_cast<Node*>(ret);
+	}
 
-	void preOrder(RBTNode<T>* tree) const;
-	void inOrder(RBTNode<T>* tree) const;
-	void postOrder(RBTNode<T>* tree) const;
+	if ( a.mCursor == a.mEnd )
+		a.grow();
 
-	void levelOrder(RBTNode<T>* tree) const;
+	return a.mCursor++;
+}
 
-	RBTNode<T>* search(RBTNode<T>* tree, T key) const;
-	RBTNode<T>* iterativeSearch(RBTNode<T>* tree, T key) const;
+template <typename Node>
+void RBTNodePool<Node>::deallocate(Node* node)
+{
+	FreeNode* tmp = reinterpret_cast<FreeNode*>(node);
+	tmp->mNext = mArena->mFree;
+	mArena->mFree = tmp;
+}
 
-	RBTNode<T>* minimum(RBTNode<T>* tree) const;
-	RBTNode<T>* maximum(RBTNode<T>* tree) const;
+template <typename Node>
+void RBTNodePool<Node>::release()	// 还有其它树共享这块内存时什么也不做
+{
+	if ( unique() )
+		mArena->release();
+}
 
-	void lRotate(RBTNode<T>* &tree, RBTNode<T>* node) const;
-	void rRotate(RBTNode<T>* &tree, RBTNode<T>* node) const;
+template <typename Node>
+uint64_t RBTNodePool<Node>::reservedBytes(uint64_t) const	// 包括空闲链表中和块尾尚未用到的结点
+{
+	return mArena->mReserved;
+}
 
-	void insert(RBTNode<T>* &tree, RBTNode<T>* node);
-	void insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node);	// 插入修正红黑树
+template <typename Node>
+bool RBTNodePool<Node>::unique() const
+{
+	return mArena.use_count() == 1;
+}
 
-	void remove(RBTNode<T>* &tree, RBTNode<T> *del);
-	void removeFixUp(RBTNode<T>* &tree, RBTNode<T>* del, RBTNode<T>* parent);	// 删除修正红黑树(被删除的是黑色)
+template <typename Node>
+bool RBTNodePool<Node>::shares(const RBTNodePool& other) const
+{
+	return mArena == other.mArena;
+}
 
-	void printTree(RBTNode<T> const* const tree, bool firstNode) const;
+/*	Stats是统计策略（见TreeStats.h），默认TreeNoStats不统计；换成TreeCountStats后统计旋转、变色、修正轮数和查找的比较次数
+ */
+template <typename T, template <typename> class Alloc = RBTNodePool, bool Counted = false, bool Packed = false, typename Stats = TreeNoStats>
+class RBTree
+{
+	template <typename> friend class ConcurrentRBTree;	// 无锁读取需要直接访问mRoot
 
-	void destroy(RBTNode<T>* &tree);
-	uint16_t max(uint16_t left, uint16_t right) const;
-	uint16_t updateHeight(RBTNode<T> *node);
+private:
+	RBTNode<T, Counted, Packed>* mRoot;
+	uint64_t mCount;
+	uint16_t mBlackHeight;			// 根到叶子路径上的黑色结点数，insert/remove时随修正增量维护
+	mutable Stats mStats;			// 查找和旋转是const函数，也要能计数；空的TreeNoStats放在这里正好占用对齐的空隙
+	uint64_t mVersion;				// 每次修改加一，用来判断下面的缓存是否过期
+
+	mutable uint16_t mHeight;				// 按需统计的精确高度和各层结点数，只在树有修改后再次查询时重新统计
+	mutable vector<uint64_t> mDepths;
+	mutable uint64_t mDepthsVersion;
+	Alloc<RBTNode<T, Counted, Packed>> mAlloc;
+	shared_ptr<TreeMetricsSlot> mMetrics;	// attachMetrics()之后才有，每次修改后把O(1)的指标写进去
+
+	template <typename F>
+	static bool visit(F& visitor, const T& key);	// visitor可以返回void或bool
+
+	RBTNode<T, Counted, Packed>* search(RBTNode<T, Counted, Packed>* tree, T key) const;
+	RBTNode<T, Counted, Packed>* iterativeSearch(RBTNode<T, Counted, Packed>* tree, T key) const;
+
+	RBTNode<T, Counted, Packed>* minimum(RBTNode<T, Counted, Packed>* tree) const;
+	RBTNode<T, Counted, Packed>* maximum(RBTNode<T, Counted, Packed>* tree) const;
+
+	static uint64_t size(RBTNode<T, Counted, Packed> const* tree);		// 子树结点数，未开启Counted时恒为0
+	static void updateSize(RBTNode<T, Counted, Packed>* node);
+	static void addSize(RBTNode<T, Counted, Packed>* node, int64_t delta);	// node及其所有祖先的子树结点数加delta
+
+	void lRotate(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node) const;
+	void rRotate(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node) const;
+
+	void insert(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node);
+	void link(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* parent, RBTNode<T, Counted, Packed>* &slot, RBTNode<T, Counted, Packed>* node);	// 把node挂到parent的空孩子slot上并修正
+	template <typename K>
+	pair<RBTNode<T, Counted, Packed>*, bool> tryInsertKey(K&& key);
+	bool insertFixUp(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node);	// 插入修正红黑树，根由红变黑（黑高加一）时返回true
+
+	void remove(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed> *del);
+	bool removeFixUp(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* del, RBTNode<T, Counted, Packed>* parent);	// 删除修正红黑树(被删除的是黑色)，黑高减一时返回true
+
+	void printTree(RBTNode<T, Counted, Packed> const* const tree, bool firstNode) const;
+
+	template <typename Iterator>
+	RBTNode<T, Counted, Packed>* buildFromSorted(Iterator& it, uint64_t n, uint16_t depth, uint16_t redDepth, RBTNode<T, Counted, Packed>* parent);
+
+	template <typename K>
+	RBTNode<T, Counted, Packed>* createNode(K&& key);
+	void destroyNode(RBTNode<T, Counted, Packed>* node);
+
+	static uint16_t blackHeight(RBTNode<T, Counted, Packed>* tree);		// 沿最左路径统计黑色结点数，O(log(n))
+	static void detach(RBTNode<T, Counted, Packed>* node, RBTNode<T, Counted, Packed>* &left, RBTNode<T, Counted, Packed>* &right);
+
+	// 以下各函数都带着子树的黑高（按根的实际颜色计）一起传递，避免每层递归都沿路径重新统计
+	RBTNode<T, Counted, Packed>* join(RBTNode<T, Counted, Packed>* left, uint16_t bl, RBTNode<T, Counted, Packed>* node, RBTNode<T, Counted, Packed>* right, uint16_t br, uint16_t& bh);	// bh返回结果的黑高
+	RBTNode<T, Counted, Packed>* join(RBTNode<T, Counted, Packed>* left, uint16_t bl, RBTNode<T, Counted, Packed>* right, uint16_t br, uint16_t& bh);
+	void split(RBTNode<T, Counted, Packed>* tree, uint16_t th, const T& key, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &found, RBTNode<T, Counted, Packed>* &right, uint16_t& br);
+	void split(RBTNode<T, Counted, Packed>* tree, uint16_t th, const T& key, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &right, uint16_t& br);		// 小于key的进left，其余（含所有等于key的）进right
+	void splitLast(RBTNode<T, Counted, Packed>* tree, uint16_t th, RBTNode<T, Counted, Packed>* &rest, uint16_t& bh, RBTNode<T, Counted, Packed>* &last);
+
+	typedef RBTNode<T, Counted, Packed>* (RBTree::*SetOp)(RBTNode<T, Counted, Packed>*, uint16_t, RBTNode<T, Counted, Packed>*, uint16_t, vector<RBTNode<T, Counted, Packed>*>&, uint16_t, uint16_t&);
+	static constexpr uint16_t FORK_BLACK_HEIGHT = 10;		// 子树黑高低于此值（约一千个结点）时不再开新线程
+	static uint16_t forkBudget();
+
+	void fork(SetOp op, RBTNode<T, Counted, Packed>* a1, uint16_t ha1, RBTNode<T, Counted, Packed>* b1, uint16_t hb1, RBTNode<T, Counted, Packed>* a2, uint16_t ha2, RBTNode<T, Counted, Packed>* b2, uint16_t hb2,
+			  vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &right, uint16_t& br);
+	RBTNode<T, Counted, Packed>* unite(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh);
+	RBTNode<T, Counted, Packed>* intersect(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh);
+	RBTNode<T, Counted, Packed>* subtract(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh);
+	void setOperation(RBTree& other, SetOp op);
+	void adopt(RBTree& other);								// 让other的结点改用本树的内存池；不共享时O(n)单线程复制
+
+	uint64_t countNodes(RBTNode<T, Counted, Packed> const* tree) const;
+	uint64_t destroy(RBTNode<T, Counted, Packed>* &tree);			// 返回释放的结点数
+	void updateDepths() const;			// 遍历一遍统计各层结点数，栈深度O(log(n))
+	void reshaped();					// 批量修改后重新取黑高，并让高度缓存失效
+	void modified();					// 每次修改后调用，开启RBTREE_VALIDATE_INTERVAL时按间隔校验
 
 public:
+	typedef RBTNode<T, Counted, Packed> Node;
+	typedef RBTIterator<T, RBTNode<T, Counted, Packed>> iterator;
+	typedef iterator const_iterator;
+
 	RBTree();
+	RBTree(const RBTree&) = delete;
+	RBTree& operator = (const RBTree&) = delete;
 	~RBTree();
 
 	void preOrder() const;
@@ -71,129 +551,244 @@ public:
 
 	void levelOrder() const;
 
-	RBTNode<T>* search(T key) const;
-	RBTNode<T>* iterativeSearch(T key) const;
+	template <typename F>
+	bool forEachPreOrder(F&& visitor) const;		// 非递归遍历，visitor(key)返回false时提前结束，返回值表示是否遍历完整棵树
+	template <typename F>
+	bool forEachInOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachPostOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachLevelOrder(F&& visitor) const;
+	template <typename F>
+	bool forEachInRange(const T& lo, const T& hi, F&& visitor) const;	// 按升序访问[lo, hi)内的key
+
+	RBTNode<T, Counted, Packed>* search(T key) const;
+	RBTNode<T, Counted, Packed>* iterativeSearch(T key) const;
 
 	T const* minimum() const;
 	T const* maximum() const;
 
-	RBTNode<T>* successor(RBTNode<T>* node) const;
-	RBTNode<T>* predecessor(RBTNode<T>* node) const;
-
-	void insert(T key);
+	RBTNode<T, Counted, Packed>* successor(RBTNode<T, Counted, Packed>* node) const;
+	RBTNode<T, Counted, Packed>* predecessor(RBTNode<T, Counted, Packed>* node) const;
+
+	iterator begin() const;
+	iterator end() const;
+	iterator lower_bound(const T& key) const;		// 第一个不小于key的结点
+	iterator upper_bound(const T& key) const;		// 第一个大于key的结点
+	pair<iterator, iterator> equal_range(const T& key) const;
+
+	void insert(const T& key);						// 允许重复key，重复的放在右边
+	void insert(T&& key);
+	pair<RBTNode<T, Counted, Packed>*, bool> tryInsert(const T& key);	// 一次下行完成查找和插入，key已存在时返回已有结点和false
+	pair<RBTNode<T, Counted, Packed>*, bool> tryInsert(T&& key);
+	template <typename... Args>
+	pair<RBTNode<T, Counted, Packed>*, bool> emplace(Args&&... args);	// 用参数直接构造key，key已存在时不插入
 	bool remove(T key);
+	void erase(RBTNode<T, Counted, Packed>* node);					// 删除已经找到的结点，不再查找
+	iterator erase(iterator it);						// 返回被删除结点的下一个位置
+	uint64_t eraseRange(const T& lo, const T& hi);		// 删除[lo, hi)内的所有结点，返回删除数量，O(log(n)+k)
+
+	RBTNode<T, Counted, Packed>* select(uint64_t k) const;		// 第k小的结点（从0开始），需要Counted
+	uint64_t rank(const T& key) const;					// 小于key的结点数，需要Counted
+	uint64_t countRange(const T& lo, const T& hi) const;	// [lo, hi)内的结点数，需要Counted
+
+	void split(const T& key, RBTree& left, RBTree& right);	// 小于key的进left，其余进right，本树清空
+	void join(RBTree& left, const T& key, RBTree& right);	// 要求left < key < right，结果存入本树，left和right清空
+	void setUnion(RBTree& other);							// 集合运算，结果存入本树，other清空；多线程并行；两树内存池不同时先串行复制other，O(n)
+	void setIntersection(RBTree& other);
+	void setDifference(RBTree& other);
+	void sharePool(const RBTree& other);					// 清空本树并改用other的内存池，之后两树间的join和集合运算不必复制结点
+
+	template <typename Iterator>
+	void buildFromSorted(Iterator first, Iterator last);	// 用升序序列重建整棵树，O(n)
+	template <typename Iterator>
+	void buildFromUnsorted(Iterator first, Iterator last);	// 先排序再重建，O(n*log(n))
+
+	bool save(const char* path) const;					// 写出带版本号的二进制快照：文件头加升序排列的key
+	bool load(const char* path);						// 映射快照文件后用buildFromSorted()线性重建；失败时本树不变
 
 	void printTree() const;
+	bool exportKeys(TreeWriter& writer) const;		// 按升序把全部key写入缓冲区，整块write(2)写出
+	bool exportKeys(int fd, TreeWriter::Format format = TreeWriter::TEXT) const;
+	bool exportKeys(const char* path, TreeWriter::Format format = TreeWriter::TEXT) const;
 
 	void destroy();
 	uint64_t getCount() const;
-	uint16_t getHeight(bool update = true);
+	bool validate(char const** reason = nullptr) const;	// 一次遍历校验全部红黑树性质，O(n)时间，O(log(n))空间；失败时reason指向原因
+	uint16_t getHeight(bool exact = true) const;	// exact为true时返回精确高度（树有修改后才重新统计，O(n)），否则返回O(1)的上界
+	uint16_t getBlackHeight() const;
+	uint16_t getHeightBound() const;				// 红黑树高度不超过黑高的两倍
+	TreeStats stats() const;						// 统计快照，Stats为TreeNoStats时全为0
+	void resetStats();
+	void attachMetrics(const string& name, TreeMetricsRegistry& registry = TreeMetricsRegistry::instance());	// 注册到指标表，之后每次修改都更新指标
+	void publishMetrics() const;					// 立即更新指标；只查找不修改的阶段里，查找计数要靠它才能刷新
+	vector<uint64_t> const& getDepthHistogram() const;	// 下标为深度（根为0），值为该层结点数，按需统计
 	bool rootIsNullptr() const;
 	T getRootKey() const;
 	uint8_t setKeyStrLen();
 };
 
-template <typename T>
-RBTree<T>::RBTree() : mRoot(nullptr), mCount(0ull), mHeight(0)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTree<T, Alloc, Counted, Packed, Stats>::RBTree() : mRoot(nullptr), mCount(0ull), mBlackHeight(0), mVersion(0ull), mHeight(0), mDepthsVersion(0ull)
 {
 }
 
-template <typename T>
-RBTree<T>::~RBTree()
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTree<T, Alloc, Counted, Packed, Stats>::~RBTree()
 {
 	destroy();
 }
 
-template <typename T>
-void RBTree<T>::preOrder(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::preOrder() const
 {
-	if ( tree != nullptr )
-	{
-		cout << tree->mKey << " " << flush;
-		preOrder(tree->mLeft);
-		preOrder(tree->mRight);
-	}
+	forEachPreOrder([](const T& key) { cout << key << " "; });
+	cout << endl;
 }
 
-template <typename T>
-void RBTree<T>::preOrder() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::inOrder() const
 {
-	preOrder(mRoot);
+	forEachInOrder([](const T& key) { cout << key << " "; });
 	cout << endl;
 }
 
-template <typename T>
-void RBTree<T>::inOrder(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::postOrder() const
 {
-	if ( tree != nullptr )
-	{
-		inOrder(tree->mLeft);
-		cout << tree->mKey << " " << flush;
-		inOrder(tree->mRight);
-	}
+	forEachPostOrder([](const T& key) { cout << key << " "; });
+	cout << endl;
 }
 
-template <typename T>
-void RBTree<T>::inOrder() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::levelOrder() const
 {
-	inOrder(mRoot);
+	forEachLevelOrder([](const T& key) { cout << key << " "; });
 	cout << endl;
 }
 
-template <typename T>
-void RBTree<T>::postOrder(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::visit(F& visitor, const T& key)
 {
-	if ( tree != nullptr )
+	if constexpr ( is_void<decltype(visitor(key))>::value )		// 返回void的visitor不能提前结束
 	{
-		postOrder(tree->mLeft);
-		postOrder(tree->mRight);
-		cout << tree->mKey << " " << flush;
+		visitor(key);
+		return true;
 	}
+	else
+		return static_cast<bool>(visitor(key));
 }
 
-template <typename T>
-void RBTree<T>::postOrder() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::forEachPreOrder(F&& visitor) const
 {
-	postOrder(mRoot);
-	cout << endl;
+	vector<RBTNode<T, Counted, Packed>*> stack;
+	if ( mRoot != nullptr )
+		stack.push_back(mRoot);
+
+	while ( !stack.empty() )
+	{
+		RBTNode<T, Counted, Packed>* node = stack.back();
+		stack.pop_back();
+
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		if ( node->mRight != nullptr )			// 右孩子先进栈，左子树先访问
+			stack.push_back(node->mRight);
+		if ( node->mLeft != nullptr )
+			stack.push_back(node->mLeft);
+	}
+
+	return true;
 }
 
-template <typename T>
-void RBTree<T>::levelOrder(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::forEachInOrder(F&& visitor) const
 {
-	if ( tree != nullptr )
+	for ( RBTNode<T, Counted, Packed>* node = minimum(mRoot); node != nullptr; node = successor(node) )	// 沿父指针找后继，不需要栈
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+	return true;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::forEachPostOrder(F&& visitor) const
+{
+	vector<RBTNode<T, Counted, Packed>*> stack;
+	RBTNode<T, Counted, Packed>* node = mRoot;
+	RBTNode<T, Counted, Packed>* last = nullptr;						// 上一个访问的结点，用来判断右子树是否已经访问过
+
+	while ( node != nullptr || !stack.empty() )
 	{
-		queue<RBTNode<T>*> tmp;
-		tmp.push(tree);
+		for ( ; node != nullptr; node = node->mLeft )
+			stack.push_back(node);
 
-		while( tmp.size() > 0 )
+		RBTNode<T, Counted, Packed>* top = stack.back();
+		if ( top->mRight != nullptr && top->mRight != last )
+			node = top->mRight;
+		else
 		{
-			RBTNode<T>* t = tmp.front();
+			if ( !visit(visitor, top->mKey) )
+				return false;
 
-			if ( t->mLeft != nullptr )
-				tmp.push(t->mLeft);
+			last = top;
+			stack.pop_back();
+		}
+	}
 
-			if ( t->mRight != nullptr )
-				tmp.push(t->mRight);
+	return true;
+}
 
-			tmp.pop();
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::forEachLevelOrder(F&& visitor) const
+{
+	queue<RBTNode<T, Counted, Packed>*> tmp;
+	if ( mRoot != nullptr )
+		tmp.push(mRoot);
 
-			cout << t->mKey << " " << flush;
-		}
+	while ( !tmp.empty() )
+	{
+		RBTNode<T, Counted, Packed>* node = tmp.front();
+		tmp.pop();
+
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+		if ( node->mLeft != nullptr )
+			tmp.push(node->mLeft);
+		if ( node->mRight != nullptr )
+			tmp.push(node->mRight);
 	}
+
+	return true;
 }
 
-template <typename T>
-void RBTree<T>::levelOrder() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename F>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::forEachInRange(const T& lo, const T& hi, F&& visitor) const
 {
-	levelOrder(mRoot);
-	cout << endl;
+	for ( RBTNode<T, Counted, Packed>* node = lower_bound(lo).node(); node != nullptr && node->mKey < hi; node = successor(node) )
+		if ( !visit(visitor, node->mKey) )
+			return false;
+
+	return true;
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::search(RBTNode<T>* tree, T key) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::search(RBTNode<T, Counted, Packed>* tree, T key) const
 {
-	if ( tree==nullptr || key==tree->mKey )
+	if ( tree==nullptr )
+		return tree;
+
+	mStats.comparison();
+	if ( key==tree->mKey )
 		return tree;
 
 	if ( key < tree->mKey )
@@ -202,34 +797,39 @@ RBTNode<T>* RBTree<T>::search(RBTNode<T>* tree, T key) const
 		return search(tree->mRight, key);
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::search(T key) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::search(T key) const
 {
+	mStats.search();
 	return search(mRoot, key);
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::iterativeSearch(RBTNode<T>* tree, T key) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::iterativeSearch(RBTNode<T, Counted, Packed>* tree, T key) const
 {
+	mStats.search();
 	while ( tree!=nullptr && key!=tree->mKey )
 	{
+		mStats.comparison();
 		if ( key < tree->mKey )
 			tree = tree->mLeft;
 		else
 			tree = tree->mRight;
 	}
+	if ( tree != nullptr )
+		mStats.comparison();				// 命中的那一次
 
 	return tree;
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::iterativeSearch(T key) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::iterativeSearch(T key) const
 {
 	return iterativeSearch(mRoot, key);
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::minimum(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::minimum(RBTNode<T, Counted, Packed>* tree) const
 {
 	if ( tree == nullptr )
 		return nullptr;
@@ -240,18 +840,18 @@ RBTNode<T>* RBTree<T>::minimum(RBTNode<T>* tree) const
 	return tree;
 }
 
-template <typename T>
-T const* RBTree<T>::minimum() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+T const* RBTree<T, Alloc, Counted, Packed, Stats>::minimum() const
 {
-	RBTNode<T>* ret = minimum(mRoot);
+	RBTNode<T, Counted, Packed>* ret = minimum(mRoot);
 	if ( ret != nullptr )
 		return &ret->mKey;
 
 	return nullptr;
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::maximum(RBTNode<T>* tree) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::maximum(RBTNode<T, Counted, Packed>* tree) const
 {
 	if ( tree == nullptr )
 		return nullptr;
@@ -262,79 +862,224 @@ RBTNode<T>* RBTree<T>::maximum(RBTNode<T>* tree) const
 	return tree;
 }
 
-template <typename T>
-T const* RBTree<T>::maximum() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+T const* RBTree<T, Alloc, Counted, Packed, Stats>::maximum() const
 {
-	RBTNode<T>* ret = maximum(mRoot);
+	RBTNode<T, Counted, Packed>* ret = maximum(mRoot);
 	if ( ret != nullptr )
 		return &ret->mKey;
 
 	return nullptr;
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::successor(RBTNode<T>* tree) const	// 查找tree的后继，比tree大
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::successor(RBTNode<T, Counted, Packed>* tree) const	// 查找tree的后继，比tree大
 {
-	if ( tree->right != nullptr )			// 在右节点查找最小结点
-		return minimum(tree->right);
+	if ( tree->mRight != nullptr )			// 在右节点查找最小结点
+		return minimum(tree->mRight);
 
-	RBTNode<T>* p = tree->parent;
-	while ( p!=nullptr && tree==p->right )	// 父节点非空且自己是右节点就继续寻找，直至自己是左结点或父节点为空
+	RBTNode<T, Counted, Packed>* p = tree->parent();
+	while ( p!=nullptr && tree==p->mRight )	// 父节点非空且自己是右节点就继续寻找，直至自己是左结点或父节点为空
 	{
 		tree = p;
-		p = p->parent;
+		p = p->parent();
 	}
 
 	return p;
 }
 
-template <typename T>
-RBTNode<T>* RBTree<T>::predecessor(RBTNode<T>* tree) const	// 查找tree的前任，比tree小
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::predecessor(RBTNode<T, Counted, Packed>* tree) const	// 查找tree的前任，比tree小
 {
-	if ( tree->left != nullptr )			// 在左结点查找最大结点
-		return maximum(tree->left);
+	if ( tree->mLeft != nullptr )			// 在左结点查找最大结点
+		return maximum(tree->mLeft);
 
-	RBTNode<T>* p = tree->parent;
-	while ( p!=nullptr && tree==p->left )	// 父节点非空且自己是左结点就继续寻找，直至自己是右节点或父节点为空
+	RBTNode<T, Counted, Packed>* p = tree->parent();
+	while ( p!=nullptr && tree==p->mLeft )	// 父节点非空且自己是左结点就继续寻找，直至自己是右节点或父节点为空
 	{
 		tree = p;
-		p = p->parent;
+		p = p->parent();
 	}
 
 	return p;
 }
 
-/*	左旋
- *    p                     p
- *    |                     |
- *   old                   new
- *   / \     --(左旋)-->    / \
- *  a  new                old c
- *     / \                / \
- *    B   c              a   B
- */
-template <typename T>
-void RBTree<T>::lRotate(RBTNode<T>* &tree, RBTNode<T>* node) const	// 将右边重的结点旋转至左边重
-{																	// 当前结点成为右孩子的左孩子，右孩子的左孩子成为自己的右孩子，右孩子则替换自己位置
-	RBTNode<T>* r = node->mRight;			// 新结点指向右节点
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator RBTree<T, Alloc, Counted, Packed, Stats>::begin() const
+{
+	return iterator(minimum(mRoot), &mRoot);
+}
 
-	node->mRight = r->mLeft;					// 更新 【当前结点（旧结点）】 与 【右节点（新结点）的左孩子】 之间的关系
-	if ( r->mLeft != nullptr )
-		r->mLeft->mParent = node;
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator RBTree<T, Alloc, Counted, Packed, Stats>::end() const
+{
+	return iterator(nullptr, &mRoot);
+}
 
-	r->mParent = node->mParent;				// 更新 父节点 和 新孩子 之间的关系
-	if ( node->mParent == nullptr )
-		tree = r;
-	else
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator RBTree<T, Alloc, Counted, Packed, Stats>::lower_bound(const T& key) const
+{
+	RBTNode<T, Counted, Packed>* tree = mRoot;
+	RBTNode<T, Counted, Packed>* ret = nullptr;
+
+	while ( tree != nullptr )
 	{
-		if ( node == node->mParent->mLeft )		// 判断并更新父节点的新孩子
-			node->mParent->mLeft = r;
+		if ( tree->mKey < key )
+			tree = tree->mRight;
 		else
-			node->mParent->mRight = r;
-	}
+		{
+			ret = tree;						// 候选者，继续在左子树找更小的
+			tree = tree->mLeft;
+		}
+	}
+
+	return iterator(ret, &mRoot);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator RBTree<T, Alloc, Counted, Packed, Stats>::upper_bound(const T& key) const
+{
+	RBTNode<T, Counted, Packed>* tree = mRoot;
+	RBTNode<T, Counted, Packed>* ret = nullptr;
+
+	while ( tree != nullptr )
+	{
+		if ( key < tree->mKey )
+		{
+			ret = tree;
+			tree = tree->mLeft;
+		}
+		else
+			tree = tree->mRight;
+	}
+
+	return iterator(ret, &mRoot);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+pair<typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator, typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator> RBTree<T, Alloc, Counted, Packed, Stats>::equal_range(const T& key) const
+{
+	return make_pair(lower_bound(key), upper_bound(key));
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::size(RBTNode<T, Counted, Packed> const* tree)
+{
+	if constexpr ( Counted )
+		return (tree != nullptr) ? tree->mSize : 0;
+	else
+		return 0;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::updateSize(RBTNode<T, Counted, Packed>* node)
+{
+	if constexpr ( Counted )
+		node->mSize = size(node->mLeft) + size(node->mRight) + 1;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::addSize(RBTNode<T, Counted, Packed>* node, int64_t delta)
+{
+	if constexpr ( Counted )
+		for ( ; node != nullptr; node = node->parent() )
+			node->mSize += static_cast<uint64_t>(delta);
+	else
+		(void)node, (void)delta;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::select(uint64_t k) const
+{
+	static_assert(Counted, "select() requires RBTree<T, Alloc, true>");
+
+	RBTNode<T, Counted, Packed>* tree = mRoot;
+	while ( tree != nullptr )
+	{
+		uint64_t left = size(tree->mLeft);
+		if ( k < left )						// 在左子树
+			tree = tree->mLeft;
+		else if ( k == left )				// 左边正好有k个结点
+			break;
+		else								// 跳过左子树和自己，到右子树找
+		{
+			k -= left + 1;
+			tree = tree->mRight;
+		}
+	}
+
+	return tree;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::rank(const T& key) const
+{
+	static_assert(Counted, "rank() requires RBTree<T, Alloc, true>");
+
+	uint64_t ret = 0;
+	RBTNode<T, Counted, Packed>* tree = mRoot;
+	while ( tree != nullptr )
+	{
+		if ( tree->mKey < key )				// 左子树和自己都小于key
+		{
+			ret += size(tree->mLeft) + 1;
+			tree = tree->mRight;
+		}
+		else
+			tree = tree->mLeft;
+	}
+
+	return ret;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::countRange(const T& lo, const T& hi) const
+{
+	if ( !(lo < hi) )
+		return 0;
+
+	return rank(hi) - rank(lo);
+}
+
+/*	左旋
+ *    p                     p
+ *    |                     |
+ *   old                   new
+ *   / \     --(左旋)-->    / \
+ *  a  new                old c
+ *     / \                / \
+ *    B   c              a   B
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::lRotate(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node) const	// 将右边重的结点旋转至左边重
+{																	// 当前结点成为右孩子的左孩子，右孩子的左孩子成为自己的右孩子，右孩子则替换自己位置
+	RBTNode<T, Counted, Packed>* r = node->mRight;			// 新结点指向右节点
+
+	mStats.rotation();
+
+	node->mRight = r->mLeft;					// 更新 【当前结点（旧结点）】 与 【右节点（新结点）的左孩子】 之间的关系
+	if ( r->mLeft != nullptr )
+		r->mLeft->setParent(node);
+
+	r->setParent(node->parent());				// 更新 父节点 和 新孩子 之间的关系
+	if ( node->parent() == nullptr )
+		tree = r;
+	else
+	{
+		if ( node == node->parent()->mLeft )		// 判断并更新父节点的新孩子
+			node->parent()->mLeft = r;
+		else
+			node->parent()->mRight = r;
+	}
 
 	r->mLeft = node;							// 更新 新旧结点 之间的关系
-	node->mParent = r;
+	node->setParent(r);
+
+	if constexpr ( Counted )					// 新结点接管整棵子树，旧结点重新统计
+	{
+		r->mSize = node->mSize;
+		updateSize(node);
+	}
 }
 
 /*	右旋
@@ -346,49 +1091,58 @@ void RBTree<T>::lRotate(RBTNode<T>* &tree, RBTNode<T>* node) const	// 将右边
  *   / \                    / \
  *  a   B                  B   c
  */
-template <typename T>
-void RBTree<T>::rRotate(RBTNode<T>* &tree, RBTNode<T>* node) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::rRotate(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node) const
 {
-	RBTNode<T>* l = node->mLeft;
+	RBTNode<T, Counted, Packed>* l = node->mLeft;
 
+	mStats.rotation();
 	node->mLeft = l->mRight;
 	if ( l->mRight != nullptr )
-		l->mRight->mParent = node;
+		l->mRight->setParent(node);
 
-	l->mParent = node->mParent;
-	if ( node->mParent == nullptr )
+	l->setParent(node->parent());
+	if ( node->parent() == nullptr )
 		tree = l;
 	else
 	{
-		if ( node == node->mParent->mLeft )
-			node->mParent->mLeft = l;
+		if ( node == node->parent()->mLeft )
+			node->parent()->mLeft = l;
 		else
-			node->mParent->mRight = l;
+			node->parent()->mRight = l;
 	}
 
 	l->mRight = node;
-	node->mParent = l;
+	node->setParent(l);
+
+	if constexpr ( Counted )
+	{
+		l->mSize = node->mSize;
+		updateSize(node);
+	}
 }
 
-template <typename T>
-void RBTree<T>::insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node)	// 插入修正红黑树
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::insertFixUp(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node)	// 插入修正红黑树
 {
-	RBTNode<T> *parent, *gparent;	// 父结点，爷爷结点
+	RBTNode<T, Counted, Packed> *parent, *gparent;	// 父结点，爷爷结点
 
 	// node有父结点且父亲是红色(R红色、B黑色、@插入结点)
-	while ( (parent = node->mParent) && (parent->mColor==RED) )
+	while ( (parent = node->parent()) && (parent->color()==RED) )
 	{
-		gparent = parent->mParent;
+		mStats.fixUp();
+		gparent = parent->parent();
 
 		if ( parent == gparent->mLeft )	// 父亲是左孩子，叔叔是右孩子
 		{
 			{	// 叔叔有效且是红色，while保证父亲也是红色
-				RBTNode<T>* uncle = gparent->mRight;
-				if ( uncle && uncle->mColor==RED )	// 父亲是红色，自己默认又是红色，所以需要变色
+				RBTNode<T, Counted, Packed>* uncle = gparent->mRight;
+				if ( uncle && uncle->color()==RED )	// 父亲是红色，自己默认又是红色，所以需要变色
 				{									// 将父亲和叔叔设为黑结点，爷爷设为红节点；
-					uncle->mColor = BLACK;	//   B		      R
-					parent->mColor = BLACK;	// R   R		B   B
-					gparent->mColor = RED;	// R(@)			R(@)	// 不区分自己是左孩子还是右孩子
+					uncle->setColor(BLACK);	//   B		      R
+					parent->setColor(BLACK);	// R   R		B   B
+					gparent->setColor(RED);	// R(@)			R(@)	// 不区分自己是左孩子还是右孩子
+					mStats.recolor(3);
 					node = gparent;					// node指向爷爷后向上再判断其它结点是否需要平衡
 					continue;
 				}
@@ -397,7 +1151,7 @@ void RBTree<T>::insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node)	// 插入修正
 			{	// 叔叔为空，自己是红色父亲的右孩子，旋转成左孩子（父子身份也交换，且父子仍为红色）
 				if ( parent->mRight == node )// 红节点的子结点如有叶子则全是叶子，否则不平衡；父亲之前没有子结点则父亲无兄弟
 				{
-					RBTNode<T>* tmp;
+					RBTNode<T, Counted, Packed>* tmp;
 					lRotate(tree, parent);	// 左旋后node替换父亲，父亲则成为自己的左孩子，变成左左模式，左左都是红色
 					tmp = parent;			// 旋转后修正父子指针位置，父子互换
 					parent = node;			//	 B  	  B  		B
@@ -406,20 +1160,22 @@ void RBTree<T>::insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node)	// 插入修正
 			}
 
 			{	// 叔叔为空，自己是红色父亲的左孩子
-				parent->mColor = BLACK;		//	 B  	  R 		 B
-				gparent->mColor = RED;		//	R   	 B   	 R(@)   R
+				parent->setColor(BLACK);		//	 B  	  R 		 B
+				gparent->setColor(RED);		//	R   	 B   	 R(@)   R
+				mStats.recolor(2);
 				rRotate(tree, gparent);		// R(@)		R(@)
 			}
 		}
 		else						// 父亲是右孩子，伯父是左孩子
 		{
 			{	// 伯父有效且是红色，while保证父亲也是红色
-				RBTNode<T>* uncle = gparent->mLeft;
-				if ( uncle && uncle->mColor==RED )
+				RBTNode<T, Counted, Packed>* uncle = gparent->mLeft;
+				if ( uncle && uncle->color()==RED )
 				{
-					uncle->mColor = BLACK;	//	 B  		  R
-					parent->mColor = BLACK;	// R   R 		B   B
-					gparent->mColor = RED;	//	   R(@)			R(@)
+					uncle->setColor(BLACK);	//	 B  		  R
+					parent->setColor(BLACK);	// R   R 		B   B
+					gparent->setColor(RED);	//	   R(@)			R(@)
+					mStats.recolor(3);
 					node = gparent;
 					continue;
 				}
@@ -428,7 +1184,7 @@ void RBTree<T>::insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node)	// 插入修正
 			{	// 伯父为空或为黑色，自己是红色父亲的左孩子，旋转成右孩子（父子身份也交换，且父子仍为红色）
 				if ( parent->mLeft == node )
 				{
-					RBTNode<T>* tmp;
+					RBTNode<T, Counted, Packed>* tmp;
 					rRotate(tree, parent);
 					tmp = parent;			// B 		B   	B
 					parent = node;			//  R   	 R(@)	 R
@@ -437,21 +1193,27 @@ void RBTree<T>::insertFixUp(RBTNode<T>* &tree, RBTNode<T>* node)	// 插入修正
 			}
 
 			{	// 伯父为空或为黑色，自己是红色父亲的右孩子
-				parent->mColor = BLACK;		// B 		R   		 B
-				gparent->mColor = RED;		//	R   	 #  	 R       R(@)
+				parent->setColor(BLACK);		// B 		R   		 B
+				gparent->setColor(RED);		//	R   	 #  	 R       R(@)
+				mStats.recolor(2);
 				lRotate(tree, gparent);		//	 R(@)	  R(@)
 			}
 		}
 	}
 
-	tree->mColor = BLACK;	// 如果没有父节点则当前结点就是根节点；父节点为黑则这条语句无意义
+	bool ret = tree->color() == RED;		// 根是红色只有两种可能：新结点成为根，或者叔叔为红的情况一路上推到了根
+	tree->setColor(BLACK);	// 如果没有父节点则当前结点就是根节点；父节点为黑则这条语句无意义
+	if ( ret )
+		mStats.recolor();
+
+	return ret;
 }
 
-template <typename T>
-void RBTree<T>::insert(RBTNode<T>* &tree, RBTNode<T>* node)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::insert(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* node)
 {
-	RBTNode<T>* parent = nullptr;	// 插入点的父节点
-	RBTNode<T>* root = tree;		// 辅助寻找parent
+	RBTNode<T, Counted, Packed>* parent = nullptr;	// 插入点的父节点
+	RBTNode<T, Counted, Packed>* root = tree;		// 辅助寻找parent
 
 	while ( root != nullptr )		// 寻找插入点
 	{
@@ -462,157 +1224,233 @@ void RBTree<T>::insert(RBTNode<T>* &tree, RBTNode<T>* node)
 			root = root->mRight;
 	}
 
-	node->mParent = parent;			// 设置node结点的父节点
-	if ( parent != nullptr )		// 有父节点则插入为子结点
-		if ( node->mKey < parent->mKey )
-			parent->mLeft = node;
-		else
-			parent->mRight = node;
-	else							// 父节点为空则设为根节点
-		tree = node;
+	if ( parent == nullptr )		// 父节点为空则设为根节点
+		link(tree, parent, tree, node);
+	else if ( node->mKey < parent->mKey )
+		link(tree, parent, parent->mLeft, node);
+	else
+		link(tree, parent, parent->mRight, node);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::link(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* parent, RBTNode<T, Counted, Packed>* &slot, RBTNode<T, Counted, Packed>* node)
+{
+	node->setParent(parent);			// 设置node结点的父节点
+	slot = node;
 
-	node->mColor = RED;				// 设为红色
+	node->setColor(RED);				// 设为红色
 	++mCount;
+	addSize(parent, 1);				// 新结点的祖先子树各多了一个结点
+
+	if ( insertFixUp(tree, node) )	// 只有父节点是红色才需要平衡，但是要注意根节点没有父亲且默认插入的是红色
+		++mBlackHeight;
+	modified();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::insert(const T& key)
+{
+	insert(mRoot, createNode(key));
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::insert(T&& key)
+{
+	insert(mRoot, createNode(std::move(key)));
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename K>
+pair<RBTNode<T, Counted, Packed>*, bool> RBTree<T, Alloc, Counted, Packed, Stats>::tryInsertKey(K&& key)
+{
+	RBTNode<T, Counted, Packed>* parent = nullptr;
+	RBTNode<T, Counted, Packed>** slot = &mRoot;		// 下行时记住要挂新结点的指针，找到空位后不必再比较一次
 
-	insertFixUp(tree, node);		// 只有父节点是红色才需要平衡，但是要注意根节点没有父亲且默认插入的是红色
+	while ( *slot != nullptr )
+	{
+		parent = *slot;
+		if ( key < parent->mKey )
+			slot = &parent->mLeft;
+		else if ( parent->mKey < key )
+			slot = &parent->mRight;
+		else
+			return make_pair(parent, false);
+	}
+
+	RBTNode<T, Counted, Packed>* node = createNode(std::forward<K>(key));	// 确认不存在后才构造结点，key已存在时不会发生复制
+	link(mRoot, parent, *slot, node);
+
+	return make_pair(node, true);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+pair<RBTNode<T, Counted, Packed>*, bool> RBTree<T, Alloc, Counted, Packed, Stats>::tryInsert(const T& key)
+{
+	return tryInsertKey(key);
 }
 
-template <typename T>
-void RBTree<T>::insert(T key)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+pair<RBTNode<T, Counted, Packed>*, bool> RBTree<T, Alloc, Counted, Packed, Stats>::tryInsert(T&& key)
 {
-	RBTNode<T>* node = new RBTNode<T>(RED, key, nullptr, nullptr, nullptr);	// 颜色在重载版本改为红色，此处可任意填写
+	return tryInsertKey(std::move(key));
+}
 
-	insert(mRoot, node);
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename... Args>
+pair<RBTNode<T, Counted, Packed>*, bool> RBTree<T, Alloc, Counted, Packed, Stats>::emplace(Args&&... args)
+{
+	return tryInsertKey(T(std::forward<Args>(args)...));	// 比较需要完整的key，只能先构造；插入时移入结点
 }
 
-template <typename T>
-void RBTree<T>::removeFixUp(RBTNode<T>* &tree, RBTNode<T>* del_child, RBTNode<T>* del_parent)	// 删除修正红黑树(被删除的是黑色)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::removeFixUp(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* del_child, RBTNode<T, Counted, Packed>* del_parent)	// 删除修正红黑树(被删除的是黑色)
 {
-	RBTNode<T>* other;	// child的兄弟（原来的叔伯）
+	RBTNode<T, Counted, Packed>* other;	// child的兄弟（原来的叔伯）
+	bool fixed = false;					// 在旋转中补回了黑色；否则双黑一直上移到根，整棵树黑高减一
 
 	// del_child为假或del_child为黑结点，且del_child不是根节点(del_child如果不是根节点就绝对是nullptr)
-	while ( (!del_child || del_child->mColor==BLACK) && del_child!=tree )	// B黑，R红，p=parent，c=child，o=other，ol=other->left，or=other->right
+	while ( (!del_child || del_child->color()==BLACK) && del_child!=tree )	// B黑，R红，p=parent，c=child，o=other，ol=other->left，or=other->right
 	{
+		mStats.fixUp();
 		if ( del_parent->mLeft == del_child )		// 如果del_child是左结点；注意替换者已经离开了，所以child和parent是父子关系
 		{											// 父亲绝对有两个儿子，因为del_child原先是黑色孙子，所以绝对有一个叔伯（现在是兄弟）
 			other = del_parent->mRight;
-			if ( other->mColor == RED )								// del_child的兄弟是红节点，它的子结点必定全是黑色
+			if ( other->color() == RED )								// del_child的兄弟是红节点，它的子结点必定全是黑色
 			{
-				other->mColor = BLACK;
-				del_parent->mColor = RED;
+				other->setColor(BLACK);
+				del_parent->setColor(RED);
+				mStats.recolor(2);
 				lRotate(tree, del_parent);
 				other = del_parent->mRight;
 			}
 
-			if ( (!other->mLeft || other->mLeft->mColor==BLACK) &&		// del_child兄弟的左结点为假或者为黑，且右结点也为假或者为黑
-				 (!other->mRight || other->mRight->mColor==BLACK) )	// 上面if保证del_child的兄弟也是黑色
+			if ( (!other->mLeft || other->mLeft->color()==BLACK) &&		// del_child兄弟的左结点为假或者为黑，且右结点也为假或者为黑
+				 (!other->mRight || other->mRight->color()==BLACK) )	// 上面if保证del_child的兄弟也是黑色
 			{
-				other->mColor = RED;
+				other->setColor(RED);
+				mStats.recolor();
 				del_child = del_parent;
-				del_parent = del_child->mParent;
+				del_parent = del_child->parent();
 			}
 			else
 			{
-				if ( !other->mRight || other->mRight->mColor==BLACK )		// del_child兄弟是黑色，且该兄弟孩子不全为黑
+				if ( !other->mRight || other->mRight->color()==BLACK )		// del_child兄弟是黑色，且该兄弟孩子不全为黑
 				{
-					other->mLeft->mColor = BLACK;
-					other->mColor = RED;
+					other->mLeft->setColor(BLACK);
+					other->setColor(RED);
+					mStats.recolor(2);
 					rRotate(tree, other);
 					other = del_parent->mRight;
 				}
 
-				other->mColor = del_parent->mColor;
-				del_parent->mColor = BLACK;
-				other->mRight->mColor = BLACK;
+				other->setColor(del_parent->color());
+				del_parent->setColor(BLACK);
+				other->mRight->setColor(BLACK);
+				mStats.recolor(3);
 				lRotate(tree, del_parent);
 				del_child = tree;
+				fixed = true;
 				break;
 			}
 		}
 		else										// 如果del_child是右结点
 		{
 			other = del_parent->mLeft;
-			if ( other->mColor == RED )
+			if ( other->color() == RED )
 			{
-				other->mColor = BLACK;
-				del_parent->mColor = RED;
+				other->setColor(BLACK);
+				del_parent->setColor(RED);
+				mStats.recolor(2);
 				rRotate(tree, del_parent);
 				other = del_parent->mLeft;
 			}
 
-			if ( (!other->mLeft || other->mLeft->mColor==BLACK) &&
-				 (!other->mRight || other->mRight->mColor==BLACK) )
+			if ( (!other->mLeft || other->mLeft->color()==BLACK) &&
+				 (!other->mRight || other->mRight->color()==BLACK) )
 			{
-				other->mColor = RED;
+				other->setColor(RED);
+				mStats.recolor();
 				del_child = del_parent;
-				del_parent = del_child->mParent;
+				del_parent = del_child->parent();
 			}
 			else
 			{
-				if ( !other->mLeft || other->mLeft->mColor==BLACK )
+				if ( !other->mLeft || other->mLeft->color()==BLACK )
 				{
-					other->mRight->mColor = BLACK;
-					other->mColor = RED;
+					other->mRight->setColor(BLACK);
+					other->setColor(RED);
+					mStats.recolor(2);
 					lRotate(tree, other);
 					other = del_parent->mLeft;
 				}
 
-				other->mColor = del_parent->mColor;
-				del_parent->mColor = BLACK;
-				other->mLeft->mColor = BLACK;
+				other->setColor(del_parent->color());
+				del_parent->setColor(BLACK);
+				other->mLeft->setColor(BLACK);
+				mStats.recolor(3);
 				rRotate(tree, del_parent);
 				del_child = tree;					// 也可以改成 tree->color = BLACK;
+				fixed = true;
 				break;
 			}
 		}
 	}
 
-	if ( del_child != nullptr )					// del_child如果存在且是红色，或者是根节点
-		del_child->mColor = BLACK;
+	bool ret = !fixed && del_child == tree && (del_child == nullptr || del_child->color() == BLACK);	// 红色的del_child染黑即可补回
+
+	if ( del_child != nullptr && del_child->color() == RED )	// del_child如果存在且是红色，或者是根节点
+	{
+		del_child->setColor(BLACK);
+		mStats.recolor();
+	}
+
+	return ret;
 }
 
-template <typename T>
-void RBTree<T>::remove(RBTNode<T>* &tree, RBTNode<T>* del)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::remove(RBTNode<T, Counted, Packed>* &tree, RBTNode<T, Counted, Packed>* del)
 {
-	RBTNode<T> *child, *parent;
+	RBTNode<T, Counted, Packed> *child, *parent;
 	RBTColor color;
 
 	if ( del->mLeft!=nullptr && del->mRight!=nullptr )		// 如果删除结点有两个孩子，需要找一个替换者
 	{
-		RBTNode<T>* replace = del->mRight;			// 替换者指向右结点最小者；也可以指向左结点的最大者
+		RBTNode<T, Counted, Packed>* replace = del->mRight;			// 替换者指向右结点最小者；也可以指向左结点的最大者
 		while ( replace->mLeft != nullptr )
 			replace = replace->mLeft;
 
-		if ( del->mParent != nullptr )				// 更新父结点指向替换者
+		if ( del->parent() != nullptr )				// 更新父结点指向替换者
 		{
-			if ( del->mParent->mLeft == del )
-				del->mParent->mLeft = replace;
+			if ( del->parent()->mLeft == del )
+				del->parent()->mLeft = replace;
 			else
-				del->mParent->mRight = replace;
+				del->parent()->mRight = replace;
 		}
 		else
 			tree = replace;
 
 		child = replace->mRight;						// 保存替换者的子结点、父结点、颜色
-		parent = replace->mParent;
-		color = replace->mColor;
+		parent = replace->parent();
+		color = replace->color();
 
 		if ( del == parent )						// 删除的是替换者的父结点（这时替换者就是del的右结点，因为替换者没有左结点，所以del的右结点最小）
 			parent = replace;
 		else
 		{
 			if ( child != nullptr )
-				child->mParent = parent;
+				child->setParent(parent);
 			parent->mLeft = child;					// 替换者的父亲接管替换者的儿子（此时替换者只有右儿子，因为自己是右子树的最左下者）
 
 			replace->mRight = del->mRight;			// 更新替换者和被删除者右儿子的关系（因为替换者位于右子树）
-			del->mRight->mParent = replace;
+			del->mRight->setParent(replace);
 		}
 
-		replace->mParent = del->mParent;				// 更新替换者的父亲、颜色、以及与被删除者左结点的关系
-		replace->mColor = del->mColor;
+		replace->setParent(del->parent());				// 更新替换者的父亲、颜色、以及与被删除者左结点的关系
+		replace->setColor(del->color());
+		if constexpr ( Counted )
+			replace->mSize = del->mSize;				// 替换者接管被删除者的位置，下面再沿parent向上减一
 		replace->mLeft = del->mLeft;
-		del->mLeft->mParent = replace;
+		del->mLeft->setParent(replace);
 	}
 	else													// 删除结点孩子不足两个，独子或者叶节点就是替换者
 	{
@@ -620,11 +1458,11 @@ void RBTree<T>::remove(RBTNode<T>* &tree, RBTNode<T>* del)
 			child = del->mLeft;
 		else
 			child = del->mRight;
-		parent = del->mParent;
-		color = del->mColor;
+		parent = del->parent();
+		color = del->color();
 
 		if ( child != nullptr )						// 更新 '被删除结点的父节点' 和 '被删除结点的子结点' 的关系
-			child->mParent = parent;					// 父亲（也就是被删除结点）被删除，所以爷爷直接和唯一一个孙子互相更新关系即可
+			child->setParent(parent);					// 父亲（也就是被删除结点）被删除，所以爷爷直接和唯一一个孙子互相更新关系即可
 		if ( parent != nullptr )
 		{
 			if ( parent->mLeft == del )
@@ -637,19 +1475,23 @@ void RBTree<T>::remove(RBTNode<T>* &tree, RBTNode<T>* del)
 	}
 
 	--mCount;									// 结点计数减一
+	addSize(parent, -1);						// parent是实际被摘除位置的父亲，它到根的路径上子树都少了一个结点
 
 	if ( color == BLACK )						// 如果替换者或被删除者是黑色需要重新平衡（被删除者有两个儿子则是替换者），因为删除了一个黑结点
-		removeFixUp(tree, child, parent);		// child如果不是根节点或红色节点，那它绝对是nullptr指针（替换者至多有一个红色儿子，且该儿子没有后代）
+		if ( removeFixUp(tree, child, parent) )	// child如果不是根节点或红色节点，那它绝对是nullptr指针（替换者至多有一个红色儿子，且该儿子没有后代）
+			--mBlackHeight;
+	modified();
 
-	delete del;									// 删除节点并返回
+	destroyNode(del);							// 删除节点并返回
 	del = nullptr;
 }
 
-template <typename T>
-bool RBTree<T>::remove(T key)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::remove(T key)
 {
 	bool ret = false;
-	RBTNode<T>* node = search(mRoot, key);
+	mStats.search();
+	RBTNode<T, Counted, Packed>* node = search(mRoot, key);
 
 	if ( node != nullptr )
 	{
@@ -660,8 +1502,610 @@ bool RBTree<T>::remove(T key)
 	return ret;
 }
 
-template <typename T>
-void RBTree<T>::printTree(RBTNode<T> const* const tree, bool firstNode) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::erase(RBTNode<T, Counted, Packed>* node)
+{
+	if ( node != nullptr )
+		remove(mRoot, node);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+typename RBTree<T, Alloc, Counted, Packed, Stats>::iterator RBTree<T, Alloc, Counted, Packed, Stats>::erase(iterator it)
+{
+	iterator next = it;
+	++next;							// remove()只改指针不搬key，后继结点在删除后依然有效
+
+	erase(it.node());
+
+	return next;
+}
+
+/*	按lo和hi两次分割出[lo, hi)这段子树，整段释放后把两边join回去
+ *	分割和合并都是O(log(n))，释放k个结点O(k)，不必对每个结点做一次查找和删除修正
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::eraseRange(const T& lo, const T& hi)
+{
+	if ( !(lo < hi) || mRoot == nullptr )
+		return 0ull;
+
+	RBTNode<T, Counted, Packed> *left, *rest, *mid, *right;
+	uint16_t hl, hr, hm, bh;
+	split(mRoot, mBlackHeight, lo, left, hl, rest, hr);
+	split(rest, hr, hi, mid, hm, right, hr);
+	mRoot = nullptr;
+
+	uint64_t ret = destroy(mid);
+	mCount -= ret;
+
+	mRoot = join(left, hl, right, hr, bh);
+	if ( mRoot != nullptr )					// 分割出来的子树根可能是红色
+		mRoot->setColor(BLACK);
+	reshaped();
+
+	return ret;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint16_t RBTree<T, Alloc, Counted, Packed, Stats>::blackHeight(RBTNode<T, Counted, Packed>* tree)
+{
+	uint16_t ret = 0;
+
+	for ( ; tree != nullptr; tree = tree->mLeft )
+		if ( tree->color() == BLACK )
+			++ret;
+
+	return ret;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::detach(RBTNode<T, Counted, Packed>* node, RBTNode<T, Counted, Packed>* &left, RBTNode<T, Counted, Packed>* &right)	// 把结点从子树中摘出来，左右孩子成为独立的子树
+{
+	left = node->mLeft;
+	right = node->mRight;
+	if ( left != nullptr )
+		left->setParent(nullptr);
+	if ( right != nullptr )
+		right->setParent(nullptr);
+
+	node->mLeft = nullptr;
+	node->mRight = nullptr;
+	node->setParent(nullptr);
+	updateSize(node);
+}
+
+/*	连接：left < node < right，三者合并成一棵红黑树，O(|黑高差|+1)；bl、br由调用者给出，不再沿路径统计
+ *	两边根结点先染黑（仍是合法红黑树，红根染黑后黑高加一）；黑高较大的一边沿着靠近另一边的路径向下，找到黑高相等的黑结点c，
+ *	node染红后替换c的位置，c和另一棵树分别成为node的孩子，此时只可能出现红红冲突，交给insertFixUp()处理
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::join(RBTNode<T, Counted, Packed>* left, uint16_t bl, RBTNode<T, Counted, Packed>* node, RBTNode<T, Counted, Packed>* right, uint16_t br, uint16_t& bh)
+{
+	if ( left != nullptr && left->color() == RED )
+	{
+		left->setColor(BLACK);
+		++bl;
+	}
+	if ( right != nullptr && right->color() == RED )
+	{
+		right->setColor(BLACK);
+		++br;
+	}
+
+	RBTNode<T, Counted, Packed>* tree;
+	RBTNode<T, Counted, Packed>* parent = nullptr;
+	RBTNode<T, Counted, Packed>* cur;
+	uint16_t h;
+
+	if ( bl == br )										// 黑高相等，node直接做根
+	{
+		node->mLeft = left;
+		node->mRight = right;
+		node->setParent(nullptr);
+		node->setColor(BLACK);
+		if ( left != nullptr )
+			left->setParent(node);
+		if ( right != nullptr )
+			right->setParent(node);
+		updateSize(node);
+		bh = static_cast<uint16_t>(bl + 1);
+
+		return node;
+	}
+
+	if ( bl > br )										// 沿left的最右路径向下
+	{
+		tree = left;
+		for ( cur = left, h = bl; cur!=nullptr && !(cur->color()==BLACK && h==br); cur = cur->mRight )
+		{
+			if ( cur->color() == BLACK )
+				--h;
+			parent = cur;
+		}
+
+		node->mLeft = cur;
+		node->mRight = right;
+		parent->mRight = node;
+		addSize(parent, static_cast<int64_t>(size(right)+1));
+	}
+	else												// 沿right的最左路径向下
+	{
+		tree = right;
+		for ( cur = right, h = br; cur!=nullptr && !(cur->color()==BLACK && h==bl); cur = cur->mLeft )
+		{
+			if ( cur->color() == BLACK )
+				--h;
+			parent = cur;
+		}
+
+		node->mLeft = left;
+		node->mRight = cur;
+		parent->mLeft = node;
+		addSize(parent, static_cast<int64_t>(size(left)+1));
+	}
+
+	node->setParent(parent);
+	node->setColor(RED);
+	if ( node->mLeft != nullptr )
+		node->mLeft->setParent(node);
+	if ( node->mRight != nullptr )
+		node->mRight->setParent(node);
+	updateSize(node);
+
+	bh = max(bl, br);
+	if ( insertFixUp(tree, node) )						// 红色一路上推到根，根重新染黑，黑高加一
+		++bh;
+
+	return tree;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::join(RBTNode<T, Counted, Packed>* left, uint16_t bl, RBTNode<T, Counted, Packed>* right, uint16_t br, uint16_t& bh)	// 没有中间结点时取left的最大结点做中间结点
+{
+	if ( left == nullptr )
+	{
+		bh = br;
+		return right;
+	}
+	if ( right == nullptr )
+	{
+		bh = bl;
+		return left;
+	}
+
+	RBTNode<T, Counted, Packed> *rest, *last;
+	uint16_t hr;
+	splitLast(left, bl, rest, hr, last);
+
+	return join(rest, hr, last, right, br, bh);
+}
+
+/*	分割：小于key的结点组成left，大于key的组成right，等于key的结点单独放在found（没有则为nullptr）
+ *	left和right的根可能是红色，作为整棵树使用前要染黑
+ *	沿查找路径向下递归，回溯时把路径结点连同另一侧子树join起来；各次join的黑高差之和不超过树高，总开销O(log(n))
+ *	th是tree的黑高，孩子的黑高由它减去tree自身得到，每层O(1)；bl、br返回两边的黑高
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::split(RBTNode<T, Counted, Packed>* tree, uint16_t th, const T& key, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &found, RBTNode<T, Counted, Packed>* &right, uint16_t& br)
+{
+	if ( tree == nullptr )
+	{
+		left = found = right = nullptr;
+		bl = br = 0;
+		return;
+	}
+
+	RBTNode<T, Counted, Packed> *l, *r, *tmp;
+	uint16_t hc = static_cast<uint16_t>(th - (tree->color() == BLACK ? 1 : 0));	// 两个孩子的黑高
+	uint16_t ht;
+	detach(tree, l, r);
+
+	if ( key < tree->mKey )
+	{
+		split(l, hc, key, left, bl, found, tmp, ht);
+		right = join(tmp, ht, tree, r, hc, br);
+	}
+	else if ( tree->mKey < key )
+	{
+		split(r, hc, key, tmp, ht, found, right, br);
+		left = join(l, hc, tree, tmp, ht, bl);
+	}
+	else
+	{
+		left = l;
+		found = tree;
+		right = r;
+		bl = br = hc;
+	}
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::split(RBTNode<T, Counted, Packed>* tree, uint16_t th, const T& key, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &right, uint16_t& br)
+{
+	if ( tree == nullptr )
+	{
+		left = right = nullptr;
+		bl = br = 0;
+		return;
+	}
+
+	RBTNode<T, Counted, Packed> *l, *r, *tmp;
+	uint16_t hc = static_cast<uint16_t>(th - (tree->color() == BLACK ? 1 : 0));
+	uint16_t ht;
+	detach(tree, l, r);
+
+	if ( tree->mKey < key )
+	{
+		split(r, hc, key, tmp, ht, right, br);
+		left = join(l, hc, tree, tmp, ht, bl);
+	}
+	else							// 等于key时也往左找，重复的key全部分到right
+	{
+		split(l, hc, key, left, bl, tmp, ht);
+		right = join(tmp, ht, tree, r, hc, br);
+	}
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::splitLast(RBTNode<T, Counted, Packed>* tree, uint16_t th, RBTNode<T, Counted, Packed>* &rest, uint16_t& bh, RBTNode<T, Counted, Packed>* &last)	// 摘出最大结点
+{
+	RBTNode<T, Counted, Packed> *l, *r, *tmp;
+	uint16_t hc = static_cast<uint16_t>(th - (tree->color() == BLACK ? 1 : 0));
+	uint16_t ht;
+	detach(tree, l, r);
+
+	if ( r == nullptr )
+	{
+		rest = l;
+		bh = hc;
+		last = tree;
+	}
+	else
+	{
+		splitLast(r, hc, tmp, ht, last);
+		rest = join(l, hc, tree, tmp, ht, bh);
+	}
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint16_t RBTree<T, Alloc, Counted, Packed, Stats>::forkBudget()		// 递归中允许开新线程的层数，每层线程数翻倍
+{
+	unsigned threads = thread::hardware_concurrency();
+	uint16_t ret = 0;
+
+	while ( (1u<<ret) < threads )
+		++ret;
+
+	return ret + 1;
+}
+
+/*	并行执行两个互不相交的子问题：(a1, b1)交给新线程，(a2, b2)在当前线程
+ *	子问题只在各自的子树内旋转，被丢弃的结点先收集起来，全部完成后由调用线程统一释放，所以不需要加锁；统计计数同理
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::fork(SetOp op, RBTNode<T, Counted, Packed>* a1, uint16_t ha1, RBTNode<T, Counted, Packed>* b1, uint16_t hb1, RBTNode<T, Counted, Packed>* a2, uint16_t ha2, RBTNode<T, Counted, Packed>* b2, uint16_t hb2,
+	vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, RBTNode<T, Counted, Packed>* &left, uint16_t& bl, RBTNode<T, Counted, Packed>* &right, uint16_t& br)
+{
+	if ( forks > 0 && (ha1 >= FORK_BLACK_HEIGHT || hb1 >= FORK_BLACK_HEIGHT) )
+	{
+		vector<RBTNode<T, Counted, Packed>*> tmp;
+		Stats stats;								// 新线程的统计也单独收集，完成后合并
+		future<RBTNode<T, Counted, Packed>*> f = async(launch::async, [this, op, a1, ha1, b1, hb1, &tmp, &stats, forks, &bl]
+		{
+			typename Stats::Task task(stats);
+			return (this->*op)(a1, ha1, b1, hb1, tmp, static_cast<uint16_t>(forks-1), bl);
+		});
+
+		right = (this->*op)(a2, ha2, b2, hb2, discard, forks-1, br);
+		left = f.get();
+		discard.insert(discard.end(), tmp.begin(), tmp.end());
+		mStats.merge(stats);
+	}
+	else
+	{
+		left = (this->*op)(a1, ha1, b1, hb1, discard, forks, bl);
+		right = (this->*op)(a2, ha2, b2, hb2, discard, forks, br);
+	}
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::unite(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh)
+{
+	if ( a == nullptr )
+	{
+		bh = hb;
+		return b;
+	}
+	if ( b == nullptr )
+	{
+		bh = ha;
+		return a;
+	}
+
+	RBTNode<T, Counted, Packed> *al, *ar, *bl, *br, *dup, *l, *r;
+	uint16_t hc = static_cast<uint16_t>(ha - (a->color() == BLACK ? 1 : 0));
+	uint16_t hbl, hbr, hl, hr;
+	detach(a, al, ar);
+	split(b, hb, a->mKey, bl, hbl, dup, br, hbr);			// 用a的根分割b
+	if ( dup != nullptr )
+		discard.push_back(dup);
+
+	fork(&RBTree::unite, al, hc, bl, hbl, ar, hc, br, hbr, discard, forks, l, hl, r, hr);
+
+	return join(l, hl, a, r, hr, bh);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::intersect(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh)
+{
+	if ( a == nullptr || b == nullptr )
+	{
+		if ( a != nullptr )
+			discard.push_back(a);
+		if ( b != nullptr )
+			discard.push_back(b);
+		bh = 0;
+		return nullptr;
+	}
+
+	RBTNode<T, Counted, Packed> *al, *ar, *bl, *br, *dup, *l, *r;
+	uint16_t hc = static_cast<uint16_t>(ha - (a->color() == BLACK ? 1 : 0));
+	uint16_t hbl, hbr, hl, hr;
+	detach(a, al, ar);
+	split(b, hb, a->mKey, bl, hbl, dup, br, hbr);
+
+	fork(&RBTree::intersect, al, hc, bl, hbl, ar, hc, br, hbr, discard, forks, l, hl, r, hr);
+
+	if ( dup != nullptr )					// 两边都有，保留a的结点
+	{
+		discard.push_back(dup);
+		return join(l, hl, a, r, hr, bh);
+	}
+
+	discard.push_back(a);
+	return join(l, hl, r, hr, bh);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::subtract(RBTNode<T, Counted, Packed>* a, uint16_t ha, RBTNode<T, Counted, Packed>* b, uint16_t hb, vector<RBTNode<T, Counted, Packed>*>& discard, uint16_t forks, uint16_t& bh)	// a - b
+{
+	if ( a == nullptr || b == nullptr )
+	{
+		if ( b != nullptr )
+			discard.push_back(b);
+		bh = ha;
+		return a;
+	}
+
+	RBTNode<T, Counted, Packed> *al, *ar, *bl, *br, *found, *l, *r;
+	uint16_t hc = static_cast<uint16_t>(hb - (b->color() == BLACK ? 1 : 0));
+	uint16_t hal, har, hl, hr;
+	detach(b, bl, br);
+	split(a, ha, b->mKey, al, hal, found, ar, har);		// 用b的根分割a，a中相同的结点被删除
+	discard.push_back(b);
+	if ( found != nullptr )
+		discard.push_back(found);
+
+	fork(&RBTree::subtract, al, hal, bl, hc, ar, har, br, hc, discard, forks, l, hl, r, hr);
+
+	return join(l, hl, r, hr, bh);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::adopt(RBTree& other)
+{
+	if ( mAlloc.shares(other.mAlloc) )
+		return;
+
+	vector<T> keys(other.begin(), other.end());	// 内存池不同，只能按顺序复制一遍，O(n)且在调用线程串行完成，会抵消集合运算的并行；两树先sharePool()即可避免
+	other.destroy();
+	other.mAlloc = mAlloc;
+	other.buildFromSorted(keys.begin(), keys.end());
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::sharePool(const RBTree& other)
+{
+	if ( &other == this )
+		return;
+
+	destroy();
+	mAlloc = other.mAlloc;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::setOperation(RBTree& other, SetOp op)
+{
+	adopt(other);
+
+	RBTNode<T, Counted, Packed>* a = mRoot;
+	RBTNode<T, Counted, Packed>* b = other.mRoot;
+	uint64_t total = mCount + other.mCount;
+	uint16_t ha = mBlackHeight, hb = other.mBlackHeight, bh;
+	mRoot = other.mRoot = nullptr;
+	mCount = other.mCount = 0ull;
+	other.reshaped();
+
+	vector<RBTNode<T, Counted, Packed>*> discard;
+	mRoot = (this->*op)(a, ha, b, hb, discard, forkBudget(), bh);
+	if ( mRoot != nullptr )					// 递归可能直接返回某棵子树，它的根可能是红色
+		mRoot->setColor(BLACK);
+
+	for ( RBTNode<T, Counted, Packed>* tree : discard )
+		total -= destroy(tree);
+	mCount = total;
+	reshaped();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::split(const T& key, RBTree& left, RBTree& right)
+{
+	RBTNode<T, Counted, Packed>* tree = mRoot;
+	uint64_t count = mCount;
+	uint16_t height = mBlackHeight;
+	Alloc<RBTNode<T, Counted, Packed>> alloc = mAlloc;				// 持有内存池，下面清空left和right时不会把它释放掉
+	mRoot = nullptr;
+	mCount = 0ull;
+	reshaped();
+
+	left.destroy();
+	right.destroy();
+	left.mAlloc = alloc;
+	right.mAlloc = alloc;
+
+	RBTNode<T, Counted, Packed> *l, *r;
+	uint16_t hl, hr;
+	split(tree, height, key, l, hl, r, hr);
+	if ( l != nullptr )						// 分割出来的子树根可能是红色
+		l->setColor(BLACK);
+	if ( r != nullptr )
+		r->setColor(BLACK);
+
+	left.mRoot = l;
+	right.mRoot = r;
+	left.mCount = Counted ? size(l) : countNodes(l);	// 未开启Counted只能数一遍，O(n)
+	right.mCount = count - left.mCount;
+	left.reshaped();
+	right.reshaped();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::join(RBTree& left, const T& key, RBTree& right)
+{
+	left.adopt(right);
+
+	RBTNode<T, Counted, Packed>* l = left.mRoot;
+	RBTNode<T, Counted, Packed>* r = right.mRoot;
+	uint64_t count = left.mCount + right.mCount + 1;
+	uint16_t hl = left.mBlackHeight, hr = right.mBlackHeight, bh;
+	Alloc<RBTNode<T, Counted, Packed>> alloc = left.mAlloc;
+	left.mRoot = right.mRoot = nullptr;
+	left.mCount = right.mCount = 0ull;
+	left.reshaped();
+	right.reshaped();
+
+	destroy();								// 本树可能就是left或right，此时已经是空树
+	mAlloc = alloc;
+	mRoot = join(l, hl, createNode(key), r, hr, bh);
+	mCount = count;
+	reshaped();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::setUnion(RBTree& other)
+{
+	if ( &other != this )
+		setOperation(other, &RBTree::unite);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::setIntersection(RBTree& other)
+{
+	if ( &other != this )
+		setOperation(other, &RBTree::intersect);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::setDifference(RBTree& other)
+{
+	if ( &other != this )
+		setOperation(other, &RBTree::subtract);
+	else
+		destroy();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::countNodes(RBTNode<T, Counted, Packed> const* tree) const
+{
+	if ( tree == nullptr )
+		return 0;
+
+	return countNodes(tree->mLeft) + countNodes(tree->mRight) + 1;
+}
+
+/*	按中序顺序从升序序列依次取出key构建结点，左右子树结点数至多相差1，所以除最底层外每层都是满的
+ *	满层的结点全部染成黑色，最底层（不满的那层）染成红色，这样每条路径的黑色结点数都相同，且红色结点没有子结点
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename Iterator>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::buildFromSorted(Iterator& it, uint64_t n, uint16_t depth, uint16_t redDepth, RBTNode<T, Counted, Packed>* parent)
+{
+	if ( n == 0 )
+		return nullptr;
+
+	uint64_t leftCount = (n-1)/2;				// 右子树多分一个结点
+
+	RBTNode<T, Counted, Packed>* left = buildFromSorted(it, leftCount, depth+1, redDepth, nullptr);
+	RBTNode<T, Counted, Packed>* node = createNode(*it);
+	++it;
+	node->setColor((depth == redDepth) ? RED : BLACK);
+	node->setParent(parent);
+
+	node->mLeft = left;
+	if ( left != nullptr )
+		left->setParent(node);
+
+	node->mRight = buildFromSorted(it, n-1-leftCount, depth+1, redDepth, node);
+	updateSize(node);
+
+	return node;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename Iterator>
+void RBTree<T, Alloc, Counted, Packed, Stats>::buildFromSorted(Iterator first, Iterator last)
+{
+	destroy();
+
+	uint64_t n = static_cast<uint64_t>(distance(first, last));
+	uint16_t redDepth = 0;					// 满层的层数，即第一个不满的层（从0开始计数）
+	while ( redDepth < 64 && ((1ull<<(redDepth+1))-1ull) <= n )
+		++redDepth;
+
+	mRoot = buildFromSorted(first, n, 0, redDepth, nullptr);
+	mCount = n;
+	reshaped();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename Iterator>
+void RBTree<T, Alloc, Counted, Packed, Stats>::buildFromUnsorted(Iterator first, Iterator last)
+{
+	vector<T> keys(first, last);
+	sort(keys.begin(), keys.end());
+
+	buildFromSorted(keys.begin(), keys.end());
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::save(const char* path) const
+{
+	static_assert(is_trivially_copyable<T>::value, "snapshots store keys byte by byte");
+
+	TreeWriter writer(path, TreeWriter::BINARY);
+	TreeSnapshotHeader header = TreeSnapshotHeader::make<T>(mCount);
+	writer.putBytes(&header, sizeof(header));
+
+	return writer.good() && exportKeys(writer) && writer.commit();	// 写到path.tmp，fsync后替换，崩溃时旧快照仍然完整
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::load(const char* path)
+{
+	static_assert(is_trivially_copyable<T>::value, "snapshots store keys byte by byte");
+
+	TreeSnapshot snapshot(path);
+	T const* keys = snapshot.keys<T>();
+	if ( keys == nullptr || !is_sorted(keys, keys+snapshot.getCount()) )	// 顺序扫描一遍，损坏的文件不能交给buildFromSorted()
+		return false;
+
+	buildFromSorted(keys, keys+snapshot.getCount());
+
+	return true;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::printTree(RBTNode<T, Counted, Packed> const* const tree, bool firstNode) const
 {
 	if ( tree==nullptr )
 		return;
@@ -680,7 +2124,7 @@ void RBTree<T>::printTree(RBTNode<T> const* const tree, bool firstNode) const
 				cout << "        ";
 		cout << "+-------" << flush;
 	}
-	cout << tree->mKey << ' ' << (tree->mColor==BLACK ? 'B' : 'R') << endl;
+	cout << tree->mKey << ' ' << (tree->color()==BLACK ? 'B' : 'R') << endl;
 
 	for ( i=2-1; i>0; --i)		// 从右往左输出结点，即先打印最右边结点，其次次右边的结点；此循环不输出最左边的结点
 	{
@@ -699,74 +2143,294 @@ void RBTree<T>::printTree(RBTNode<T> const* const tree, bool firstNode) const
 	--layer;
 }
 
-template <typename T>
-void RBTree<T>::printTree() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::exportKeys(TreeWriter& writer) const
+{
+	forEachInOrder([&writer](const T& key) { writer.put(key); });
+
+	return writer.flush();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::exportKeys(int fd, TreeWriter::Format format) const
+{
+	TreeWriter writer(fd, format);
+
+	return exportKeys(writer);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::exportKeys(const char* path, TreeWriter::Format format) const
+{
+	TreeWriter writer(path, format);
+
+	return writer.good() && exportKeys(writer) && writer.commit();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::printTree() const
 {
 	printTree(mRoot, true);	// 右边参数此时无意义
 }
 
-template <typename T>
-void RBTree<T>::destroy(RBTNode<T>* &tree)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+template <typename K>
+RBTNode<T, Counted, Packed>* RBTree<T, Alloc, Counted, Packed, Stats>::createNode(K&& key)
+{
+	return new (mAlloc.allocate()) RBTNode<T, Counted, Packed>(RED, T(std::forward<K>(key)), nullptr, nullptr, nullptr);	// 颜色在insert()中改为红色，此处可任意填写
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::destroyNode(RBTNode<T, Counted, Packed>* node)
+{
+	node->~RBTNode();
+	mAlloc.deallocate(node);
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::destroy(RBTNode<T, Counted, Packed>* &tree)
 {
 	if ( tree == nullptr )
-		return;
+		return 0;
 
+	uint64_t ret = 1;
 	if ( tree->mLeft != nullptr )
-		destroy(tree->mLeft);
+		ret += destroy(tree->mLeft);
 	if ( tree->mRight != nullptr )
-		destroy(tree->mRight);
+		ret += destroy(tree->mRight);
 
-	delete tree;
+	destroyNode(tree);
+
+	return ret;
 }
 
-template <typename T>
-void RBTree<T>::destroy()
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::destroy()
 {
-	destroy(mRoot);
+	if ( Alloc<RBTNode<T, Counted, Packed>>::canRelease && is_trivially_destructible<T>::value && mAlloc.unique() )
+		mAlloc.release();		// 结点无需析构且内存池不与其它树共享，整块归还内存即可，不必遍历
+	else
+	{
+		destroy(mRoot);
+		mAlloc.release();
+	}
 
 	mRoot = nullptr;
 	mCount = 0ull;
-	mHeight = 0;
+	reshaped();
 }
 
-template <typename T>
-uint64_t RBTree<T>::getCount() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint64_t RBTree<T, Alloc, Counted, Packed, Stats>::getCount() const
 {
 	return mCount;
 }
 
-template <typename T>
-uint16_t RBTree<T>::updateHeight(RBTNode<T> *node)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+TreeStats RBTree<T, Alloc, Counted, Packed, Stats>::stats() const
 {
-	if ( node == nullptr )
-		return 0;
+	return mStats.snapshot();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::resetStats()
+{
+	mStats.reset();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::attachMetrics(const string& name, TreeMetricsRegistry& registry)
+{
+	mMetrics = registry.add(name, "rb");
+	publishMetrics();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::publishMetrics() const	// 只用增量维护的值，高度取黑高给出的上界，不做getHeight(true)那样的遍历
+{
+	if ( mMetrics == nullptr )
+		return;
 
-	return max(updateHeight(node->mLeft), updateHeight(node->mRight))+1;
+	mMetrics->publish(mCount, getHeightBound(), mBlackHeight, mCount*sizeof(RBTNode<T, Counted, Packed>),
+					  mAlloc.reservedBytes(mCount), mStats.snapshot());
 }
 
-template <typename T>
-uint16_t RBTree<T>::getHeight(bool update)
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::updateDepths() const
 {
-	if ( update == true )
-		mHeight = updateHeight(mRoot);
+	mDepths.clear();
+
+	vector<pair<RBTNode<T, Counted, Packed>*, uint16_t>> stack;
+	if ( mRoot != nullptr )
+		stack.emplace_back(mRoot, 0);
+
+	while ( !stack.empty() )
+	{
+		RBTNode<T, Counted, Packed>* node = stack.back().first;
+		uint16_t depth = stack.back().second;
+		stack.pop_back();
+
+		if ( depth >= mDepths.size() )
+			mDepths.resize(depth+1, 0ull);
+		++mDepths[depth];
+
+		if ( node->mRight != nullptr )
+			stack.emplace_back(node->mRight, depth+1);
+		if ( node->mLeft != nullptr )
+			stack.emplace_back(node->mLeft, depth+1);
+	}
+
+	mHeight = static_cast<uint16_t>(mDepths.size());
+	mDepthsVersion = mVersion;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::reshaped()
+{
+	mBlackHeight = blackHeight(mRoot);
+	modified();
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+void RBTree<T, Alloc, Counted, Packed, Stats>::modified()
+{
+	++mVersion;
+	if ( mMetrics != nullptr )
+		publishMetrics();
+
+#if RBTREE_VALIDATE_INTERVAL > 0
+	char const* reason = nullptr;
+	if ( mVersion % RBTREE_VALIDATE_INTERVAL == 0 && !validate(&reason) )
+	{
+		cerr << "红黑树校验失败（第" << mVersion << "次修改后）：" << reason << endl;
+		abort();
+	}
+#endif
+}
+
+/*	中序遍历，栈里只保存当前结点左侧路径上的祖先及其黑色结点数，深度不超过树高
+ *	每个结点只做局部检查：父子指针互相对应、红色结点没有红孩子、顺序统计的子树大小，
+ *	遇到空孩子时比较路径黑色结点数与mBlackHeight，中序相邻的key不能逆序，访问的结点数不能超过mCount（同时防止有环时死循环）
+ */
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::validate(char const** reason) const
+{
+	char const* tmp;
+	char const*& ret = (reason != nullptr) ? *reason : tmp;
+	ret = nullptr;
+
+	if ( mRoot == nullptr )
+	{
+		if ( mCount != 0 || mBlackHeight != 0 )
+			ret = "空树的结点数或黑高不为0";
+		return ret == nullptr;
+	}
+	if ( mRoot->parent() != nullptr )
+		ret = "根结点的父指针不为空";
+	else if ( mRoot->color() != BLACK )
+		ret = "根结点不是黑色";
+	if ( ret != nullptr )
+		return false;
+
+	vector<pair<RBTNode<T, Counted, Packed>*, uint16_t>> stack;
+	RBTNode<T, Counted, Packed>* node = mRoot;
+	RBTNode<T, Counted, Packed>* prev = nullptr;
+	uint16_t blacks = 0;						// 根到node的父亲路径上的黑色结点数
+	uint64_t count = 0;
+
+	while ( node != nullptr || !stack.empty() )
+	{
+		for ( ; node != nullptr; node = node->mLeft )
+		{
+			if ( ++count > mCount )
+			{
+				ret = "结点数多于记录的结点数，或者存在环";
+				return false;
+			}
+
+			blacks += (node->color() == BLACK);
+			for ( RBTNode<T, Counted, Packed>* child : { node->mLeft, node->mRight } )
+			{
+				if ( child == nullptr )
+				{
+					if ( blacks != mBlackHeight )
+						ret = "路径上的黑色结点数与黑高不同";
+				}
+				else if ( child->parent() != node )
+					ret = "孩子的父指针没有指向父结点";
+				else if ( node->color() == RED && child->color() == RED )
+					ret = "红色结点有红色孩子";
+			}
+			if constexpr ( Counted )
+				if ( node->mSize != 1 + size(node->mLeft) + size(node->mRight) )
+					ret = "子树结点数错误";
+			if ( ret != nullptr )
+				return false;
+
+			stack.emplace_back(node, blacks);
+		}
+
+		node = stack.back().first;
+		blacks = stack.back().second;
+		stack.pop_back();
+
+		if ( prev != nullptr && node->mKey < prev->mKey )
+		{
+			ret = "中序遍历的key没有按升序排列";
+			return false;
+		}
+		prev = node;
+
+		node = node->mRight;					// 右子树从node的黑色结点数继续累加
+	}
+
+	if ( count != mCount )
+		ret = "结点数少于记录的结点数";
+
+	return ret == nullptr;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint16_t RBTree<T, Alloc, Counted, Packed, Stats>::getHeight(bool exact) const
+{
+	if ( !exact )
+		return getHeightBound();
+
+	if ( mDepthsVersion != mVersion )
+		updateDepths();
 
 	return mHeight;
 }
 
-template <typename T>
-uint16_t RBTree<T>::max(uint16_t left, uint16_t right) const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint16_t RBTree<T, Alloc, Counted, Packed, Stats>::getBlackHeight() const
 {
-	return (left > right) ? left : right;
+	return mBlackHeight;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+uint16_t RBTree<T, Alloc, Counted, Packed, Stats>::getHeightBound() const
+{
+	return 2*mBlackHeight;
+}
+
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+vector<uint64_t> const& RBTree<T, Alloc, Counted, Packed, Stats>::getDepthHistogram() const
+{
+	if ( mDepthsVersion != mVersion )
+		updateDepths();
+
+	return mDepths;
 }
 
-template <typename T>
-bool RBTree<T>::rootIsNullptr() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+bool RBTree<T, Alloc, Counted, Packed, Stats>::rootIsNullptr() const
 {
 	return mRoot==nullptr;
 }
 
-template <typename T>
-T RBTree<T>::getRootKey() const
+template <typename T, template <typename> class Alloc, bool Counted, bool Packed, typename Stats>
+T RBTree<T, Alloc, Counted, Packed, Stats>::getRootKey() const
 {
 	return (rootIsNullptr()) ? ~0ull : mRoot->mKey;
 }
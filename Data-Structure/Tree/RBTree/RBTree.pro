@@ -1,11 +1,21 @@
 TEMPLATE = app
-CONFIG += console c++17
+CONFIG += console c++17 thread
 CONFIG -= app_bundle
 CONFIG -= qt
 
+# DEFINES += RBTREE_VALIDATE_INTERVAL=1024	# 每修改1024次校验一遍整棵树
+# DEFINES += TIMES_PERF=0	# 关掉Times.h中的硬件计数器（perf_event_open）
+
 SOURCES += \
     main.cpp
 
 HEADERS += \
+    ConcurrentRBTree.h \
+    EytzingerIndex.h \
+    PRBTree.h \
     RBTree.h \
-    Times.h
+    Times.h \
+    TreeIO.h \
+    TreeMetrics.h \
+    TreeStats.h \
+    Workload.h
@@ -0,0 +1,362 @@
+#ifndef TREEMETRICS_H
+#define TREEMETRICS_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "TreeIO.h"
+#include "TreeStats.h"
+
+namespace Viclib
+{
+
+/*	长期运行的树对外暴露的指标，全部是O(1)取得的值：结点数、高度、黑高、结点字节数、分配器占用的字节数和TreeStats中的计数
+ *	树在每次修改后把这些值写进自己的TreeMetricsSlot（relaxed原子写），抓取线程只读原子量，不锁树也不遍历树
+ */
+enum TreeMetric
+{
+	METRIC_COUNT, METRIC_HEIGHT, METRIC_BLACK_HEIGHT, METRIC_NODE_BYTES, METRIC_ALLOC_BYTES,
+	METRIC_ROTATIONS, METRIC_DOUBLE_ROTATIONS, METRIC_RECOLORS, METRIC_FIXUPS, METRIC_SEARCHES, METRIC_COMPARISONS,
+	TREE_METRICS
+};
+
+static char const* const TREE_METRIC_NAMES[TREE_METRICS] =
+{
+	"tree_nodes", "tree_height", "tree_black_height", "tree_node_bytes", "tree_alloc_bytes",
+	"tree_rotations_total", "tree_double_rotations_total", "tree_recolors_total", "tree_fixups_total", "tree_searches_total", "tree_comparisons_total"
+};
+
+static char const* const TREE_METRIC_HELP[TREE_METRICS] =
+{
+	"Number of keys in the tree",
+	"Tree height (red-black trees report the 2*black-height bound)",
+	"Black nodes on every root-to-leaf path (red-black trees only)",
+	"Bytes held by live nodes",
+	"Bytes reserved by the node allocator",
+	"Single rotations",
+	"Double rotations",
+	"Recolorings during red-black fix-up",
+	"Fix-up rounds",
+	"Searches",
+	"Nodes compared during searches"
+};
+
+static bool const TREE_METRIC_COUNTER[TREE_METRICS] =		// Prometheus的TYPE：counter只增不减，其余为gauge
+{
+	false, false, false, false, false,
+	true, true, true, true, true, true
+};
+
+/*	一棵树的指标槽，由TreeMetricsRegistry::add()创建，树和注册表共同持有
+ *	树析构后槽随之释放，注册表下次抓取时自动跳过
+ */
+class TreeMetricsSlot
+{
+public:
+	TreeMetricsSlot(const std::string& name, const std::string& kind);
+	TreeMetricsSlot(const TreeMetricsSlot&) = delete;
+	TreeMetricsSlot& operator = (const TreeMetricsSlot&) = delete;
+
+	void publish(uint64_t count, uint64_t height, uint64_t blackHeight, uint64_t nodeBytes, uint64_t allocBytes, const TreeStats& stats);
+	uint64_t get(TreeMetric metric) const;
+
+	const std::string& getName() const;
+	const std::string& getKind() const;
+
+private:
+	std::string mName;			// 树的名字，作为Prometheus的tree标签
+	std::string mKind;			// 树的种类，rb或avl
+	std::atomic<uint64_t> mValues[TREE_METRICS];
+};
+
+inline TreeMetricsSlot::TreeMetricsSlot(const std::string& name, const std::string& kind) : mName(name), mKind(kind)
+{
+	for ( std::atomic<uint64_t>& value : mValues )
+		value.store(0ull, std::memory_order_relaxed);
+}
+
+inline void TreeMetricsSlot::publish(uint64_t count, uint64_t height, uint64_t blackHeight, uint64_t nodeBytes, uint64_t allocBytes, const TreeStats& stats)
+{
+	uint64_t const values[TREE_METRICS] =
+	{
+		count, height, blackHeight, nodeBytes, allocBytes,
+		stats.mRotations, stats.mDoubleRotations, stats.mRecolors, stats.mFixUps, stats.mSearches, stats.mComparisons
+	};
+
+	for ( int i = 0; i < TREE_METRICS; ++i )		// 各项之间不保证是同一时刻的值，对监控足够，换来写入方没有任何同步开销
+		mValues[i].store(values[i], std::memory_order_relaxed);
+}
+
+inline uint64_t TreeMetricsSlot::get(TreeMetric metric) const
+{
+	return mValues[metric].load(std::memory_order_relaxed);
+}
+
+inline const std::string& TreeMetricsSlot::getName() const
+{
+	return mName;
+}
+
+inline const std::string& TreeMetricsSlot::getKind() const
+{
+	return mKind;
+}
+
+/*	进程内所有树的指标注册表，一般用instance()这一个全局实例
+ *	add()和抓取由互斥锁保护，只在注册和抓取时加锁，树的修改路径上不碰这把锁
+ */
+class TreeMetricsRegistry
+{
+public:
+	static TreeMetricsRegistry& instance();
+
+	std::shared_ptr<TreeMetricsSlot> add(const std::string& name, const std::string& kind);
+	std::string prometheus();					// Prometheus文本格式（0.0.4）
+	std::string json();							// {"trees": [{"name": ..., "kind": ..., "tree_nodes": ..., ...}, ...]}
+
+private:
+	std::mutex mMutex;
+	std::vector<std::weak_ptr<TreeMetricsSlot>> mSlots;
+
+	std::vector<std::shared_ptr<TreeMetricsSlot>> live();	// 取出仍存活的槽，顺便清掉已释放的
+};
+
+inline TreeMetricsRegistry& TreeMetricsRegistry::instance()
+{
+	static TreeMetricsRegistry ret;
+
+	return ret;
+}
+
+inline std::shared_ptr<TreeMetricsSlot> TreeMetricsRegistry::add(const std::string& name, const std::string& kind)
+{
+	std::shared_ptr<TreeMetricsSlot> ret = std::make_shared<TreeMetricsSlot>(name, kind);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mSlots.push_back(ret);
+
+	return ret;
+}
+
+inline std::vector<std::shared_ptr<TreeMetricsSlot>> TreeMetricsRegistry::live()
+{
+	std::vector<std::shared_ptr<TreeMetricsSlot>> ret;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t kept = 0;
+	for ( size_t i = 0; i < mSlots.size(); ++i )
+	{
+		std::shared_ptr<TreeMetricsSlot> slot = mSlots[i].lock();
+		if ( slot == nullptr )
+			continue;
+		ret.push_back(slot);
+		mSlots[kept++] = mSlots[i];
+	}
+	mSlots.resize(kept);
+
+	return ret;
+}
+
+inline std::string TreeMetricsRegistry::prometheus()
+{
+	std::vector<std::shared_ptr<TreeMetricsSlot>> const slots = live();
+	std::string ret;
+	char number[24];
+
+	for ( int m = 0; m < TREE_METRICS; ++m )
+	{
+		ret += "# HELP ";
+		ret += TREE_METRIC_NAMES[m];
+		ret += ' ';
+		ret += TREE_METRIC_HELP[m];
+		ret += "\n# TYPE ";
+		ret += TREE_METRIC_NAMES[m];
+		ret += TREE_METRIC_COUNTER[m] ? " counter\n" : " gauge\n";
+
+		for ( const std::shared_ptr<TreeMetricsSlot>& slot : slots )
+		{
+			snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(slot->get(static_cast<TreeMetric>(m))));
+			ret += TREE_METRIC_NAMES[m];
+			ret += "{tree=\"" + slot->getName() + "\",kind=\"" + slot->getKind() + "\"} ";
+			ret += number;
+			ret += '\n';
+		}
+	}
+
+	return ret;
+}
+
+inline std::string TreeMetricsRegistry::json()
+{
+	std::vector<std::shared_ptr<TreeMetricsSlot>> const slots = live();
+	std::string ret = "{\"trees\": [";
+	char number[24];
+
+	for ( size_t i = 0; i < slots.size(); ++i )
+	{
+		ret += (i == 0) ? "\n  {" : ",\n  {";
+		ret += "\"name\": \"" + slots[i]->getName() + "\", \"kind\": \"" + slots[i]->getKind() + "\"";
+		for ( int m = 0; m < TREE_METRICS; ++m )
+		{
+			snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(slots[i]->get(static_cast<TreeMetric>(m))));
+			ret += ", \"";
+			ret += TREE_METRIC_NAMES[m];
+			ret += "\": ";
+			ret += number;
+		}
+		ret += '}';
+	}
+	ret += slots.empty() ? "]}\n" : "\n]}\n";
+
+	return ret;
+}
+
+/*	后台线程按固定间隔把注册表写出去，析构时停止线程并最后写一次
+ *	target是文件路径时先写path.tmp再rename()，读的一方（比如node_exporter的textfile目录）不会读到写了一半的文件；
+ *	target以unix:开头时每次连接这个Unix域套接字，写完即断开，由监听的一方接收
+ */
+class TreeMetricsWriter
+{
+public:
+	enum Format { PROMETHEUS, JSON };
+
+	TreeMetricsWriter(const std::string& target, Format format = PROMETHEUS,
+					  std::chrono::milliseconds interval = std::chrono::milliseconds(10000),
+					  TreeMetricsRegistry& registry = TreeMetricsRegistry::instance());
+	TreeMetricsWriter(const TreeMetricsWriter&) = delete;
+	TreeMetricsWriter& operator = (const TreeMetricsWriter&) = delete;
+	~TreeMetricsWriter();
+
+	bool writeOnce();							// 立即写出一次，返回是否成功
+	uint64_t getWrites() const;					// 成功写出的次数
+
+private:
+	std::string mTarget;
+	Format mFormat;
+	std::chrono::milliseconds mInterval;
+	TreeMetricsRegistry& mRegistry;
+	std::atomic<uint64_t> mWrites;
+
+	std::mutex mWriteMutex;						// writeOnce()可能同时被后台线程和调用者执行，两次写出共用同一个临时文件
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	bool mStop;
+	std::thread mThread;
+
+	void run();
+	bool writeFile(const std::string& text);
+	bool writeSocket(const std::string& path, const std::string& text);
+};
+
+inline TreeMetricsWriter::TreeMetricsWriter(const std::string& target, Format format, std::chrono::milliseconds interval, TreeMetricsRegistry& registry) :
+	mTarget(target), mFormat(format), mInterval(interval), mRegistry(registry), mWrites(0ull), mStop(false)
+{
+	mThread = std::thread(&TreeMetricsWriter::run, this);
+}
+
+inline TreeMetricsWriter::~TreeMetricsWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWake.notify_one();
+	mThread.join();
+
+	writeOnce();
+}
+
+inline void TreeMetricsWriter::run()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	while ( !mWake.wait_for(lock, mInterval, [this] { return mStop; }) )
+	{
+		lock.unlock();
+		writeOnce();
+		lock.lock();
+	}
+}
+
+inline bool TreeMetricsWriter::writeOnce()
+{
+	std::string const text = (mFormat == JSON) ? mRegistry.json() : mRegistry.prometheus();
+	std::lock_guard<std::mutex> lock(mWriteMutex);
+	bool const ok = (mTarget.compare(0, 5, "unix:") == 0) ? writeSocket(mTarget.substr(5), text) : writeFile(text);
+
+	if ( ok )
+		mWrites.fetch_add(1ull, std::memory_order_relaxed);
+
+	return ok;
+}
+
+inline uint64_t TreeMetricsWriter::getWrites() const
+{
+	return mWrites.load(std::memory_order_relaxed);
+}
+
+inline bool TreeMetricsWriter::writeFile(const std::string& text)
+{
+	TreeWriter writer(mTarget.c_str(), TreeWriter::BINARY, '\n', text.size());	// 先写mTarget.tmp，commit()时替换，读取方不会看到半个文件
+	writer.putBytes(text.data(), text.size());
+
+	return writer.commit();
+}
+
+inline bool TreeMetricsWriter::writeSocket(const std::string& path, const std::string& text)
+{
+#ifdef _WIN32
+	(void)path;
+	(void)text;
+	return false;
+#else
+	sockaddr_un address;
+	if ( path.size() >= sizeof(address.sun_path) )
+		return false;
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if ( fd < 0 )
+		return false;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, path.c_str(), path.size());
+
+	bool ok = ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	char const* data = text.data();
+	size_t left = text.size();
+	while ( ok && left > 0 )		// 用send()而不是write()，对方提前断开时返回EPIPE而不是收到SIGPIPE
+	{
+		ssize_t ret = ::send(fd, data, left, MSG_NOSIGNAL);
+		if ( ret < 0 )
+			ok = (errno == EINTR);
+		else
+		{
+			data += ret;
+			left -= static_cast<size_t>(ret);
+		}
+	}
+	::close(fd);
+
+	return ok;
+#endif
+}
+
+}
+
+#endif // TREEMETRICS_H
@@ -1,21 +1,25 @@
+#include "EytzingerIndex.h"
+#include "PRBTree.h"
 #include "RBTree.h"
 
 #include "Times.h"
+#include "Workload.h"
 
 using namespace std;
 using namespace Viclib;
 
 typedef uint64_t templateType;
-typedef uint64_t sizeType;
+typedef TreeNoStats statsType;		// 换成TreeCountStats统计旋转、变色、修正轮数和比较次数
+typedef RBTree<templateType, RBTNodePool, false, true, statsType> treeType;	// 颜色压缩进父指针，结点32字节
 
-static bool checkTree(RBTree<templateType>* tree);
+static KeyDistribution const distribution = KEYS_PERMUTATION;	// 插入顺序；改成KEYS_SEQUENTIAL、KEYS_CLUSTERED等可以观察不同的插入模式
 
 int main(int argc, char* argv[])
 {
 	// msys2终端1920*2宽424个英文字符
 	uint16_t layer = 16;
 
-	if ( argc == 2 && atoi(argv[1])>=0 )
+	if ( argc >= 2 && atoi(argv[1])>=0 )
 		layer = static_cast<uint16_t>(atoi(argv[1]));
 	else {
 		cout << "请输入结点层数，注意内存大小" << endl;
@@ -30,36 +34,45 @@ int main(int argc, char* argv[])
 	cout << "您设定的最大层数上限：" << layer << endl;
 	cout << "您设定的最大结点数上限：" << count << endl;
 
-	templateType *t = nullptr, tmp = 0;
-	RBTree<templateType>* tree = new RBTree<templateType>();
+	templateType *t = nullptr;
+	treeType* tree = new treeType();
 
-	cout << endl << "添加元素：\n\tkey\tcount\tlayer" << endl;
-	srand(static_cast<uint32_t>(time(nullptr)));
-	while ( tree->getCount() < count )
+	unique_ptr<TreeMetricsWriter> metrics;
+	if ( argc >= 5 )						// 第四个参数是指标输出目标：文件路径或unix:套接字路径，每秒写出一次Prometheus文本
 	{
-		do
-		{
-			tmp = static_cast<templateType>(
-				static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				% (count*2));
-		} while(tree->iterativeSearch(tmp));
-		//tmp = setArr(count);
-		tree->insert(tmp);
-		//cout << "插入：\t" << tmp << "\t" << tree->getCount() << "\t" << tree->getHeight(true) << endl;
-		
+		tree->attachMetrics("main");
+		metrics.reset(new TreeMetricsWriter(argv[4], TreeMetricsWriter::PROMETHEUS, chrono::milliseconds(1000)));
+	}
+
+	uint64_t const seed = static_cast<uint64_t>(time(nullptr));
+	vector<uint64_t> const keys = generateKeys(distribution, count, count*2, seed);	// 预先生成，插入循环里不再产生随机数和重试
+
+	LatencyHistogram insertLatency, searchLatency, removeLatency;	// 单次操作的延迟分布，看旋转和变色带来的长尾
+
+	cout << endl << "添加元素（" << KEY_DISTRIBUTION_NAMES[distribution] << "）：\n\tkey\tcount\tlayer" << endl;
+	ScopedTimer insertTimer("insert", keys.size());
+	for ( uint64_t key : keys )
+	{
+		uint64_t const begin = cycleStart();
+		bool const inserted = tree->tryInsert(static_cast<templateType>(key)).second;
+		insertLatency.record(cycleEnd() - begin);
+		if ( !inserted )					// 可能重复的分布里已存在的key直接跳过
+			continue;
+		//cout << "插入：\t" << key << "\t" << tree->getCount() << "\t" << tree->getHeight(true) << endl;
+
 		if ( (tree->getCount()*100%count) == 0 || tree->getCount() == count )
 			cout << "\r已添加：" << setw(2) << tree->getCount()*100.0/count << '%' << flush;
 	}
+	insertTimer.stop();
 	cout << endl;
 
+	char const* reason = nullptr;
 	cout << "\n红黑树平衡校验结果：";
-	if ( checkTree(tree) )
+	if ( tree->validate(&reason) )
 		cout << "成功\n" << endl;
 	else
 	{
-		cout << "节点的路径与左边第一个节点路径黑色数量不同\n" << endl;
+		cout << reason << "\n" << endl;
 
 		cout << "输出目录树模式关系图：" << endl;
 		tree->printTree();
@@ -68,6 +81,7 @@ int main(int argc, char* argv[])
 		exit(1);
 	}
 
+	ScopedTimer traverseTimer("traverse");
 	cout << "前序遍历: ";
 	tree->preOrder();
 	cout << "\n中序遍历: ";
@@ -77,6 +91,7 @@ int main(int argc, char* argv[])
 	cout << "\n广度优先: ";
 	tree->levelOrder();
 	cout << endl;
+	traverseTimer.stop();
 
 	if ( (tree!=nullptr) && ((t = const_cast<templateType*>(tree->minimum())) != nullptr) )
 		cout << "最小结点：" << *t << endl;
@@ -84,6 +99,11 @@ int main(int argc, char* argv[])
 		cout << "最大结点：" << *t << endl;
 	cout << "树的结点数：" << tree->getCount() << endl;
 	cout << "树的高度（不含最底层叶节点）：" << tree->getHeight(true) << endl;
+	cout << "树的黑高：" << tree->getBlackHeight() << "\t高度上界：" << tree->getHeightBound() << endl;
+	cout << "各层结点数：";
+	for ( uint64_t n : tree->getDepthHistogram() )
+		cout << n << " ";
+	cout << endl;
 
 //	cout << "输出树形关系图：" << endl;
 //	tree->printGraph();
@@ -93,94 +113,133 @@ int main(int argc, char* argv[])
 	tree->printTree();
 	cout << endl;
 
-	cout << "开始删除：\n\tkey\tcount\tlayer" << endl;
-	srand(static_cast<uint32_t>(time(nullptr)));
-	while ( !tree->rootIsNullptr() )		// 随机数删除
-	{
-		do
+	{										// 冻结成Eytzinger只读索引，与树上的查找比较结果和耗时
+		EytzingerIndex<templateType> index(*tree);
+		uint64_t const lookups = count < (1ull<<20) ? (1ull<<20) : count;
+		vector<uint64_t> const probes = generateKeys(KEYS_UNIFORM, lookups, count*2, seed+1);
+		uint64_t treeHits = 0, indexHits = 0, searchHits = 0;
+		bool same = true;
+
+		ScopedTimer treeTimer("search", lookups);
+		for ( uint64_t key : probes )
+			treeHits += tree->iterativeSearch(static_cast<templateType>(key)) != nullptr;
+		double const treeSeconds = treeTimer.stop();
+		ScopedTimer indexTimer("eytzinger", lookups);
+		for ( uint64_t key : probes )
+			indexHits += index.contains(static_cast<templateType>(key));
+		double const indexSeconds = indexTimer.stop();
+
+		for ( uint64_t key : probes )		// 单次查找的延迟另外测一遍，不影响上面的批量比较
 		{
-			tmp = static_cast<templateType>(
-				static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				* static_cast<sizeType>(rand())
-				% (count*2));
-		} while(!tree->iterativeSearch(tmp));
-		if ( tree->remove(tree->getRootKey()) )
-		{
-			//cout << "删除：\t" << tmp << "\t" << tree->getCount() << "\t" << tree->getHeight(true) << endl;
-
-			if ( (tree->getCount()*100%count) == 0 || tree->getCount() == count )
-				cout << "\r已删除：" << setw(2) << (count-tree->getCount())*100.0/count << '%' << flush;
+			uint64_t const begin = cycleStart();
+			searchHits += tree->iterativeSearch(static_cast<templateType>(key)) != nullptr;
+			searchLatency.record(cycleEnd() - begin);
 		}
-	}
-	cout << endl;
 
-	tree->destroy();
-	tree = nullptr;
-
-	cout << endl;
-	timingEnd();
-
-	return 0;
-}
-
-static bool checkTree(RBTree<templateType>* tree)
-{
-	if ( tree == nullptr )
-		return true;
-
-	queue<RBTNode<templateType>*> tmp;
-	tmp.push(tree->search(tree->getRootKey()));
-	queue<RBTNode<templateType>*> leaf;
-	RBTNode<templateType>* t;
-	uint8_t i = 0;
-	uint8_t j = 0;
-
-	while( tmp.size() > 0 )
-	{
-		t = tmp.front();
+		for ( uint64_t i = 0; same && i < 1024 && i < lookups; ++i )
+		{
+			templateType key = static_cast<templateType>(probes[i]);
+			templateType const* lb = index.lower_bound(key);
+			auto it = tree->lower_bound(key);
+			same = (it == tree->end()) ? (lb == nullptr) : (lb != nullptr && *lb == *it);
+		}
 
-		if ( t->mLeft != nullptr )
-			tmp.push(t->mLeft);
-		else
-			leaf.push(t);
+		cout << "Eytzinger索引：" << (treeHits == indexHits && treeHits == searchHits && same ? "结果一致" : "结果不一致")
+			 << "\t树查找 " << treeSeconds*1e9/lookups << " ns/次"
+			 << "\t索引查找 " << indexSeconds*1e9/lookups << " ns/次" << endl;
+	}
 
-		if ( t->mRight != nullptr )
-			tmp.push(t->mRight);
-		else
-			leaf.push(t);
+	{										// 持久化红黑树自检：边修改边拍快照，修改后旧快照的内容不能变，其它版本释放后最后一个快照不再与谁共享结点
+		uint64_t const n = keys.size() < (1ull<<16) ? keys.size() : (1ull<<16);
+		vector<PRBTree<templateType>> snapshots;
+		vector<vector<templateType>> contents;		// 拍快照时的内容
+		bool ok = true;
+		{
+			PRBTree<templateType> ptree;
+			auto take = [&ptree, &snapshots, &contents]
+			{
+				snapshots.push_back(ptree.snapshot());
+				contents.emplace_back();
+				ptree.forEachInOrder([&contents](const templateType& key) { contents.back().push_back(key); });
+			};
+
+			for ( uint64_t i = 0; i < n; ++i )
+			{
+				ptree.insert(static_cast<templateType>(keys[i]));
+				if ( (i & (i+1)) == 0 )				// 1、2、4、8...个结点时各拍一次
+					take();
+			}
+			take();
+			for ( uint64_t i = 0; i < n; i += 2 )	// 删掉一半，被快照共享的路径要先复制
+				ptree.remove(static_cast<templateType>(keys[i]));
+			take();
+			for ( uint64_t i = 0; i < n; i += 2 )	// 再插回去
+				ptree.insert(static_cast<templateType>(keys[i]));
+			ok = ptree.validate() && ptree.getCount() == contents[contents.size()-2].size();
+		}											// 当前版本先释放，快照仍然持有各自的结点
+
+		for ( size_t i = 0; ok && i < snapshots.size(); ++i )
+		{
+			vector<templateType> now;
+			snapshots[i].forEachInOrder([&now](const templateType& key) { now.push_back(key); });
+			ok = snapshots[i].validate() && now == contents[i];
+		}
+		size_t const taken = snapshots.size();
+		PRBTree<templateType> last = move(snapshots.back());
+		ok = ok && last.getSharedCount() > 0;		// 与前面的快照共享着结点
+		snapshots.clear();
+		ok = ok && last.getSharedCount() == 0;		// 释放的版本都归还了引用，剩下的结点引用计数全是1
 
-		tmp.pop();
+		cout << "持久化红黑树：" << taken << "个快照" << (ok ? "校验成功" : "校验失败") << endl;
 	}
 
-	t = leaf.front();
-	leaf.pop();
-	while ( t != nullptr )
+	if ( argc >= 3 )						// 第二个参数是导出文件路径，按升序每行一个key
+		cout << "导出到" << argv[2] << "：" << (tree->exportKeys(argv[2]) ? "成功" : "失败") << endl;
+	if ( argc >= 4 )						// 第三个参数是快照文件路径，保存后重新载入并校验
 	{
-		if ( t->mColor == BLACK ) ++i;
-		t = t->mParent;
+		treeType loaded;
+		bool ok = tree->save(argv[3]) && loaded.load(argv[3]) && loaded.getCount() == tree->getCount() && loaded.validate();
+		cout << "快照" << argv[3] << "：" << (ok ? "成功" : "失败") << endl;
 	}
 
-	while ( !leaf.empty() )
+	cout << "开始删除：\n\tkey\tcount\tlayer" << endl;
+	vector<uint64_t> const order = generateKeys(KEYS_PERMUTATION, keys.size(), keys.size(), seed+2);	// 按插入key的另一种随机排列删除
+	ScopedTimer deleteTimer("delete", order.size());
+	for ( uint64_t i : order )
 	{
-		t = leaf.front();
-
-		j = 0;
-		if ( t->mColor == BLACK ) ++j;
-		while ( t->mParent != nullptr )
+		uint64_t const begin = cycleStart();
+		bool const removed = tree->remove(static_cast<templateType>(keys[i]));
+		removeLatency.record(cycleEnd() - begin);
+		if ( removed )
 		{
-			t = t->mParent;
-			if ( t->mColor == BLACK ) ++j;
-		}
+			//cout << "删除：\t" << keys[i] << "\t" << tree->getCount() << "\t" << tree->getHeight(true) << endl;
 
-		if ( i != j )
-		{
-			cout << leaf.front()->mKey;
-			return false;
+			if ( (tree->getCount()*100%count) == 0 || tree->getCount() == count )
+				cout << "\r已删除：" << setw(2) << (count-tree->getCount())*100.0/count << '%' << flush;
 		}
+	}
+	deleteTimer.stop();
+	cout << endl;
 
-		leaf.pop();
+	cout << "单次操作延迟：" << endl;
+	insertLatency.print("insert");
+	searchLatency.print("search");
+	removeLatency.print("remove");
+	if constexpr ( !is_same<statsType, TreeNoStats>::value )
+	{
+		TreeStats const stats = tree->stats();
+		cout << "结构统计：旋转 " << stats.mRotations << "\t双旋 " << stats.mDoubleRotations << "\t变色 " << stats.mRecolors
+			 << "\t修正 " << stats.mFixUps << "\t查找 " << stats.mSearches
+			 << "\t每次查找比较 " << (stats.mSearches > 0 ? static_cast<double>(stats.mComparisons) / stats.mSearches : 0.0) << endl;
 	}
 
-	return true;
+	tree->destroy();
+	tree = nullptr;
+	if ( metrics != nullptr )
+		cout << "指标" << argv[4] << "：已写出" << (metrics->writeOnce() ? metrics->getWrites() : 0) << "次" << endl;
+
+	cout << endl;
+	timingEnd();
+
+	return 0;
 }
@@ -0,0 +1,140 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+
+#include "ConcurrentRBTree.h"
+
+#include "Times.h"
+#include "Workload.h"
+
+using namespace std;
+using namespace Viclib;
+
+typedef uint64_t templateType;
+
+/*	每个线程执行ops次操作，其中writePercent%是写操作（交替插入、删除奇数key，结点数基本不变），其余是查找
+ *	每个线程的key和读写类型在计时之前生成好，计时区间里只有树的操作
+ *	返回所有线程合计的吞吐量（百万次操作/秒）
+ */
+template <typename Lookup, typename Update>
+static double runThreads(uint16_t threads, uint64_t ops, uint16_t writePercent, uint64_t range, Lookup lookup, Update update)
+{
+	vector<vector<uint64_t>> keys(threads);
+	vector<vector<uint8_t>> writes(threads);
+	for ( uint16_t i=0; i<threads; ++i )
+	{
+		WorkloadRandom random((i+1ull) ^ 0x9e3779b97f4a7c15ull);	// 读写类型与key用不同的种子，否则两者来自同一个随机数，写操作全落在key范围的低端
+		keys[i] = generateKeys(KEYS_UNIFORM, ops, range, i+1ull);
+		writes[i].resize(ops);
+		for ( uint8_t& write : writes[i] )
+			write = random.below(100) < writePercent;
+	}
+
+	vector<thread> workers;
+	atomic<uint64_t> hits(0ull);
+
+	auto begin = chrono::steady_clock::now();
+	for ( uint16_t i=0; i<threads; ++i )
+	{
+		workers.emplace_back([=, &keys, &writes, &hits]()
+		{
+			uint64_t const* key = keys[i].data();
+			uint8_t const* write = writes[i].data();
+			uint64_t found = 0;
+
+			for ( uint64_t n=0; n<ops; ++n )
+			{
+				if ( write[n] )
+					update(static_cast<templateType>(key[n] | 1ull), (n & 1ull) == 0);
+				else
+					found += lookup(static_cast<templateType>(key[n]));
+			}
+
+			hits.fetch_add(found, memory_order_relaxed);
+		});
+	}
+
+	for ( thread& t : workers )
+		t.join();
+	auto end = chrono::steady_clock::now();
+
+	return threads*ops / chrono::duration<double, micro>(end-begin).count();
+}
+
+int main(int argc, char* argv[])
+{
+	uint16_t layer = 20;
+	uint16_t maxThreads = static_cast<uint16_t>(thread::hardware_concurrency());
+	uint16_t writePercent = 1;
+	uint64_t const ops = 1ull<<20;		// 每个线程的操作数
+
+	if ( argc >= 2 && atoi(argv[1])>0 )
+	{
+		layer = static_cast<uint16_t>(atoi(argv[1]));
+		if ( argc >= 3 && atoi(argv[2])>0 )
+			maxThreads = static_cast<uint16_t>(atoi(argv[2]));
+		if ( argc >= 4 && atoi(argv[3])>=0 )
+			writePercent = static_cast<uint16_t>(atoi(argv[3]));
+	}
+	else {
+		cout << "请输入结点层数、最大线程数、写操作百分比，注意内存大小" << endl;
+		cin >> layer >> maxThreads >> writePercent;
+	}
+	if ( maxThreads == 0 )
+		maxThreads = 1;
+
+	timingStart();
+	cout << endl;
+
+	uint64_t const count = (1ull<<layer)-1ull;
+	vector<templateType> keys(count);
+	for ( uint64_t i=0; i<count; ++i )		// 预置全部偶数key，查找命中率约50%
+		keys[i] = static_cast<templateType>(i*2);
+
+	ScopedTimer buildTimer("build", count*2);
+	ConcurrentRBTree<templateType> concurrent;
+	concurrent.buildFromSorted(keys.begin(), keys.end());
+
+	RBTree<templateType> locked;				// 对照组：整棵树一把锁
+	mutex lock;
+	locked.buildFromSorted(keys.begin(), keys.end());
+	buildTimer.stop();
+
+	cout << "结点数：" << count << "\t每线程操作数：" << ops << "\t写操作：" << writePercent << '%' << endl;
+	cout << "\n线程数\t版本号校验(Mops/s)\t全局互斥锁(Mops/s)" << endl;
+
+	for ( uint16_t threads=1; ; threads = (threads*2 > maxThreads && threads < maxThreads) ? maxThreads : threads*2 )
+	{
+		double optimistic = runThreads(threads, ops, writePercent, count*2,
+			[&](templateType key) { return concurrent.contains(key); },
+			[&](templateType key, bool add) { if ( add ) concurrent.insert(key); else concurrent.remove(key); });
+
+		double mutexed = runThreads(threads, ops, writePercent, count*2,
+			[&](templateType key) { lock_guard<mutex> guard(lock); return locked.iterativeSearch(key) != nullptr; },
+			[&](templateType key, bool add)
+			{
+				lock_guard<mutex> guard(lock);
+				if ( add )
+					locked.tryInsert(key);
+				else
+					locked.remove(key);
+			});
+
+		cout << threads << "\t" << fixed << setprecision(2) << optimistic << "\t\t\t" << mutexed << endl;
+
+		if ( threads >= maxThreads )
+			break;
+	}
+
+	cout << "\n读者重试次数：" << concurrent.getRetries() << endl;
+	cout << "树的结点数：" << concurrent.getCount() << endl;
+
+	concurrent.destroy();
+	locked.destroy();
+
+	cout << endl;
+	timingEnd();
+
+	return 0;
+}